@@ -0,0 +1,404 @@
+/*
+ * bmw_bench.cpp
+ *
+ * Replay benchmark for the BMW CarData → local MQTT forward path
+ * Copyright (c) 2025 Kurt, DJ0ABR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+// bmw_bench.cpp
+//
+// Purpose:
+//   Feed a corpus of recorded CarData messages straight into on_bmw_message()
+//   and measure what each forwarded message costs on this machine.
+//
+//   The bridge source is compiled into this binary (BMW_BRIDGE_NO_MAIN), so the
+//   measured code is exactly the code that runs in bmw_mqtt_bridge. Local
+//   publishes go to an in-process stand-in broker on 127.0.0.1 that answers
+//   CONNECT/PINGREQ/PUBLISH(QoS1) and discards everything else, so no real
+//   Mosquitto is needed and the numbers do not depend on broker load.
+//
+//   Every run is repeated for SPLIT_TOPICS and MQTT_RETAIN on/off and reports
+//   msgs/s, payload bytes/s, per-message latency (p50/p99/p999) and
+//   operator-new allocations per message.
+//
+// Build:
+//   ./scripts/compile.sh bench      (→ bench/bmw_bench; with -Wno-unused-function
+//                                    -Wno-unused-variable for the helpers only the
+//                                    bridge's main() uses)
+//
+// Usage:
+//   bench/bmw_bench [corpus-file] [iterations]
+//     corpus-file : default bench/corpus/cardata_sample.txt
+//     iterations  : passes over the corpus per configuration (default 200)
+//
+// Corpus format (one message per line, same as `mosquitto_sub -v` output):
+//   <topic> <payload>
+//   A recording of the bridge's own raw output works directly:
+//     mosquitto_sub -v -t 'bmw/raw/#' > my_corpus.txt
+//   (topics "<prefix>raw/<VIN>..." are mapped back to "<GCID>/<VIN>...")
+//
+// Bridge log output (stderr) is sent to /dev/null during measurement so the
+// log cost stays in the numbers but does not flood the terminal.
+//
+// ------------------------------------------------------------------------
+
+#define BMW_BRIDGE_NO_MAIN
+#include "../src/bmw_mqtt_bridge.cpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <new>
+
+// ===================== Allocation counter =====================
+// Every replaceable operator new/delete goes through the two functions below,
+// so all pairs are malloc/free (aligned_alloc for over-aligned types) and the
+// compiler never sees a new/free or malloc/delete mismatch after inlining.
+static std::atomic<unsigned long long> g_bench_allocs{0};
+
+__attribute__((noinline)) static void* bench_alloc(std::size_t n, std::size_t align){
+    g_bench_allocs.fetch_add(1, std::memory_order_relaxed);
+    if (n == 0) n = 1;
+    if (align <= alignof(std::max_align_t)) return std::malloc(n);
+    return std::aligned_alloc(align, (n + align - 1) / align * align);   // size must be a multiple
+}
+__attribute__((noinline)) static void bench_free(void* p) noexcept { std::free(p); }
+
+static void* bench_alloc_or_throw(std::size_t n, std::size_t align){
+    if (void* p = bench_alloc(n, align)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new  (std::size_t n) { return bench_alloc_or_throw(n, 0); }
+void* operator new[](std::size_t n) { return bench_alloc_or_throw(n, 0); }
+void* operator new  (std::size_t n, std::align_val_t a) { return bench_alloc_or_throw(n, (std::size_t)a); }
+void* operator new[](std::size_t n, std::align_val_t a) { return bench_alloc_or_throw(n, (std::size_t)a); }
+void* operator new  (std::size_t n, const std::nothrow_t&) noexcept { return bench_alloc(n, 0); }
+void* operator new[](std::size_t n, const std::nothrow_t&) noexcept { return bench_alloc(n, 0); }
+void* operator new  (std::size_t n, std::align_val_t a, const std::nothrow_t&) noexcept { return bench_alloc(n, (std::size_t)a); }
+void* operator new[](std::size_t n, std::align_val_t a, const std::nothrow_t&) noexcept { return bench_alloc(n, (std::size_t)a); }
+
+void operator delete  (void* p) noexcept { bench_free(p); }
+void operator delete[](void* p) noexcept { bench_free(p); }
+void operator delete  (void* p, std::size_t) noexcept { bench_free(p); }
+void operator delete[](void* p, std::size_t) noexcept { bench_free(p); }
+void operator delete  (void* p, std::align_val_t) noexcept { bench_free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { bench_free(p); }
+void operator delete  (void* p, std::size_t, std::align_val_t) noexcept { bench_free(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { bench_free(p); }
+void operator delete  (void* p, const std::nothrow_t&) noexcept { bench_free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { bench_free(p); }
+void operator delete  (void* p, std::align_val_t, const std::nothrow_t&) noexcept { bench_free(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { bench_free(p); }
+
+// ===================== Corpus =====================
+struct BenchMsg {
+    std::string topic;
+    std::string payload;
+};
+
+static std::vector<BenchMsg> load_corpus(const std::string& path){
+    std::vector<BenchMsg> out;
+    std::ifstream f(path);
+    if (!f) return out;
+    const std::string raw_prefix = LOCAL_PREFIX + "raw/";
+    std::string line;
+    while (std::getline(f, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+        auto sp = line.find(' ');
+        if (sp == std::string::npos) continue;
+        BenchMsg m;
+        m.topic   = line.substr(0, sp);
+        m.payload = line.substr(sp + 1);
+        if (m.topic.compare(0, raw_prefix.size(), raw_prefix) == 0) {
+            m.topic = GCID + "/" + m.topic.substr(raw_prefix.size());
+        }
+        out.push_back(std::move(m));
+    }
+    return out;
+}
+
+// ===================== Stand-in local broker =====================
+// Minimal MQTT 3.1.1/5 sink: one client, answers what libmosquitto waits for.
+struct StandInBroker {
+    int listen_fd = -1;
+    int port = 0;
+    std::thread th;
+    std::atomic<unsigned long long> publishes{0};
+    std::atomic<unsigned long long> bytes{0};
+
+    bool start(){
+        listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (listen_fd < 0) return false;
+        int one = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in a{};
+        a.sin_family = AF_INET;
+        a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        a.sin_port = 0;
+        if (::bind(listen_fd, reinterpret_cast<sockaddr*>(&a), sizeof(a)) != 0) return false;
+        if (::listen(listen_fd, 1) != 0) return false;
+        socklen_t len = sizeof(a);
+        getsockname(listen_fd, reinterpret_cast<sockaddr*>(&a), &len);
+        port = ntohs(a.sin_port);
+        th = std::thread([this]{ serve(); });
+        return true;
+    }
+
+    void stop(){
+        if (listen_fd >= 0) { ::shutdown(listen_fd, SHUT_RDWR); ::close(listen_fd); listen_fd = -1; }
+        if (th.joinable()) th.join();
+    }
+
+    static void send_all(int fd, const unsigned char* p, size_t n){
+        while (n > 0) {
+            ssize_t w = ::send(fd, p, n, MSG_NOSIGNAL);
+            if (w <= 0) return;
+            p += w; n -= (size_t)w;
+        }
+    }
+
+    void serve(){
+        int fd = ::accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) return;
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        std::vector<unsigned char> buf;
+        buf.reserve(1 << 20);
+        unsigned char tmp[64 * 1024];
+        int proto = 4;
+        for (;;) {
+            ssize_t n = ::recv(fd, tmp, sizeof(tmp), 0);
+            if (n <= 0) break;
+            bytes += (unsigned long long)n;
+            buf.insert(buf.end(), tmp, tmp + n);
+
+            size_t off = 0;
+            for (;;) {
+                // fixed header + variable length "remaining length"
+                if (buf.size() - off < 2) break;
+                size_t rem = 0, mul = 1, i = off + 1;
+                bool complete = false;
+                while (i < buf.size() && i < off + 5) {
+                    rem += (buf[i] & 0x7F) * mul;
+                    mul *= 128;
+                    if (!(buf[i++] & 0x80)) { complete = true; break; }
+                }
+                if (!complete || buf.size() - i < rem) break;
+
+                const unsigned char type = buf[off] >> 4;
+                const unsigned char* body = buf.data() + i;
+                if (type == 1 && rem >= 7) {                 // CONNECT
+                    proto = body[6];
+                    if (proto == 5) {
+                        // properties: Topic Alias Maximum 64 (like a mosquitto with max_topic_alias 64)
+                        const unsigned char ack[] = {0x20, 0x06, 0x00, 0x00, 0x03, 0x22, 0x00, 0x40};
+                        send_all(fd, ack, sizeof(ack));
+                    } else {
+                        const unsigned char ack[] = {0x20, 0x02, 0x00, 0x00};
+                        send_all(fd, ack, sizeof(ack));
+                    }
+                } else if (type == 3) {                      // PUBLISH
+                    ++publishes;
+                    int qos = (buf[off] >> 1) & 0x03;
+                    if (qos == 1 && rem >= 4) {
+                        size_t tlen = (size_t(body[0]) << 8) | body[1];
+                        if (2 + tlen + 2 <= rem) {
+                            const unsigned char ack[] = {0x40, 0x02, body[2 + tlen], body[3 + tlen]};
+                            send_all(fd, ack, sizeof(ack));
+                        }
+                    }
+                } else if (type == 12) {                     // PINGREQ
+                    const unsigned char resp[] = {0xD0, 0x00};
+                    send_all(fd, resp, sizeof(resp));
+                } else if (type == 14) {                     // DISCONNECT
+                    ::close(fd);
+                    return;
+                }
+                off = i + rem;
+            }
+            buf.erase(buf.begin(), buf.begin() + (std::ptrdiff_t)off);
+        }
+        ::close(fd);
+    }
+};
+
+// ===================== Measurement =====================
+struct BenchResult {
+    double secs = 0;
+    unsigned long long msgs = 0;
+    unsigned long long bytes = 0;
+    unsigned long long allocs = 0;
+    std::vector<uint64_t> lat_ns;
+};
+
+static uint64_t percentile(std::vector<uint64_t>& v, double p){
+    if (v.empty()) return 0;
+    size_t idx = static_cast<size_t>(p * (v.size() - 1) + 0.5);
+    std::nth_element(v.begin(), v.begin() + (std::ptrdiff_t)idx, v.end());
+    return v[idx];
+}
+
+static BenchResult run_config(const std::vector<BenchMsg>& corpus, int iterations){
+    BenchResult r;
+    r.lat_ns.reserve(corpus.size() * (size_t)iterations);
+
+    // prepare mosquitto_message views once (the real callback gets them from libmosquitto)
+    std::vector<mosquitto_message> msgs(corpus.size());
+    for (size_t i = 0; i < corpus.size(); ++i) {
+        msgs[i] = mosquitto_message{};
+        msgs[i].topic      = const_cast<char*>(corpus[i].topic.c_str());
+        msgs[i].payload    = const_cast<char*>(corpus[i].payload.data());
+        msgs[i].payloadlen = static_cast<int>(corpus[i].payload.size());
+        msgs[i].qos        = 1;
+    }
+
+    // warm-up pass (page faults, lazy init) – not measured
+    for (auto& m : msgs) on_bmw_message(nullptr, nullptr, &m);
+
+    const unsigned long long a0 = g_bench_allocs.load();
+    const auto t0 = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; ++it) {
+        for (auto& m : msgs) {
+            const auto s = std::chrono::steady_clock::now();
+            on_bmw_message(nullptr, nullptr, &m);
+            const auto e = std::chrono::steady_clock::now();
+            r.lat_ns.push_back((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(e - s).count());
+            r.bytes += (unsigned long long)m.payloadlen;
+        }
+    }
+    const auto t1 = std::chrono::steady_clock::now();
+    r.msgs   = (unsigned long long)msgs.size() * (unsigned long long)iterations;
+    r.allocs = g_bench_allocs.load() - a0;
+    r.secs   = std::chrono::duration<double>(t1 - t0).count();
+    return r;
+}
+
+static std::atomic<bool> g_bench_local_up{false};
+static void on_bench_local_connect(struct mosquitto* m, void* obj, int rc, int flags,
+                                   const mosquitto_property* props){
+    on_local_connect(m, obj, rc, flags, props);   // topic alias limit, as in the bridge
+    if (rc == 0) g_bench_local_up = true;
+}
+
+int main(int argc, char** argv){
+    const std::string corpus_path = (argc > 1) ? argv[1] : "bench/corpus/cardata_sample.txt";
+    const int iterations = (argc > 2) ? std::max(1, std::atoi(argv[2])) : 200;
+
+    // bridge configuration as main() would set it up
+    GCID               = "bench-gcid";
+    CLIENT_ID          = "bench-client";
+    LOCAL_PREFIX       = "bmw/";
+    LOCAL_STATUS_TOPIC = LOCAL_PREFIX + "status";
+
+    g_log.start();
+
+    auto corpus = load_corpus(corpus_path);
+    if (corpus.empty()) {
+        std::cerr << "✖ corpus empty or not readable: " << corpus_path << "\n";
+        return 1;
+    }
+
+    StandInBroker broker;
+    if (!broker.start()) {
+        std::cerr << "✖ cannot start stand-in broker: " << std::strerror(errno) << "\n";
+        return 2;
+    }
+
+    mosquitto_lib_init();
+    g_local = mosquitto_new("bmw-bench-forwarder", true, nullptr);
+    if (!g_local) { std::cerr << "mosquitto_new local failed\n"; return 2; }
+    if (LOCAL_MQTT5) mosquitto_int_option(g_local, MOSQ_OPT_PROTOCOL_VERSION, MQTT_PROTOCOL_V5);
+    mosquitto_connect_v5_callback_set(g_local, on_bench_local_connect);
+    if (LOCAL_MQTT5) mosquitto_publish_v5_callback_set(g_local, on_local_publish_v5);   // ACK latency, as in the bridge
+    else mosquitto_publish_callback_set(g_local, on_local_publish);
+    if (mosquitto_connect(g_local, "127.0.0.1", broker.port, 30) != MOSQ_ERR_SUCCESS) {
+        std::cerr << "connect stand-in broker failed\n"; return 3;
+    }
+    mosquitto_loop_start(g_local);
+    for (int i = 0; i < 500 && !g_bench_local_up.load(); ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    if (!g_bench_local_up.load()) { std::cerr << "stand-in broker did not CONNACK\n"; return 3; }
+
+    std::cout << "corpus: " << corpus_path << " (" << corpus.size() << " msgs), "
+              << iterations << " iterations per config\n\n";
+    std::cout << std::left
+              << std::setw(8)  << "split"  << std::setw(8)  << "retain"
+              << std::right
+              << std::setw(12) << "msgs/s" << std::setw(12) << "MB/s"
+              << std::setw(10) << "p50 us" << std::setw(10) << "p99 us" << std::setw(10) << "p999 us"
+              << std::setw(12) << "allocs/msg" << "\n";
+
+    // keep the bridge's stderr logging in the measurement, but not on screen
+    std::cerr.flush();
+    int saved_err = ::dup(STDERR_FILENO);
+    int devnull = ::open("/dev/null", O_WRONLY);
+
+    for (int split = 0; split <= 1; ++split) {
+        for (int retain = 0; retain <= 1; ++retain) {
+            SPLIT_TOPICS = split;
+            MQTT_RETAIN  = retain;
+
+            if (devnull >= 0) ::dup2(devnull, STDERR_FILENO);
+            BenchResult r = run_config(corpus, iterations);
+            g_log.flush();
+            std::cerr.flush();
+            if (saved_err >= 0) ::dup2(saved_err, STDERR_FILENO);
+
+            const double p50  = percentile(r.lat_ns, 0.50)  / 1000.0;
+            const double p99  = percentile(r.lat_ns, 0.99)  / 1000.0;
+            const double p999 = percentile(r.lat_ns, 0.999) / 1000.0;
+            std::cout << std::left
+                      << std::setw(8) << (split ? "on" : "off") << std::setw(8) << (retain ? "on" : "off")
+                      << std::right << std::fixed
+                      << std::setw(12) << std::setprecision(0) << (r.msgs / r.secs)
+                      << std::setw(12) << std::setprecision(2) << (r.bytes / r.secs / 1e6)
+                      << std::setw(10) << std::setprecision(1) << p50
+                      << std::setw(10) << std::setprecision(1) << p99
+                      << std::setw(10) << std::setprecision(1) << p999
+                      << std::setw(12) << std::setprecision(1) << (double)r.allocs / (double)r.msgs
+                      << "\n";
+        }
+    }
+    if (devnull >= 0) ::close(devnull);
+    if (saved_err >= 0) ::close(saved_err);
+
+    // let the loop thread flush what is still queued before we report the sink counters
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    std::cout << "\nstand-in broker received " << broker.publishes.load() << " PUBLISH packets, "
+              << broker.bytes.load() << " bytes\n";
+
+    mosquitto_disconnect(g_local);
+    mosquitto_loop_stop(g_local, false);
+    mosquitto_destroy(g_local);
+    g_local = nullptr;
+    broker.stop();
+    mosquitto_lib_cleanup();
+    g_log.stop();
+    return 0;
+}
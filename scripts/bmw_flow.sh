@@ -34,7 +34,8 @@
 #     - refresh_token      (→ use to refresh tokens later)
 #
 # Usage:
-#   ./bmw_flow.sh
+#   ./bmw_flow.sh            (single account)
+#   ./bmw_flow.sh <account>  (one of several accounts, see ACCOUNTS in the bridge)
 #
 # Requirements:
 #   - bash, curl, jq, openssl
@@ -47,7 +48,9 @@
 #   - Enter your real CLIENT_ID and GCID, save, exit the editor,
 #     and then rerun the script.
 #
-# Outputs (stored in ~/.local/state/bmw-mqtt-bridge, permissions 644):
+# Outputs (stored in ~/.local/state/bmw-mqtt-bridge, or in
+# ~/.local/state/bmw-mqtt-bridge/accounts/<account> with an account name;
+# permissions 644):
 #   access_token.txt
 #   id_token.txt
 #   refresh_token.txt
@@ -69,6 +72,14 @@ set -euo pipefail
 # ---------- Fixed locations (no path overrides) ----------
 STATE_BASE="${XDG_STATE_HOME:-$HOME/.local/state}"
 OUT_DIR="$STATE_BASE/bmw-mqtt-bridge"
+if [[ $# -gt 0 ]]; then
+  # own .env (CLIENT_ID/GCID) and token files per account
+  if [[ ! "$1" =~ ^[A-Za-z0-9._-]+$ || "$1" == "." || "$1" == ".." ]]; then
+    echo "Invalid account name: $1" >&2
+    exit 1
+  fi
+  OUT_DIR="$OUT_DIR/accounts/$1"
+fi
 ENV_FILE="$OUT_DIR/.env"
 
 # Ensure token dir exists
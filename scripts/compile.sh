@@ -1,20 +1,53 @@
 #!/bin/bash
 # compile.sh – build bmw_mqtt_bridge inside src directory
+#
+# Usage:
+#   ./scripts/compile.sh          build src/bmw_mqtt_bridge and src/bmw-history
+#   ./scripts/compile.sh bench    additionally build bench/bmw_bench (replay benchmark)
 
 # get the directory where this script is located
 SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
 ROOT_DIR="$(dirname "$SCRIPT_DIR")"
 SRC_DIR="$ROOT_DIR/src"
+BENCH_DIR="$ROOT_DIR/bench"
 
 cd "$SRC_DIR" || exit 1
 
 echo "Compiling bmw_mqtt_bridge..."
 g++ -std=c++17 -O2 -pthread \
   bmw_mqtt_bridge.cpp -o bmw_mqtt_bridge \
-  $(pkg-config --cflags --libs libmosquitto) -lcurl
+  $(pkg-config --cflags --libs libmosquitto) -lcurl -lssl -lcrypto
 
 if [ $? -eq 0 ]; then
   echo "✅ Build successful: $SRC_DIR/bmw_mqtt_bridge"
 else
   echo "❌ Build failed"
+  exit 1
+fi
+
+echo "Compiling bmw-history..."
+g++ -std=c++17 -O2 \
+  bmw_history.cpp -o bmw-history
+
+if [ $? -eq 0 ]; then
+  echo "✅ Build successful: $SRC_DIR/bmw-history"
+else
+  echo "❌ bmw-history build failed"
+  exit 1
+fi
+
+if [ "${1:-}" = "bench" ]; then
+  echo "Compiling bmw_bench..."
+  # the bridge source is compiled in without its main(): the helpers only
+  # main() uses are unused there
+  g++ -std=c++17 -O2 -pthread -Wno-unused-function -Wno-unused-variable \
+    "$BENCH_DIR/bmw_bench.cpp" -o "$BENCH_DIR/bmw_bench" \
+    $(pkg-config --cflags --libs libmosquitto) -lcurl -lssl -lcrypto
+
+  if [ $? -eq 0 ]; then
+    echo "✅ Build successful: $BENCH_DIR/bmw_bench"
+  else
+    echo "❌ Bench build failed"
+    exit 1
+  fi
 fi
@@ -9,6 +9,7 @@
 #   - build-essential  (compiler & linker tools)
 #   - libmosquitto-dev (MQTT client library)
 #   - libcurl4-openssl-dev (for HTTPS token refresh)
+#   - libssl-dev (TLS session resumption for the BMW connection)
 #   - jq (JSON parsing in shell scripts)
 #   - openssl (PKCE + secure randoms)
 #   - nlohmann-json3-dev (JSON header-only library for C++)
@@ -30,6 +31,7 @@ sudo apt-get install -y \
     build-essential \
     libmosquitto-dev \
     libcurl4-openssl-dev \
+    libssl-dev \
     jq \
     openssl \
     nlohmann-json3-dev \
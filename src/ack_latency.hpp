@@ -0,0 +1,182 @@
+// ack_latency.hpp
+//
+// Local broker acknowledgement latency per output class (raw, legacy, split,
+// state, status, replay).
+//
+// sent() notes the time a message was handed to mosquitto_publish under its
+// mid; acked() (publish callback) looks the mid up and records the elapsed
+// time in that class's HdrHistogram. With QoS 1 that is the time until the
+// broker's PUBACK, with QoS 0 until libmosquitto has written the message to
+// the socket (so a slow or blocked broker shows up as well).
+//
+//   interval histograms   recorded into, taken (and reset) by report(true)
+//   total histograms      everything since start (interval merged in)
+//
+// Notes:
+//   - Thread-safe: one mutex. sent() runs on the publishing thread after
+//     mosquitto_publish returned, acked() on the client's network thread, so
+//     an ack can arrive first: it is parked until its sent() shows up.
+//   - No allocation per message: mids (16 bit in MQTT) index a fixed ring of
+//     SLOTS entries; a slot reused while its message is still outstanding
+//     (more than SLOTS unacknowledged) counts that message as lost.
+//   - prune() drops messages never acknowledged (QoS 0 lost in a disconnect)
+//     and parked acks that never matched (counted, not recorded).
+//
+// Copyright (c) 2025 Kurt, DJ0ABR – MIT License (see bmw_mqtt_bridge.cpp)
+
+#pragma once
+
+#include "latency_hist.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+class AckLatencyTracker {
+public:
+    static constexpr size_t SLOTS = 16384;   // power of two
+
+    explicit AckLatencyTracker(std::vector<const char*> classes)
+        : names_(std::move(classes)), interval_(names_.size()), total_(names_.size()), slots_(SLOTS) {}
+
+    static long long now_us(){
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // message with mid was handed to the client at t_us (taken before publishing)
+    void sent(int mid, size_t cls, long long t_us){
+        if (cls >= names_.size()) return;
+        std::lock_guard<std::mutex> lk(mu_);
+        Slot& s = slot(mid);
+        if (s.state == Slot::Acked && s.mid == mid) {
+            record(cls, s.t_us - t_us);
+            s.state = Slot::Free;
+            return;
+        }
+        release(s);
+        s = Slot{t_us, mid, static_cast<uint8_t>(cls), Slot::Sent};
+        ++waiting_;
+    }
+
+    void acked(int mid){
+        const long long t = now_us();
+        std::lock_guard<std::mutex> lk(mu_);
+        Slot& s = slot(mid);
+        if (s.state == Slot::Sent && s.mid == mid) {
+            record(s.cls, t - s.t_us);
+            s.state = Slot::Free;
+            --waiting_;
+            return;
+        }
+        release(s);
+        s = Slot{t, mid, 0, Slot::Acked};
+    }
+
+    // forget sends older than max_age_us without an ack, and parked acks
+    void prune(long long max_age_us){
+        const long long now = now_us();
+        std::lock_guard<std::mutex> lk(mu_);
+        for (Slot& s : slots_)
+            if (s.state != Slot::Free && now - s.t_us > max_age_us) release(s);
+    }
+
+    // {"<class>":{"count":..,"mean":..,"p50":..,"p90":..,"p99":..,"p999":..,"max":..},...}
+    // in µs. interval = since the previous report(true), which starts a new one;
+    // otherwise since start.
+    std::string report(bool interval){
+        std::lock_guard<std::mutex> lk(mu_);
+        std::string s = "{";
+        for (size_t i = 0; i < names_.size(); ++i) {
+            HdrHistogram& h = interval ? interval_[i] : merged(i);
+            if (i) s += ',';
+            s += '"';
+            s += names_[i];
+            s += "\":";
+            append_stats(s, h);
+            if (interval) {
+                total_[i].merge(h);
+                h.reset();
+            }
+        }
+        s += '}';
+        return s;
+    }
+
+    // one line per class with acknowledged messages, since start (SIGUSR1)
+    std::string dump(){
+        std::lock_guard<std::mutex> lk(mu_);
+        std::string s;
+        char line[256];
+        for (size_t i = 0; i < names_.size(); ++i) {
+            const HdrHistogram& h = merged(i);
+            if (!h.count()) continue;
+            std::snprintf(line, sizeof(line),
+                          "  %-7s count=%llu mean=%.0f p50=%llu p90=%llu p99=%llu p99.9=%llu max=%llu\n",
+                          names_[i], (unsigned long long)h.count(), h.mean(),
+                          (unsigned long long)h.value_at(50), (unsigned long long)h.value_at(90),
+                          (unsigned long long)h.value_at(99), (unsigned long long)h.value_at(99.9),
+                          (unsigned long long)h.max());
+            s += line;
+        }
+        std::snprintf(line, sizeof(line), "  waiting=%zu lost=%llu unmatched=%llu\n",
+                      waiting_, lost_, unmatched_);
+        s += line;
+        return s;
+    }
+
+    size_t waiting() const { std::lock_guard<std::mutex> lk(mu_); return waiting_; }
+    unsigned long long lost() const { std::lock_guard<std::mutex> lk(mu_); return lost_; }
+
+private:
+    struct Slot {
+        enum : uint8_t { Free, Sent, Acked };
+        long long t_us = 0;    // send time (Sent) or ack time (Acked)
+        int       mid = 0;
+        uint8_t   cls = 0;
+        uint8_t   state = Free;
+    };
+
+    Slot& slot(int mid){ return slots_[static_cast<unsigned>(mid) & (SLOTS - 1)]; }
+
+    // drop what a slot still holds (counted)
+    void release(Slot& s){
+        if (s.state == Slot::Sent) { ++lost_; --waiting_; }
+        else if (s.state == Slot::Acked) ++unmatched_;
+        s.state = Slot::Free;
+    }
+
+    void record(size_t cls, long long us){
+        interval_[cls].record(us > 0 ? static_cast<uint64_t>(us) : 0);
+    }
+
+    // total + current interval (scratch copy)
+    HdrHistogram& merged(size_t i){
+        scratch_ = total_[i];
+        scratch_.merge(interval_[i]);
+        return scratch_;
+    }
+
+    static void append_stats(std::string& s, const HdrHistogram& h){
+        char buf[192];
+        std::snprintf(buf, sizeof(buf),
+                      "{\"count\":%llu,\"mean\":%.0f,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu}",
+                      (unsigned long long)h.count(), h.mean(),
+                      (unsigned long long)h.value_at(50), (unsigned long long)h.value_at(90),
+                      (unsigned long long)h.value_at(99), (unsigned long long)h.value_at(99.9),
+                      (unsigned long long)h.max());
+        s += buf;
+    }
+
+    mutable std::mutex mu_;
+    std::vector<const char*>  names_;
+    std::vector<HdrHistogram> interval_, total_;
+    HdrHistogram              scratch_;
+    std::vector<Slot>         slots_;              // by mid
+    size_t                    waiting_ = 0;        // slots in state Sent
+    unsigned long long lost_ = 0, unmatched_ = 0;
+};
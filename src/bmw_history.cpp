@@ -0,0 +1,431 @@
+/*
+ * bmw_history.cpp
+ *
+ * Query tool for the bridge's on-disk signal history (HISTORY=1)
+ * Copyright (c) 2025 Kurt, DJ0ABR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+// bmw_history.cpp
+//
+// Purpose:
+//   Read the signal history the bridge writes with HISTORY=1 (see history.hpp)
+//   and print it: a time range, the last N values or a downsampled series of
+//   one signal of one car, as CSV, JSON lines or CBOR.
+//
+//   The .idx/.dat files are mmapped; a query binary-searches the chunk index
+//   and decodes only the chunks it needs, and output is streamed point by
+//   point, so the bridge can keep writing while a query runs and large ranges
+//   need no memory.
+//
+// Build:
+//   ./scripts/compile.sh      (→ src/bmw-history, next to bmw_mqtt_bridge)
+//
+// Usage:
+//   bmw-history [--dir DIR] list [VIN]
+//   bmw-history [--dir DIR] [options] VIN SIGNAL
+//     --from TIME    first time (inclusive), default: oldest
+//     --to TIME      last time (inclusive; a date: end of that day), default: newest
+//     --last N       only the last N values (not with --from/--to)
+//     --step SECS    downsample: one row per SECS bucket (count/min/max/avg/last)
+//     --format F     csv (default) | jsonl | cbor
+//   TIME: 2025-03-04, 2025-03-04T18:00:00Z, ...+01:00, or unix seconds;
+//         dates and times without offset are UTC
+//   DIR:  default $XDG_STATE_HOME/bmw-mqtt-bridge/history
+//         (or $HOME/.local/state/bmw-mqtt-bridge/history)
+//
+// Output:
+//   csv    timestamp,value                              (ISO-8601 UTC, ms)
+//          timestamp,count,min,max,avg,last             (--step)
+//   jsonl  {"timestamp":"...","value":<JSON>}           one object per line
+//          {"timestamp":"...","count":..,"min":..,"max":..,"avg":..,"last":<JSON>}
+//   cbor   CBOR sequence (RFC 8742) of maps with the same keys; timestamp is
+//          unix milliseconds (integer), numbers are float64, texts the decoded
+//          JSON value
+//
+// ------------------------------------------------------------------------
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#ifndef NLOHMANN_JSON_HPP
+  #include "json.hpp" // nlohmann/json header (json.hpp next to this file)
+#endif
+using json = nlohmann::json;
+
+#include "history.hpp"
+
+// ===================== Options =====================
+enum class Format { Csv, Jsonl, Cbor };
+
+struct Query {
+    int64_t from = std::numeric_limits<int64_t>::min();
+    int64_t to   = std::numeric_limits<int64_t>::max();
+    size_t  last = 0;       // 0 = range query
+    int64_t step_ms = 0;    // 0 = no downsampling
+    Format  format = Format::Csv;
+};
+
+static std::string history_dir(){
+    const char* xdg = std::getenv("XDG_STATE_HOME");
+    const char* home = std::getenv("HOME");
+    if (xdg && *xdg) return std::string(xdg) + "/bmw-mqtt-bridge/history";
+    if (home && *home) return std::string(home) + "/.local/state/bmw-mqtt-bridge/history";
+    return std::string("./.local/state/bmw-mqtt-bridge/history");
+}
+
+// "2025-03-04" / ISO-8601 / unix seconds → unix ms; false if unparsable.
+// A date alone is the start of that day, or its last millisecond with end_of_day
+// (--to), so --from D --to D covers the whole day.
+static bool parse_time_arg(const std::string& s, int64_t& ms, bool end_of_day = false){
+    if (!s.empty() && s.find_first_not_of("0123456789") == std::string::npos) {
+        ms = std::strtoll(s.c_str(), nullptr, 10) * 1000;
+        return true;
+    }
+    std::string iso = s;
+    const bool date_only = iso.size() == 10;
+    if (date_only) iso += end_of_day ? "T23:59:59.999" : "T00:00:00";
+    ms = history::parse_time_ms(iso);
+    return ms != 0;
+}
+
+static void usage(){
+    std::cerr <<
+        "usage: bmw-history [--dir DIR] list [VIN]\n"
+        "       bmw-history [--dir DIR] [--from TIME] [--to TIME] [--last N] [--step SECS]\n"
+        "                   [--format csv|jsonl|cbor] VIN SIGNAL\n";
+}
+
+// ===================== Output =====================
+class Output {
+public:
+    Output(){ std::setvbuf(stdout, nullptr, _IOFBF, 1 << 16); }
+    ~Output(){ std::fflush(stdout); }
+
+    void raw(const char* p, size_t n){ std::fwrite(p, 1, n, stdout); }
+    void raw(const std::string& s){ raw(s.data(), s.size()); }
+    void ch(char c){ std::fputc(c, stdout); }
+
+    // ISO-8601 UTC with milliseconds
+    void time(int64_t ms){
+        const int64_t secs = ms >= 0 ? ms / 1000 : (ms - 999) / 1000;
+        const std::time_t t = static_cast<std::time_t>(secs);
+        std::tm tm{};
+        ::gmtime_r(&t, &tm);
+        char buf[40];
+        const size_t n = std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+        raw(buf, n);
+        std::snprintf(buf, sizeof(buf), ".%03dZ", static_cast<int>(ms - secs * 1000));
+        raw(buf, std::strlen(buf));
+    }
+
+    // shortest representation that reads back as the same double
+    void num(double v){
+        if (!std::isfinite(v)) { raw("null", 4); return; }
+        char buf[32];
+        auto r = std::to_chars(buf, buf + sizeof(buf), v);
+        raw(buf, static_cast<size_t>(r.ptr - buf));
+    }
+
+    // value as JSON text (texts are stored as raw JSON)
+    void json_value(const history::Point& p){
+        switch (p.type) {
+        case history::Type::Num:  num(p.num); break;
+        case history::Type::Bool: p.num != 0 ? raw("true", 4) : raw("false", 5); break;
+        case history::Type::Text: raw(p.text); break;
+        }
+    }
+
+    // CSV field: numbers plain, texts quoted ("" escaping)
+    void csv_value(const history::Point& p){
+        if (p.type != history::Type::Text) { json_value(p); return; }
+        std::string_view v = p.text;
+        if (v.size() >= 2 && v.front() == '"' && v.back() == '"' && v.find('\\') == std::string_view::npos)
+            v = v.substr(1, v.size() - 2);   // plain JSON string: its contents
+        ch('"');
+        for (char c : v) { if (c == '"') ch('"'); ch(c); }
+        ch('"');
+    }
+
+    // ---- CBOR (RFC 8949), only what the rows need ----
+    void cbor_head(uint8_t major, uint64_t v){
+        uint8_t b[9];
+        size_t n;
+        if (v < 24)           { b[0] = static_cast<uint8_t>(major << 5 | v); n = 1; }
+        else if (v <= 0xFF)   { b[0] = static_cast<uint8_t>(major << 5 | 24); b[1] = static_cast<uint8_t>(v); n = 2; }
+        else if (v <= 0xFFFF) { b[0] = static_cast<uint8_t>(major << 5 | 25); put_be(b + 1, v, 2); n = 3; }
+        else if (v <= 0xFFFFFFFFULL) { b[0] = static_cast<uint8_t>(major << 5 | 26); put_be(b + 1, v, 4); n = 5; }
+        else                  { b[0] = static_cast<uint8_t>(major << 5 | 27); put_be(b + 1, v, 8); n = 9; }
+        raw(reinterpret_cast<const char*>(b), n);
+    }
+    void cbor_int(int64_t v){
+        if (v >= 0) cbor_head(0, static_cast<uint64_t>(v));
+        else        cbor_head(1, static_cast<uint64_t>(-(v + 1)));
+    }
+    void cbor_text(std::string_view s){ cbor_head(3, s.size()); raw(s.data(), s.size()); }
+    void cbor_f64(double d){
+        uint8_t b[9];
+        b[0] = 0xFB;
+        put_be(b + 1, history::f64_bits(d), 8);
+        raw(reinterpret_cast<const char*>(b), sizeof(b));
+    }
+    void cbor_value(const history::Point& p){
+        switch (p.type) {
+        case history::Type::Num:  cbor_f64(p.num); break;
+        case history::Type::Bool: ch(p.num != 0 ? static_cast<char>(0xF5) : static_cast<char>(0xF4)); break;
+        case history::Type::Text: {
+            const json j = json::parse(p.text, nullptr, false);
+            if (j.is_discarded()) { cbor_text(p.text); break; }
+            const std::vector<uint8_t> b = json::to_cbor(j);
+            raw(reinterpret_cast<const char*>(b.data()), b.size());
+            break;
+        }
+        }
+    }
+
+private:
+    static void put_be(uint8_t* b, uint64_t v, int n){
+        for (int i = n - 1; i >= 0; --i) { b[i] = static_cast<uint8_t>(v); v >>= 8; }
+    }
+};
+
+// ===================== Rows =====================
+
+static void print_header(Output& out, const Query& q){
+    if (q.format != Format::Csv) return;
+    out.raw(q.step_ms ? "timestamp,count,min,max,avg,last\n" : "timestamp,value\n");
+}
+
+static void print_point(Output& out, const Query& q, const history::Point& p){
+    switch (q.format) {
+    case Format::Csv:
+        out.time(p.t);
+        out.ch(',');
+        out.csv_value(p);
+        out.ch('\n');
+        break;
+    case Format::Jsonl:
+        out.raw("{\"timestamp\":\"");
+        out.time(p.t);
+        out.raw("\",\"value\":");
+        out.json_value(p);
+        out.raw("}\n");
+        break;
+    case Format::Cbor:
+        out.cbor_head(5, 2);
+        out.cbor_text("timestamp");
+        out.cbor_int(p.t);
+        out.cbor_text("value");
+        out.cbor_value(p);
+        break;
+    }
+}
+
+// one --step bucket; min/max/avg only over numeric values
+struct Bucket {
+    int64_t  start = 0;
+    uint64_t count = 0;
+    uint64_t nums = 0;
+    double   min = 0, max = 0, sum = 0;
+    history::Point last;
+};
+
+static void print_bucket(Output& out, const Query& q, const Bucket& b){
+    const bool has_num = b.nums > 0;
+    const double avg = has_num ? b.sum / static_cast<double>(b.nums) : 0;
+    switch (q.format) {
+    case Format::Csv:
+        out.time(b.start);
+        out.raw(",");
+        out.raw(std::to_string(b.count));
+        out.ch(',');
+        if (has_num) { out.num(b.min); out.ch(','); out.num(b.max); out.ch(','); out.num(avg); }
+        else out.raw(",,");
+        out.ch(',');
+        out.csv_value(b.last);
+        out.ch('\n');
+        break;
+    case Format::Jsonl:
+        out.raw("{\"timestamp\":\"");
+        out.time(b.start);
+        out.raw("\",\"count\":");
+        out.raw(std::to_string(b.count));
+        if (has_num) {
+            out.raw(",\"min\":"); out.num(b.min);
+            out.raw(",\"max\":"); out.num(b.max);
+            out.raw(",\"avg\":"); out.num(avg);
+        }
+        out.raw(",\"last\":");
+        out.json_value(b.last);
+        out.raw("}\n");
+        break;
+    case Format::Cbor:
+        out.cbor_head(5, has_num ? 6 : 3);
+        out.cbor_text("timestamp"); out.cbor_int(b.start);
+        out.cbor_text("count");     out.cbor_int(static_cast<int64_t>(b.count));
+        if (has_num) {
+            out.cbor_text("min"); out.cbor_f64(b.min);
+            out.cbor_text("max"); out.cbor_f64(b.max);
+            out.cbor_text("avg"); out.cbor_f64(avg);
+        }
+        out.cbor_text("last"); out.cbor_value(b.last);
+        break;
+    }
+}
+
+// ===================== Commands =====================
+
+static int cmd_list(const std::string& dir, const std::string& vin){
+    Output out;
+    if (vin.empty()) {
+        for (auto& v : history::list_dir(dir, true)) { out.raw(v); out.ch('\n'); }
+        return 0;
+    }
+    const std::string vdir = dir + "/" + history::file_key(vin);
+    out.raw("signal,chunks,values,first,last\n");
+    for (auto& base : history::list_dir(vdir, false)) {
+        history::SeriesReader r;
+        std::string err;
+        if (!r.open(vdir + "/" + base + ".idx", vdir + "/" + base + ".dat", err)) {
+            std::cerr << "bmw-history: " << base << ": " << err << "\n";
+            continue;
+        }
+        uint64_t values = 0;
+        for (size_t i = 0; i < r.chunks(); ++i) values += r.entry(i).count;
+        out.raw(r.name());
+        out.ch(',');
+        out.raw(std::to_string(r.chunks()));
+        out.ch(',');
+        out.raw(std::to_string(values));
+        out.ch(',');
+        if (r.chunks()) {
+            out.time(r.entry(0).t_first);
+            out.ch(',');
+            out.time(r.entry(r.chunks() - 1).t_last);
+        } else {
+            out.ch(',');
+        }
+        out.ch('\n');
+    }
+    return 0;
+}
+
+static int cmd_query(const std::string& dir, const std::string& vin, const std::string& signal, const Query& q){
+    const std::string base = dir + "/" + history::file_key(vin) + "/" + history::file_key(signal);
+    history::SeriesReader r;
+    std::string err;
+    if (!r.open(base + ".idx", base + ".dat", err)) {
+        std::cerr << "bmw-history: " << err << "\n";
+        return 1;
+    }
+
+    Output out;
+    print_header(out, q);
+
+    Bucket b;
+    bool open_bucket = false;
+    auto emit = [&](const history::Point& p){
+        if (!q.step_ms) { print_point(out, q, p); return true; }
+        const int64_t start = p.t - ((p.t % q.step_ms) + q.step_ms) % q.step_ms;
+        if (open_bucket && start != b.start) { print_bucket(out, q, b); open_bucket = false; }
+        if (!open_bucket) { b = Bucket{}; b.start = start; open_bucket = true; }
+        ++b.count;
+        if (p.type != history::Type::Text) {
+            if (!b.nums || p.num < b.min) b.min = p.num;
+            if (!b.nums || p.num > b.max) b.max = p.num;
+            b.sum += p.num;
+            ++b.nums;
+        }
+        b.last = p;
+        return true;
+    };
+
+    if (q.last) r.last(q.last, emit);
+    else        r.range(q.from, q.to, emit);
+    if (open_bucket) print_bucket(out, q, b);
+
+    if (r.damaged())
+        std::cerr << "bmw-history: skipped " << r.damaged() << " damaged chunk(s)\n";
+    return 0;
+}
+
+// ===================== Main =====================
+
+int main(int argc, char** argv){
+    std::string dir = history_dir();
+    Query q;
+    bool ranged = false;
+    std::vector<std::string> args;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string a = argv[i];
+        auto next = [&]() -> std::string {
+            if (i + 1 >= argc) { std::cerr << "bmw-history: " << a << " needs a value\n"; std::exit(2); }
+            return argv[++i];
+        };
+        if (a == "--dir") {
+            dir = next();
+        } else if (a == "--from" || a == "--to") {
+            const std::string v = next();
+            int64_t& t = (a == "--from") ? q.from : q.to;
+            if (!parse_time_arg(v, t, a == "--to")) { std::cerr << "bmw-history: bad time '" << v << "'\n"; return 2; }
+            ranged = true;
+        } else if (a == "--last") {
+            const long long n = std::atoll(next().c_str());
+            if (n <= 0) { std::cerr << "bmw-history: --last needs a positive count\n"; return 2; }
+            q.last = static_cast<size_t>(n);
+        } else if (a == "--step") {
+            const double secs = std::atof(next().c_str());
+            if (!(secs > 0)) { std::cerr << "bmw-history: --step needs seconds > 0\n"; return 2; }
+            q.step_ms = std::max<int64_t>(1, static_cast<int64_t>(secs * 1000));
+        } else if (a == "--format") {
+            const std::string f = next();
+            if (f == "csv")        q.format = Format::Csv;
+            else if (f == "jsonl") q.format = Format::Jsonl;
+            else if (f == "cbor")  q.format = Format::Cbor;
+            else { std::cerr << "bmw-history: unknown format '" << f << "'\n"; return 2; }
+        } else if (a == "-h" || a == "--help") {
+            usage();
+            return 0;
+        } else if (a.size() > 1 && a[0] == '-' && a[1] == '-') {
+            std::cerr << "bmw-history: unknown option " << a << "\n";
+            usage();
+            return 2;
+        } else {
+            args.push_back(a);
+        }
+    }
+
+    if (!args.empty() && args[0] == "list" && args.size() <= 2)
+        return cmd_list(dir, args.size() == 2 ? args[1] : std::string());
+    if (args.size() != 2) { usage(); return 2; }
+    if (q.last && ranged) { std::cerr << "bmw-history: --last cannot be combined with --from/--to\n"; return 2; }
+    return cmd_query(dir, args[0], args[1], q);
+}
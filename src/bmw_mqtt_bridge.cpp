@@ -33,18 +33,28 @@
 // Features:
 //   - MQTT v5 with reason codes
 //   - Token expiry tracking via JWT "exp" claim
-//   - Soft/Hard token refresh via HTTP refresh (no external script required at runtime)
+//   - Soft/Hard token refresh via HTTP refresh (no external script required at runtime),
+//     on a background worker with a persistent curl session
 //   - Connect watchdog + client rebuild
+//   - Event-driven main loop (epoll/timerfd/eventfd): sleeps until the next deadline
+//     or connection event instead of polling every second
 //   - Backoff (incl. jitter) to avoid quota/rate-limit storms
 //   - LWT on local broker + status topic
+//   - Optional merged last-known state per vehicle (vehicles/<VIN>/state) and a
+//     read-only HTTP API for it (ETag / If-None-Match, long-poll)
+//   - Optional compressed on-disk history of every signal (see history.hpp)
+//   - Local broker ACK latency per output class: stats topic, SIGUSR1 dump
+//   - Optional end-to-end latency per vehicle (car timestamp → receive → publish)
 //
-// Build (Debian/Ubuntu):
-//   g++ -std=c++17 -O2 -Wall -Wextra -pthread bmw_mqtt_bridge.cpp \
-//       $(pkg-config --cflags --libs libmosquitto) -lcurl
+// Build (Debian/Ubuntu; one line - a trailing backslash would continue this comment):
+//   g++ -std=c++17 -O2 -Wall -Wextra -pthread bmw_mqtt_bridge.cpp $(pkg-config --cflags --libs libmosquitto) -lcurl -lssl -lcrypto
 //
 // Runtime configuration (env overrides):
 //   CLIENT_ID        : BMW CarData client ID (GUID)              (required; no default)
 //   GCID             : BMW GCID / username for the MQTT broker   (required; no default)
+//   ACCOUNTS         : comma list of account names (default: empty = single account); each
+//                      account has its own dir accounts/<name>/ with .env (CLIENT_ID, GCID)
+//                      and token files, and its own BMW connection
 //   BMW_HOST         : customer.streaming-cardata.bmwgroup.com   (default: set)
 //   BMW_PORT         : 9000                                      (default: 9000)
 //   LOCAL_HOST       : 127.0.0.1                                 (default: 127.0.0.1)
@@ -52,8 +62,46 @@
 //   LOCAL_PREFIX     : bmw/                                      (default: bmw/)
 //   LOCAL_USER       : (optional)
 //   LOCAL_PASSWORD   : (optional)
+//   LOCAL_MQTT5      : 0/1  (default: 1; MQTT v5 to the local broker: Content Type, topic aliases,
+//                      "vin"/"timestamp" user properties; 0 = MQTT 3.1.1)
+//   LOCAL_TOPIC_ALIASES: max. topic aliases used with LOCAL_MQTT5 (default: 64, capped by the
+//                      broker's Topic Alias Maximum; 0 = off)
+//   LOCAL_QOS        : 0/1  (default: 0; QoS of forwarded data; 1 = kept until the broker's PUBACK)
+//   LOCAL_INFLIGHT   : QoS 1 messages in flight to the local broker at once (default: 100)
+//   LOCAL_QUEUE_MAX  : max. unacknowledged QoS 1 messages (default: 10000; beyond: spool, else drop)
+//   LOCAL_QUEUE_MB   : max. MB of unacknowledged QoS 1 messages (default: 16)
 //   SPLIT_TOPICS     : 0/1  (default: 0; split JSON into per-signal topics)
 //   STATUS_STABLE_DELAY : seconds until bmw/status goes to false false (default: 5; 0 = immediately)
+//   STATS_INTERVAL   : seconds between <prefix>stats messages (local ACK latency; default: 60; 0 = off)
+//   E2E_LATENCY      : 0/1  (default: 0; per-VIN latency from the signal timestamps on
+//                      <prefix>vehicles/<VIN>/latency every STATS_INTERVAL)
+//   TOPIC_CACHE_MAX  : max. interned topics per table (default: 4096)
+//   LOG_LEVEL        : error|warn|info|debug (default: info)
+//   LOG_SAMPLE       : per-category sampling, e.g. "fwd:100,split:0" (default: all 1)
+//   FWD_QUEUE_SIZE   : BMW thread → forwarder handoff slots (default: 1024; 0 = forward inline)
+//   SPLIT_CHANGE_ONLY: 0/1  (default: 0; publish split topics only when the value changed)
+//   SPLIT_HEARTBEAT  : seconds; republish unchanged split values after this (default: 300; 0 = never)
+//   SPLIT_ENCODING   : json|cbor|msgpack  payload of split topics (default: json)
+//   RAW_ENCODING     : json|cbor|msgpack  payload of <prefix>raw/... topics (default: json = as received)
+//   STATE_SNAPSHOT   : 0/1  (default: 0; merge all properties per VIN into vehicles/<VIN>/state)
+//   STATE_COALESCE_MS: ms a snapshot waits after a change to collect more (default: 1000)
+//   STATE_INTERVAL   : seconds; min. gap between snapshots of a VIN, >0 also republishes
+//                      when only timestamps changed (default: 0 = on change)
+//   STATE_ENCODING   : json|cbor|msgpack  payload of vehicles/<VIN>/state (default: json)
+//   METRICS_PORT     : OpenMetrics HTTP endpoint /metrics (default: 0 = disabled)
+//   METRICS_BIND     : listen address for METRICS_PORT (default: 127.0.0.1)
+//   API_PORT         : read-only vehicle state API /api/vehicles (default: 0 = disabled;
+//                      same as METRICS_PORT = served by the metrics endpoint)
+//   API_BIND         : listen address for API_PORT (default: 127.0.0.1)
+//   HISTORY          : 0/1  (default: 0; store every signal value in TDIR/history/<VIN>/)
+//   HISTORY_COMMIT_SECS: seconds between history group commits (default: 60)
+//   SPOOL_MAX_MB     : disk spool for messages while the local broker is down (default: 16; 0 = off)
+//   SPOOL_REPLAY_RATE: spooled messages replayed per second after reconnect (default: 500)
+//   BMW_MAKE_BEFORE_BREAK: 0/1 (default: 0; on token refresh, connect+subscribe a second
+//                      client with the new token before the old one is closed)
+//   BMW_TLS_RESUME   : 0/1  (default: 1; shared SSL_CTX + TLS session resumption for BMW reconnects)
+//   MQTT_REACTOR     : 0/1  (default: 0, 1 with ACCOUNTS; drive all MQTT clients from the main thread's epoll
+//                      loop instead of mosquitto_loop_start threads; forwards inline)
 //
 //
 // Token / .env location (fixed):
@@ -61,6 +109,7 @@
 //   Fallback: $HOME/.local/state/bmw-mqtt-bridge/.env
 //   Token files are expected in the same directory:
 //     id_token.txt, refresh_token.txt, access_token.txt
+//   With ACCOUNTS=a,b: .../bmw-mqtt-bridge/accounts/a/{.env,id_token.txt,...}
 //
 // Notes:
 //   - id_token (a JWT) is used as the MQTT password; we parse its 'exp' to know validity.
@@ -79,6 +128,9 @@
 #include <atomic>
 #include <thread>
 #include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
 #include <string>
 #include <sstream>
 #include <algorithm>
@@ -89,14 +141,56 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <regex>
+#include <limits>
+#include <deque>
 
 #ifndef NLOHMANN_JSON_HPP
   #include "json.hpp" // nlohmann/json header (json.hpp next to this file)
 #endif
 using json = nlohmann::json;
 
-static bool refresh_tokens();
-static mosquitto* create_bmw_client();
+// DOM on the per-message arena (payload re-encoding, DOM split fallback);
+// only valid inside a msg_arena::Scope
+#include "json_binary.hpp"
+#include "msg_arena.hpp"
+using arena_json = nlohmann::basic_json<std::map, std::vector, msg_arena::string, bool, std::int64_t,
+                                        std::uint64_t, double, msg_arena::Allocator>;
+
+#include "topic_cache.hpp"
+#include "split_scan.hpp"
+#include "log_ring.hpp"
+#include "spsc_queue.hpp"
+#include "metrics.hpp"
+#include "http_server.hpp"
+#include "spool.hpp"
+#include "curl_session.hpp"
+#include "tls_cache.hpp"
+#include "event_loop.hpp"
+#include "state_store.hpp"
+#include "history.hpp"
+#include "topic_alias.hpp"
+#include "outbound_queue.hpp"
+#include "ack_latency.hpp"
+#include "e2e_latency.hpp"
+
+// tokens from a refresh; applied to the globals by the main thread only
+struct TokenSet {
+    std::string id_token;
+    std::string refresh_token;
+    long        exp = 0;
+};
+
+// result of one refresh, handed from the refresh worker to the main loop
+struct RefreshResult {
+    bool     ok = false;
+    TokenSet tokens;
+};
+
+struct BmwSession;
+static std::unique_ptr<TokenSet> fetch_tokens(CurlSession& http, const BmwSession& s);
+static void apply_tokens(BmwSession& s, const TokenSet& t);
+static mosquitto* create_bmw_client(BmwSession& s, int slot);
+static bool write_file_atomic(const std::string& final_path, const std::string& data, mode_t mode);
 
 // ---------------------- tiny helpers for env config ----------------------
 static std::string env_str(const char* key, const char* defv){
@@ -120,9 +214,11 @@ static std::string trim_copy(const std::string& s){
     return s.substr(a,b-a);
 }
 
-static void load_env_file(const std::string& path=".env"){
+// KEY=VALUE lines of an env file (comments/blank lines skipped, quotes removed)
+static std::vector<std::pair<std::string, std::string>> parse_env_file(const std::string& path){
+    std::vector<std::pair<std::string, std::string>> out;
     std::ifstream f(path);
-    if(!f) return;
+    if(!f) return out;
     std::string line;
     while(std::getline(f, line)){
         if(line.empty() || line[0]=='#') continue;
@@ -134,13 +230,19 @@ static void load_env_file(const std::string& path=".env"){
         if(val.size()>=2 && ((val.front()=='"' && val.back()=='"') || (val.front()=='\'' && val.back()=='\''))){
             val = val.substr(1, val.size()-2);
         }
-        if(!key.empty()) setenv(key.c_str(), val.c_str(), 1);
+        if(!key.empty()) out.emplace_back(std::move(key), std::move(val));
     }
+    return out;
+}
+
+static void load_env_file(const std::string& path=".env"){
+    for (auto& kv : parse_env_file(path)) setenv(kv.first.c_str(), kv.second.c_str(), 1);
 }
 
 // ===================== Configuration =====================
 static std::string CLIENT_ID;
 static std::string GCID;
+static std::string ACCOUNTS;               // "" = single account in the token dir
 static std::string BMW_HOST;
 static int         BMW_PORT;
 static std::string LOCAL_HOST;
@@ -149,29 +251,294 @@ static std::string LOCAL_PREFIX;
 static std::string LOCAL_USER;
 static std::string LOCAL_PASSWORD;
 static std::string LOCAL_STATUS_TOPIC;
+static int         LOCAL_MQTT5 = 1;         // 0 = MQTT 3.1.1 to the local broker
+static int         LOCAL_TOPIC_ALIASES = 64; // v5 topic aliases (LRU), 0 = off
+static int         LOCAL_QOS = 0;           // forwarded data: 0 or 1 (tracked in g_outq)
+static int         LOCAL_INFLIGHT = 100;    // QoS 1 in-flight window
+static int         LOCAL_QUEUE_MAX = 10000; // unacknowledged QoS 1 messages
+static int         LOCAL_QUEUE_MB = 16;
 static int         SPLIT_TOPICS = 0;
 static int         STATUS_STABLE_DELAY = 5; // seconds; 0 = no delay
-static std::string ID_TOKEN_FILE;
-static std::string REFRESH_TOKEN_FILE;
+static int         STATS_INTERVAL = 60;     // seconds; 0 = no stats topic
+static int         E2E_LATENCY = 0;         // 1 = vehicles/<VIN>/latency
 static int         MQTT_RETAIN = 0; // 0 = no retain (default), 1 = retain
+static int         TOPIC_CACHE_MAX = 4096;
+static int         FWD_QUEUE_SIZE = 1024;   // 0 = forward on the BMW network thread
+static int         SPLIT_CHANGE_ONLY = 0;   // 1 = suppress unchanged split values
+static int         SPLIT_HEARTBEAT = 300;   // seconds; 0 = never republish unchanged values
+static int         STATE_SNAPSHOT = 0;      // 1 = publish vehicles/<VIN>/state
+static int         STATE_COALESCE_MS = 1000;
+static int         STATE_INTERVAL = 0;      // seconds; 0 = snapshot on change only
+
+// payload encoding per output; the value is also the spool record tag
+enum class Encoding : uint8_t { Json = 0, Cbor = 1, Msgpack = 2 };
+static Encoding    SPLIT_ENCODING = Encoding::Json;
+static Encoding    RAW_ENCODING   = Encoding::Json;   // legacy topics always stay JSON
+static Encoding    STATE_ENCODING = Encoding::Json;
+static int         METRICS_PORT = 0;        // 0 = no metrics endpoint
+static std::string METRICS_BIND;
+static int         API_PORT = 0;            // 0 = no state API
+static std::string API_BIND;
+static int         HISTORY = 0;             // 1 = on-disk signal history
+static int         HISTORY_COMMIT_SECS = 60;
+static int         SPOOL_MAX_MB = 16;       // 0 = no spool
+static int         SPOOL_REPLAY_RATE = 500; // messages per second
+static int         BMW_MAKE_BEFORE_BREAK = 0;
+static int         BMW_TLS_RESUME = 1;
+static int         MQTT_REACTOR = 0;        // 1 = no mosquitto loop threads (see reactor_arm)
+static const char* BMW_CA_FILE = "/etc/ssl/certs/ca-certificates.crt";
 
 // ===================== Globals =====================
 static std::atomic<bool> g_stop{false};
-static std::string g_id_token;
-static std::string g_refresh_token;
-static std::atomic<long> g_id_token_exp{0};
 
-static mosquitto* g_bmw = nullptr;
 static mosquitto* g_local = nullptr;
 
-static std::atomic<bool> g_connected{false};
-static std::atomic<long> g_last_connect_attempt{0};
-static std::atomic<long> g_next_connect_after{0}; // backoff fence for (re)connects
+// BMW client role, passed as mosquitto userdata. With BMW_MAKE_BEFORE_BREAK two
+// clients overlap during a token refresh: the standby must not touch the
+// connection state of the primary, and a retiring client is ignored.
+enum class BmwRole : int { Primary, Standby, Retiring };
+struct BmwClientCtx {
+    BmwSession*           session = nullptr;
+    std::string           client_id;       // MQTT client id of this slot
+    std::atomic<int>      role{static_cast<int>(BmwRole::Primary)};
+    std::atomic<bool>     subscribed{false};
+    std::atomic<bool>     failed{false};   // standby: CONNACK error / disconnect
+};
+// one SSL_CTX (CA bundle parsed once) + last session ticket for all BMW clients
+static TlsClientCache g_bmw_tls;
+
+// Make-before-break overlap: both BMW sessions deliver the same messages for a
+// moment. While the window is open, (topic, payload) hashes of recent messages
+// are remembered and repeats are dropped.
+struct RecentHashes {
+    static constexpr size_t N = 512;
+    uint64_t h[N] = {};
+    size_t   next = 0;
+
+    bool seen_or_add(uint64_t v){
+        for (uint64_t x : h) if (x == v) return true;
+        h[next++ % N] = v;
+        return false;
+    }
+    void clear(){ std::fill(std::begin(h), std::end(h), 0); next = 0; }
+};
+
+// One BMW CarData account: its MQTT client(s), tokens, backoff and refresh
+// state. Without ACCOUNTS there is one session from .env (CLIENT_ID/GCID) and
+// the token directory; with ACCOUNTS=a,b,... one per TDIR/accounts/<name>/.
+// All sessions share the local client, the topic tables, the spool, the TLS
+// context, the refresh worker thread and the main loop.
+struct BmwSession {
+    std::string name;                    // account name; "" = single account
+    std::string tag;                     // log prefix: "[bridge]" / "[bridge:<name>]"
+    std::string client_id;
+    std::string gcid;
+    std::string id_token_file;
+    std::string refresh_token_file;
+
+    std::string       id_token;          // main thread (and client setup)
+    std::string       refresh_token;
+    std::atomic<long> id_token_exp{0};   // JWT "exp", unix seconds
+
+    mosquitto*   bmw = nullptr;
+    mosquitto*   standby = nullptr;      // new client during a swap (main thread)
+    BmwClientCtx ctx[2];                 // slot 0: client_id, slot 1: client_id + "-mbb"
+    int          slot = 0;               // slot of bmw (main thread)
+    long long    standby_since = 0;      // mono_ms()
+
+    std::atomic<bool>      connected{false};
+    std::atomic<long long> last_connect_attempt{0}; // mono_ms() of the last CONNECT; 0 = none pending
+    std::atomic<long long> next_connect_after{0};   // mono_ms() backoff fence for (re)connects
+
+    // main loop bookkeeping (mono_ms())
+    long long last_refresh_attempt = 0;
+    long long last_successful_refresh = 0;
+    long long rebuild_after_refresh_at = 0;   // 0 = no rebuild scheduled
+
+    // refresh worker handoff
+    std::atomic<bool>           refresh_busy{false};   // queued or running
+    std::atomic<RefreshResult*> refresh_result{nullptr};
+
+    RecentHashes      overlap_seen;          // guarded by g_bmw_msg_mu
+    std::atomic<long> overlap_until{0};      // mono_secs(); 0 = no overlap
+
+    ~BmwSession(){ delete refresh_result.exchange(nullptr); }
+};
+static std::vector<std::unique_ptr<BmwSession>> g_sessions;
+
+static BmwRole bmw_role(void* userdata){
+    auto* ctx = static_cast<BmwClientCtx*>(userdata);
+    return ctx ? static_cast<BmwRole>(ctx->role.load()) : BmwRole::Primary;
+}
+
+static BmwSession* bmw_session(void* userdata){
+    auto* ctx = static_cast<BmwClientCtx*>(userdata);
+    return ctx ? ctx->session : nullptr;
+}
+
+static std::atomic<bool> g_local_connected{false};
+
+// LOCAL_MQTT5: topic aliases of the current local connection; the lock also
+// orders the publishes, so an alias is defined before it is used
+static std::mutex    g_alias_mu;
+static TopicAliasLru g_topic_alias;
+
+// output class of a local publish (ACK latency is kept per class)
+enum class OutClass : uint8_t { Raw, Legacy, Split, State, Status, Replay };
+
+// per publish: LOCAL_MQTT5 user properties (views, may be empty) and class
+struct PublishMeta {
+    std::string_view vin;
+    std::string_view timestamp;   // source timestamp as in the BMW message (JSON)
+    OutClass         cls = OutClass::Status;
+};
+
+// mid → time until the local broker's PUBACK (QoS 1) / written to the socket (QoS 0)
+static AckLatencyTracker g_ack_latency({"raw", "legacy", "split", "state", "status", "replay"});
+static std::atomic<bool> g_dump_stats{false};   // SIGUSR1
+
+// E2E_LATENCY: car timestamp → bridge receive → local publish, per VIN
+static EndToEndLatency g_e2e;
+static constexpr size_t E2E_OFFSET_WINDOWS = 10;   // clock offset = min over these report windows
+
+// main loop wait; callbacks and the refresh worker wake() it on state changes
+static EventLoop g_loop;
+
+// LOCAL_STATUS_TOPIC debounce (publish_status), called from the main loop and
+// the BMW callbacks
+struct StatusDebounce {
+    std::mutex mu;
+    long long  disconnected_since = 0;   // mono_ms(); 0 = not currently timing
+    bool       last_published = false;
+    bool       initialized = false;
+};
+static StatusDebounce g_status;
+
+// async logger for the message path (flusher thread writes to stderr)
+static LogRing g_log;
+
+// counters for the /metrics endpoint (updated lock-free from all threads)
+struct BridgeMetrics {
+    metrics::Counter     received;          // messages from BMW
+    metrics::Counter     received_bytes;
+    metrics::Counter     forwarded;         // messages fully processed by forward_message
+    metrics::Counter     published;         // successful local publishes (all topics)
+    metrics::Counter     published_bytes;
+    metrics::CodeCounter publish_errors;    // mosquitto_publish rc != 0
+    metrics::CodeCounter bmw_connack;       // CONNACK reason codes (on_bmw_connect_v5)
+    metrics::CodeCounter bmw_disconnect;    // disconnect reason codes
+    metrics::Counter     bmw_rebuilds;      // full client rebuilds (refresh + watchdog)
+    metrics::Counter     bmw_swaps;         // make-before-break session swaps
+    metrics::Counter     overlap_dropped;   // duplicates dropped during a swap
+    metrics::Counter     tls_handshakes;    // BMW TLS handshakes (BMW_TLS_RESUME)
+    metrics::Counter     tls_resumed;       // ... of which resumed a cached session
+    metrics::Histogram   tls_handshake_seconds{0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5};
+    metrics::Counter     spooled;           // messages written to the spool
+    metrics::Counter     replayed;          // spooled messages published after reconnect
+    metrics::Counter     local_queue_dropped; // LOCAL_QOS=1: outbound queue full, no spool
+    metrics::Counter     local_rejected;    // v5 PUBACK with an error reason code
+    metrics::Counter     refresh_ok;
+    metrics::Counter     refresh_failed;
+    metrics::Counter     refresh_reused;    // refresh without a new connection
+    metrics::Counter     loop_wakeups;      // main loop iterations (timer or event)
+    metrics::Counter     state_snapshots;   // vehicles/<VIN>/state publishes
+    metrics::Counter     api_requests;      // state API responses (all statuses)
+    metrics::Counter     api_not_modified;  // ... of which 304 (If-None-Match hit)
+    metrics::Histogram   refresh_seconds{0.1, 0.25, 0.5, 1, 2, 5, 10, 20, 30};
+    // BMW receive → all local publishes done (incl. queue wait)
+    metrics::Histogram   forward_seconds{5e-6, 1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4,
+                                         1e-3, 2.5e-3, 5e-3, 1e-2, 2.5e-2, 0.1, 0.5};
+};
+static BridgeMetrics g_metrics;
+
+// handoff BMW network thread → forwarder thread (payload copied into reusable slots)
+struct ForwardItem {
+    std::string topic;
+    std::string payload;
+    std::chrono::steady_clock::time_point received;
+};
+static std::unique_ptr<SpscQueue<ForwardItem>> g_fwd_queue;
+static std::thread g_fwd_thread;
+static std::atomic<bool> g_fwd_stop{false};
+
+// interned publish topics (owned by the thread running on_bmw_message)
+struct EventTopics {
+    std::string raw;     // <prefix>raw/<VIN>/<event>
+    std::string legacy;  // <prefix><VIN>/<event>
+};
+struct SplitTopic {
+    std::string topic;          // <prefix>vehicles/<VIN>/<prop>
+    uint64_t    value_hash = 0; // hash of the last published "value" (+ "unit")
+    long        last_publish = 0; // monotonic seconds
+    bool        published = false;
+};
+static InternTable<EventTopics> g_event_topics;  // key: incoming BMW topic
+static InternTable<SplitTopic>  g_split_topics;  // key: (VIN, property)
+
+// forwarded messages waiting for the local broker (TDIR/spool.dat)
+static Spool g_spool;
+
+// LOCAL_QOS=1: forwarded messages published but not yet acknowledged (PUBACK)
+static OutboundQueue g_outq;
+
+// merged last-known state per VIN (STATE_SNAPSHOT / API_PORT, saved in TDIR/state.json)
+static VehicleStateStore g_state;
+static bool g_state_on = false;   // STATE_SNAPSHOT || API_PORT
+
+// per-signal time series (HISTORY, TDIR/history)
+static history::Writer g_history;
+
+static std::atomic<unsigned long long> g_split_published{0};
+static std::atomic<unsigned long long> g_split_suppressed{0};
 
 static std::mt19937 rng{std::random_device{}()};
 static long jitter_ms(long base_ms){ std::uniform_int_distribution<int> d(-250,250); return base_ms + d(rng); }
 
 // ===================== Helpers =====================
+
+// monotonic clock in seconds (not affected by wall clock jumps)
+static long mono_secs(){
+    return static_cast<long>(std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// monotonic clock in milliseconds; main loop deadlines and connect fences
+static long long mono_ms(){ return EventLoop::now_ms(); }
+
+// "json" / "cbor" / "msgpack" (env value); unknown names fall back to JSON
+static Encoding env_encoding(const char* key){
+    const std::string v = env_str(key, "json");
+    if (v == "cbor") return Encoding::Cbor;
+    if (v == "msgpack") return Encoding::Msgpack;
+    if (v != "json") std::cerr << "[bridge] " << key << "=" << v << " unknown, using json\n";
+    return Encoding::Json;
+}
+
+static const char* content_type(Encoding e){
+    switch (e) {
+    case Encoding::Cbor:    return "application/cbor";
+    case Encoding::Msgpack: return "application/msgpack";
+    default:                return "application/json";
+    }
+}
+
+// JSON text → CBOR / MessagePack in out (cleared first). false if the text is
+// not valid JSON; the caller then publishes it unchanged.
+static bool encode_payload(std::string_view text, Encoding enc, std::string& out){
+    // direct transcoding (no DOM, no allocation); the DOM path only for what it declines
+    thread_local json_binary::Transcoder transcoder;
+    if (transcoder.encode(text, enc == Encoding::Cbor ? json_binary::Format::Cbor
+                                                      : json_binary::Format::Msgpack, out))
+        return true;
+
+    msg_arena::Scope arena;   // DOM nodes and strings, released on return
+    const arena_json j = arena_json::parse(text.begin(), text.end(), nullptr, false);
+    if (j.is_discarded()) return false;
+    out.clear();
+    if (enc == Encoding::Cbor) arena_json::to_cbor(j, out);
+    else                       arena_json::to_msgpack(j, out);
+    return true;
+}
 // Helper: dirname
 static std::string dirname_of(const std::string& p){
     std::filesystem::path pp(p);
@@ -195,47 +562,163 @@ static bool is_placeholder_uuid(const std::string& v){
     return v.empty() || std::regex_match(v, all_ones);
 }
 
-static void bmw_full_reconnect(){
+static void bmw_destroy(mosquitto*& m){
+    if (!m) return;
+    mosquitto_loop_stop(m, true);
+    mosquitto_destroy(m);
+    m = nullptr;
+}
+
+// network loop of a client: own thread, or the main loop's reactor
+static void client_loop_start(mosquitto* m){
+    if (!MQTT_REACTOR) mosquitto_loop_start(m);
+}
+
+static void bmw_full_reconnect(BmwSession& s){
+    g_metrics.bmw_rebuilds.inc();
     // alten Client sauber neu aufbauen
-    if (g_bmw) {
-        mosquitto_loop_stop(g_bmw, true);
-        mosquitto_destroy(g_bmw);
-        g_bmw = nullptr;
-    }
-    g_bmw = create_bmw_client();
-    if (!g_bmw) {
-        std::cerr << "[bridge] rebuild failed (mosquitto_new)\n";
+    bmw_destroy(s.standby);
+    bmw_destroy(s.bmw);
+    s.bmw = create_bmw_client(s, s.slot);
+    if (!s.bmw) {
+        std::cerr << s.tag << " rebuild failed (mosquitto_new)\n";
         return;
     }
-    mosquitto_loop_start(g_bmw);
+    client_loop_start(s.bmw);
 
-    int rc = mosquitto_connect_async(g_bmw, BMW_HOST.c_str(), BMW_PORT, 30);
-    g_last_connect_attempt = time(nullptr);
-    std::cerr << "[bridge] rebuild+connect rc=" << rc << "\n";
+    int rc = mosquitto_connect_async(s.bmw, BMW_HOST.c_str(), BMW_PORT, 30);
+    s.last_connect_attempt = mono_ms();
+    std::cerr << s.tag << " rebuild+connect rc=" << rc << "\n";
 }
 
-// Debounced status publisher for LOCAL_STATUS_TOPIC
-static void publish_status(bool connected) {
-    static long  disconnected_since = 0;   // 0 = not currently timing
-    static bool  last_published     = false;
-    static bool  initialized        = false;
+// MQTT v5 publish: Content Type, user properties and topic alias. QoS 1 always
+// carries the full topic and no alias: libmosquitto may send it later (beyond
+// the in-flight window) or again after a reconnect, when the alias is gone or
+// maps to another topic - and an alias on it would redefine one we reuse.
+static int local_publish_v5(const char* topic, int payloadlen, const void* payload, bool retain,
+                            Encoding enc, const PublishMeta* meta, int qos, int* mid){
+    mosquitto_property* props = nullptr;
+    mosquitto_property_add_string(&props, MQTT_PROP_CONTENT_TYPE, content_type(enc));
+    if (enc == Encoding::Json) mosquitto_property_add_byte(&props, MQTT_PROP_PAYLOAD_FORMAT_INDICATOR, 1);
+    if (meta) {
+        thread_local std::string v;   // NUL-terminated copies, capacity reused
+        if (!meta->vin.empty()) {
+            v.assign(meta->vin.data(), meta->vin.size());
+            mosquitto_property_add_string_pair(&props, MQTT_PROP_USER_PROPERTY, "vin", v.c_str());
+        }
+        std::string_view ts = meta->timestamp;
+        if (ts.size() >= 2 && ts.front() == '"' && ts.back() == '"') ts = ts.substr(1, ts.size() - 2);
+        if (!ts.empty()) {
+            v.assign(ts.data(), ts.size());
+            mosquitto_property_add_string_pair(&props, MQTT_PROP_USER_PROPERTY, "timestamp", v.c_str());
+        }
+    }
+
+    std::lock_guard<std::mutex> lk(g_alias_mu);
+    const TopicAliasLru::Result a = g_topic_alias.lookup(topic, qos);
+    if (a.alias) mosquitto_property_add_int16(&props, MQTT_PROP_TOPIC_ALIAS, a.alias);
+    int rc = mosquitto_publish_v5(g_local, mid, a.known ? nullptr : topic, payloadlen, payload, qos,
+                                  retain, props);
+    if (rc != MOSQ_ERR_SUCCESS && a.alias && !a.known) g_topic_alias.forget(topic);
+    mosquitto_property_free_all(&props);
+    return rc;
+}
+
+// every publish to the local broker goes through here (error/byte accounting,
+// ACK latency; without meta the publish counts as "status")
+static int local_publish(const char* topic, int payloadlen, const void* payload, bool retain,
+                         Encoding enc = Encoding::Json, const PublishMeta* meta = nullptr,
+                         int qos = 0, int* mid = nullptr){
+    int own_mid = 0;
+    if (!mid) mid = &own_mid;
+    const long long t0 = AckLatencyTracker::now_us();
+    int rc = LOCAL_MQTT5
+        ? local_publish_v5(topic, payloadlen, payload, retain, enc, meta, qos, mid)
+        : mosquitto_publish(g_local, mid, topic, payloadlen, payload, qos, retain);
+    if (rc == MOSQ_ERR_SUCCESS) {
+        g_ack_latency.sent(*mid, static_cast<size_t>(meta ? meta->cls : OutClass::Status), t0);
+        g_metrics.published.inc();
+        g_metrics.published_bytes.inc(static_cast<uint64_t>(payloadlen));
+    } else {
+        g_metrics.publish_errors.inc(rc);
+    }
+    return rc;
+}
+
+// LOCAL_QOS=1 publish, kept in g_outq until the broker's PUBACK. full = too much
+// is unacknowledged already; nothing was sent.
+static int local_publish_tracked(const char* topic, int payloadlen, const void* payload, bool retain,
+                                 Encoding enc, const PublishMeta* meta, bool& full){
+    return g_outq.send(topic, payload, static_cast<size_t>(payloadlen), retain, static_cast<uint8_t>(enc),
+        meta ? meta->vin : std::string_view{}, meta ? meta->timestamp : std::string_view{},
+        [&](int* mid){ return local_publish(topic, payloadlen, payload, retain, enc, meta, 1, mid); }, full);
+}
+
+// Publish for forwarded vehicle data. While the local broker is unreachable, or
+// older messages are still spooled (keeps the order), the message goes to the
+// spool instead and counts as delivered. With LOCAL_QOS=1 the same applies when
+// the outbound queue is full; without a spool the message is dropped then.
+static int forward_publish(const char* topic, int payloadlen, const void* payload, bool retain,
+                           Encoding enc = Encoding::Json, const PublishMeta* meta = nullptr){
+    const uint8_t tag = static_cast<uint8_t>(enc);
+    const std::string_view vin = meta ? meta->vin : std::string_view{};
+    const std::string_view ts  = meta ? meta->timestamp : std::string_view{};
+    if (g_spool.is_open() &&
+        (!g_local_connected.load(std::memory_order_relaxed) || !g_spool.empty())) {
+        if (g_spool.append(topic, payload, static_cast<size_t>(payloadlen), retain, tag, vin, ts)) {
+            g_metrics.spooled.inc();
+            return MOSQ_ERR_SUCCESS;
+        }
+        return MOSQ_ERR_PAYLOAD_SIZE;
+    }
+    bool full = false;
+    int rc = LOCAL_QOS ? local_publish_tracked(topic, payloadlen, payload, retain, enc, meta, full)
+                       : local_publish(topic, payloadlen, payload, retain, enc, meta);
+    if ((rc != MOSQ_ERR_SUCCESS || full) && g_spool.is_open() &&
+        g_spool.append(topic, payload, static_cast<size_t>(payloadlen), retain, tag, vin, ts)) {
+        g_metrics.spooled.inc();
+        g_loop.wake();   // main loop schedules the replay
+        return MOSQ_ERR_SUCCESS;
+    }
+    if (full) {
+        g_metrics.local_queue_dropped.inc();
+        return MOSQ_ERR_NOMEM;
+    }
+    return rc;
+}
 
+// LOCAL_STATUS_TOPIC state: every BMW session connected
+static bool all_sessions_connected(){
+    if (g_sessions.empty()) return false;
+    for (auto& s : g_sessions) if (!s->connected.load()) return false;
+    return true;
+}
+
+// Debounced status publisher for LOCAL_STATUS_TOPIC (with several accounts the
+// payload also lists each account's state at the time of the change)
+static void publish_status() {
     if (!g_local) return;
+    const bool connected = all_sessions_connected();
+    std::lock_guard<std::mutex> lk(g_status.mu);
 
     auto do_publish = [&](bool val){
         json j;
         j["connected"] = val;
         j["timestamp"] = static_cast<long>(time(nullptr));
+        if (!g_sessions.empty() && !g_sessions.front()->name.empty()) {
+            json a = json::object();
+            for (auto& s : g_sessions) a[s->name] = s->connected.load();
+            j["accounts"] = std::move(a);
+        }
         std::string payload = j.dump();
-        mosquitto_publish(g_local, nullptr, LOCAL_STATUS_TOPIC.c_str(),
-                          payload.size(), payload.data(), 0, true);
-        last_published = val;
-        initialized = true;
+        local_publish(LOCAL_STATUS_TOPIC.c_str(), static_cast<int>(payload.size()), payload.data(), true);
+        g_status.last_published = val;
+        g_status.initialized = true;
     };
 
     if (connected) {
-        disconnected_since = 0;
-        if (!initialized || last_published != true) {
+        g_status.disconnected_since = 0;
+        if (!g_status.initialized || g_status.last_published != true) {
             do_publish(true); // sofort auf true
         }
         return;
@@ -243,19 +726,32 @@ static void publish_status(bool connected) {
 
     // connected == false
     if (STATUS_STABLE_DELAY == 0) {
-        if (!initialized || last_published != false) {
+        if (!g_status.initialized || g_status.last_published != false) {
             do_publish(false); // sofort auf false
         }
-        disconnected_since = 0;
+        g_status.disconnected_since = 0;
         return;
     }
-    long now = time(nullptr);
-    if (disconnected_since == 0) { disconnected_since = now; return; }
-    if ((now - disconnected_since) >= STATUS_STABLE_DELAY && (!initialized || last_published != false)) {
+    long long now = mono_ms();
+    if (g_status.disconnected_since == 0) {
+        g_status.disconnected_since = now;
+        g_loop.wake();   // main loop arms the STATUS_STABLE_DELAY deadline
+        return;
+    }
+    if ((now - g_status.disconnected_since) >= STATUS_STABLE_DELAY * 1000LL &&
+        (!g_status.initialized || g_status.last_published != false)) {
         do_publish(false); // nach Delay auf false
     }
 }
 
+// mono_ms() at which a pending "connected:false" is due; 0 = nothing pending
+static long long status_deadline(){
+    std::lock_guard<std::mutex> lk(g_status.mu);
+    if (g_status.disconnected_since == 0) return 0;
+    if (g_status.initialized && g_status.last_published == false) return 0;
+    return g_status.disconnected_since + STATUS_STABLE_DELAY * 1000LL;
+}
+
 static std::string read_file(const std::string& path) {
     std::ifstream f(path);
     if (!f) return {};
@@ -270,11 +766,10 @@ static std::string trim(std::string s) {
     return s.substr(i);
 }
 
-static bool write_file(const std::string& path, const std::string& data) {
-    std::ofstream f(path, std::ios::trunc);
-    if (!f) return false;
-    f << data;
-    return true;
+// FNV-1a 64 bit; chain calls by passing the previous result as seed
+static uint64_t fnv1a64(std::string_view s, uint64_t h = 1469598103934665603ULL){
+    for (unsigned char c : s) { h ^= c; h *= 1099511628211ULL; }
+    return h;
 }
 
 // Ersetzt problematische Zeichen in Topic-Keys
@@ -328,134 +823,407 @@ static long jwt_exp_unix(const std::string& jwt){
     return j.value("exp", 0L);
 }
 
-static size_t curl_write_cb(void* ptr, size_t size, size_t nmemb, void* userdata){
-    auto* s = static_cast<std::string*>(userdata);
-    s->append(static_cast<const char*>(ptr), size*nmemb);
-    return size*nmemb;
-}
-
 // ===================== MQTT Callbacks =====================
 
 // v5 connect callback (no property iteration, Debian header only forward-declares properties)
-static void on_bmw_connect_v5(struct mosquitto*, void*, int rc, int flags, const mosquitto_property* /*props*/){
+static void on_bmw_connect_v5(struct mosquitto* mosq, void* obj, int rc, int flags, const mosquitto_property* /*props*/){
     const char* reason = mosquitto_reason_string(rc);
-    std::cout << "[bridge] BMW on_connect_v5 rc=" << rc
+    const BmwRole role = bmw_role(obj);
+    BmwSession& s = *bmw_session(obj);
+    if (role == BmwRole::Retiring) return;
+    if (role == BmwRole::Standby) {
+        // make-before-break: subscribe, promotion happens in the main loop after SUBACK
+        auto* ctx = static_cast<BmwClientCtx*>(obj);
+        std::cerr << s.tag << " BMW standby on_connect_v5 rc=" << rc
+                  << " (" << (reason ? reason : "unknown") << ")\n";
+        g_metrics.bmw_connack.inc(rc);
+        if (rc != 0) { ctx->failed = true; g_loop.wake(); return; }
+        std::string sub = s.gcid + std::string("/+");
+        int mid = 0;
+        int s_rc = mosquitto_subscribe(mosq, &mid, sub.c_str(), 1);
+        std::cerr << s.tag << " standby subscribe '" << sub << "' rc=" << s_rc << " mid=" << mid << "\n";
+        if (s_rc != MOSQ_ERR_SUCCESS) { ctx->failed = true; g_loop.wake(); }
+        return;
+    }
+
+    std::cout << s.tag << " BMW on_connect_v5 rc=" << rc
               << " (" << (reason ? reason : "unknown") << ")"
               << " sp=" << ((flags & 0x01) ? 1 : 0)
               << "\n";
+    g_metrics.bmw_connack.inc(rc);
 
     if(rc == 0){
-        g_connected = true;
-        std::string sub = GCID + std::string("/+");
+        s.connected = true;
+        std::string sub = s.gcid + std::string("/+");
         int mid = 0;
-        int s_rc = mosquitto_subscribe(g_bmw, &mid, sub.c_str(), 1);
-        std::cerr << "[bridge] subscribe '" << sub << "' rc=" << s_rc << " mid=" << mid << "\n";
-        publish_status(true);
-        g_last_connect_attempt = 0;
+        int s_rc = mosquitto_subscribe(mosq, &mid, sub.c_str(), 1);
+        std::cerr << s.tag << " subscribe '" << sub << "' rc=" << s_rc << " mid=" << mid << "\n";
+        publish_status();
+        s.last_connect_attempt = 0;
         return;
     }
 
     // failed → set backoff
-    long now = time(nullptr);
+    long long now = mono_ms();
     long delay = 5; // default
     if (rc == 151) delay = 60;              // Quota exceeded
     if (rc == 128 || rc == 133) delay = 20; // Unspecified / Server busy
     if (rc == 135) delay = 30;              // Not authorized
 
-    g_next_connect_after = now + delay + (jitter_ms(0)/1000);
-    g_connected = false;
-    publish_status(false);
+    s.next_connect_after = now + delay * 1000 + jitter_ms(0);
+    s.connected = false;
+    publish_status();
+    g_loop.wake();
 }
 
-static void on_bmw_disconnect(struct mosquitto*, void*, int rc){
-    std::cout << "[bridge] BMW disconnect rc=" << rc << "\n";
-    g_connected = false;
-    publish_status(false);
+static void on_bmw_disconnect(struct mosquitto*, void* obj, int rc){
+    if (bmw_role(obj) != BmwRole::Primary) return;   // handled in on_bmw_disconnect_v5
+    BmwSession& s = *bmw_session(obj);
+    std::cout << s.tag << " BMW disconnect rc=" << rc << "\n";
+    s.connected = false;
+    publish_status();
+    g_loop.wake();
 }
 
-static void on_bmw_disconnect_v5(struct mosquitto*, void*, int rc,
+static void on_bmw_disconnect_v5(struct mosquitto*, void* obj, int rc,
                                  const mosquitto_property* /*props*/){
     const char* reason = mosquitto_reason_string(rc);
-    std::cerr << "[bridge] BMW disconnect_v5 rc=" << rc
+    const BmwRole role = bmw_role(obj);
+    BmwSession& s = *bmw_session(obj);
+    if (role == BmwRole::Retiring) return;
+    if (role == BmwRole::Standby) {
+        std::cerr << s.tag << " BMW standby disconnect_v5 rc=" << rc
+                  << " (" << (reason ? reason : "unknown") << ")\n";
+        static_cast<BmwClientCtx*>(obj)->failed = true;
+        g_loop.wake();
+        return;
+    }
+    std::cerr << s.tag << " BMW disconnect_v5 rc=" << rc
               << " (" << (reason ? reason : "unknown") << ")\n";
-    g_connected = false;
-    publish_status(false);
+    g_metrics.bmw_disconnect.inc(rc);
+    s.connected = false;
+    publish_status();
+    g_loop.wake();
 }
 
-static void on_bmw_message(struct mosquitto*, void*, const struct mosquitto_message* m){
-    if (!m || !m->topic) return;
-    std::string in_topic = m->topic ? m->topic : "";
-
-    // Republishing: 1) RAW (neu)  2) Legacy (alt)
+// VIN fallback: "<GCID>/<VIN>/..." → <VIN>
+static std::string_view vin_from_topic(std::string_view in_topic){
     auto pos = in_topic.find('/');
-    std::string raw_topic    = LOCAL_PREFIX + "raw" + (pos!=std::string::npos ? in_topic.substr(pos)   : "");
-    std::string legacy_topic = LOCAL_PREFIX          + (pos!=std::string::npos ? in_topic.substr(pos+1) : in_topic);
+    if (pos == std::string_view::npos) return {};
+    auto next = in_topic.find('/', pos + 1);
+    if (next == std::string_view::npos) return {};
+    return in_topic.substr(pos + 1, next - (pos + 1));
+}
 
-    bool retain_flag = (MQTT_RETAIN != 0);
-    int rc1 = mosquitto_publish(g_local, nullptr, raw_topic.c_str(),
-                                m->payloadlen, m->payload, 0, retain_flag);
-    int rc2 = mosquitto_publish(g_local, nullptr, legacy_topic.c_str(),
-                                m->payloadlen, m->payload, 0, retain_flag);
-       
-    std::cerr << "[bridge] fwd rc1=" << rc1
-              << " rc2=" << rc2
-              << " retain=" << (retain_flag ? 1 : 0)
-              << " in='"  << in_topic
-              << "' raw='"<< raw_topic
-              << "' legacy='"<< legacy_topic
-              << "' bytes="<< m->payloadlen << "\n";
-
-    // Optional: Splitten aktiv?
-    if (!SPLIT_TOPICS || !m->payload || m->payloadlen <= 0)
-        return;
+// publish one split property to <prefix>vehicles/<VIN>/<prop>
+// value_hash identifies the property's value (not its timestamp) for SPLIT_CHANGE_ONLY;
+// timestamp (raw JSON, may be empty) goes out as a user property with LOCAL_MQTT5
+static void publish_split(std::string_view vin, std::string_view prop,
+                          std::string_view val, uint64_t value_hash, bool retain_flag,
+                          std::string_view timestamp){
+    SplitTopic& st = g_split_topics.get(vin, prop, [&]{
+        SplitTopic t;
+        t.topic = LOCAL_PREFIX + "vehicles/";
+        t.topic.append(vin);
+        t.topic.push_back('/');
+        t.topic.append(sanitize_key(std::string(prop)));
+        return t;
+    });
 
-    try {
-        std::string payload_str(static_cast<const char*>(m->payload), static_cast<size_t>(m->payloadlen));
-        auto j = json::parse(payload_str, nullptr, true);
-
-        std::string vin;
-        if (j.contains("vin") && j["vin"].is_string()) {
-            vin = j["vin"].get<std::string>();
-        }
-        if (vin.empty()) {
-            auto pos = in_topic.find('/');
-            if (pos != std::string::npos) {
-                auto next = in_topic.find('/', pos + 1);
-                if (next != std::string::npos)
-                    vin = in_topic.substr(pos + 1, next - (pos + 1));
-            }
+    long now = 0;
+    if (SPLIT_CHANGE_ONLY) {
+        now = mono_secs();
+        const bool heartbeat_due = SPLIT_HEARTBEAT > 0 && (now - st.last_publish) >= SPLIT_HEARTBEAT;
+        if (st.published && st.value_hash == value_hash && !heartbeat_due) {
+            g_split_suppressed.fetch_add(1, std::memory_order_relaxed);
+            return;
         }
+    }
+
+    // binary encodings: re-encode the property object (owner thread only)
+    static std::string encoded;
+    std::string_view out = val;
+    Encoding enc = Encoding::Json;
+    if (SPLIT_ENCODING != Encoding::Json && encode_payload(val, SPLIT_ENCODING, encoded)) {
+        out = encoded;
+        enc = SPLIT_ENCODING;
+    }
+
+    const PublishMeta meta{vin, timestamp, OutClass::Split};
+    int rc = forward_publish(st.topic.c_str(), static_cast<int>(out.size()), out.data(), retain_flag, enc, &meta);
+    g_log.write(LogLevel::Info, LogCat::Split, "[bridge] split '%s' val=%.*s rc=%d",
+                st.topic.c_str(), (int)val.size(), val.data(), rc);
+    g_split_published.fetch_add(1, std::memory_order_relaxed);
+
+    // remember only what actually went out, so a failed publish is retried next time
+    if (SPLIT_CHANGE_ONLY && rc == MOSQ_ERR_SUCCESS) {
+        st.value_hash   = value_hash;
+        st.last_publish = now;
+        st.published    = true;
+    }
+}
+
+// merge one property into the VIN's state; the main loop publishes the snapshot
+static void state_merge(std::string_view vin, std::string_view prop, std::string_view raw, uint64_t value_hash){
+    if (g_state.merge(vin, prop, raw, value_hash, mono_ms()) && STATE_SNAPSHOT) g_loop.wake();
+}
+
+// append one value to the signal's history; time = the property's own
+// "timestamp" if it has one, else the receive time
+static void history_append(std::string_view vin, std::string_view prop,
+                           std::string_view value, std::string_view timestamp){
+    int64_t t = timestamp.empty() ? 0 : history::parse_time_ms(timestamp);
+    if (t <= 0) t = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::system_clock::now().time_since_epoch()).count();
+    g_history.append(vin, prop, t, value);
+}
+
+// E2E_LATENCY: signal timestamps of the message being forwarded (forwarding
+// thread only), handed to g_e2e with the receive time once it is published
+static std::vector<int64_t> g_e2e_ts;
+
+static void e2e_signal(std::string_view timestamp){
+    if (!timestamp.empty()) g_e2e_ts.push_back(history::parse_time_ms(timestamp));
+}
+
+static void e2e_record(std::string_view vin, std::chrono::steady_clock::time_point received){
+    const int64_t pipeline_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - received).count();
+    const int64_t received_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count() - pipeline_us / 1000;
+    g_e2e.record(vin, g_e2e_ts, received_ms, pipeline_us);
+    g_e2e_ts.clear();
+}
+
+// DOM-based split for payloads the streaming scanner does not handle (nesting
+// deeper than its limit). Same hash and timestamp rules as the scanner path,
+// but the bytes are dump()-normalized (whitespace, number spelling), so such a
+// property's SPLIT_CHANGE_ONLY hash only matches the scanner's for compact JSON.
+static void split_payload_dom(std::string_view in_topic, std::string_view payload, bool retain_flag,
+                              std::chrono::steady_clock::time_point received){
+    msg_arena::Scope arena;   // DOM, keys and dump() results of this message
+    try {
+        const auto j = arena_json::parse(payload.begin(), payload.end(), nullptr, true);
+
+        std::string_view vin;
+        const auto v = j.find("vin");
+        if (v != j.end() && v->is_string()) vin = v->get_ref<const msg_arena::string&>();
+        if (vin.empty()) vin = vin_from_topic(in_topic);
         if (vin.empty() || vin.size() != 17)
             throw std::runtime_error("invalid or missing VIN");
 
-        if (j.contains("data") && j["data"].is_object()) {
-            for (auto& [propName, propObj] : j["data"].items()) {
-                if (propObj.contains("value")) {
-                    std::string topic = LOCAL_PREFIX + "vehicles/" + vin + "/" + sanitize_key(propName);
-                    std::string val = propObj.dump();
-                    int rc = mosquitto_publish(g_local, nullptr, topic.c_str(),
-+                                               val.size(), val.data(),
-+                                               0, retain_flag);
-                    std::cerr << "[bridge] split '" << topic << "' val=" << val << " rc=" << rc << "\n";
+        const auto data = j.find("data");
+        if (data != j.end() && data->is_object()) {
+            for (auto& [propName, propObj] : data->items()) {
+                const auto value = propObj.find("value");
+                if (value != propObj.end()) {
+                    const msg_arena::string value_raw = value->dump();
+                    uint64_t h = fnv1a64(value_raw);
+                    const auto unit = propObj.find("unit");
+                    if (unit != propObj.end()) h = fnv1a64(unit->dump(), h);
+                    const msg_arena::string raw = propObj.dump();
+                    const auto ts = propObj.find("timestamp");
+                    const msg_arena::string ts_raw = ts != propObj.end() ? ts->dump() : msg_arena::string();
+                    if (SPLIT_TOPICS) publish_split(vin, propName, raw, h, retain_flag, ts_raw);
+                    if (g_state_on) state_merge(vin, propName, raw, h);
+                    if (HISTORY) history_append(vin, propName, value_raw, ts_raw);
+                    if (E2E_LATENCY) e2e_signal(ts_raw);
                 }
             }
+            if (E2E_LATENCY) e2e_record(vin, received);
         } else {
             throw std::runtime_error("No valid data in payload");
         }
     } catch (const std::exception& e) {
-        std::cerr << "[bridge] JSON parse error: " << e.what() << "\n";
+        g_log.write(LogLevel::Warn, LogCat::Split, "[bridge] JSON parse error: %s", e.what());
     }
 }
 
-// log callback: set g_last_connect_attempt when "sending CONNECT" appears; filter ping spam
-static void on_bmw_log(struct mosquitto* /*mosq*/, void* /*userdata*/,
+// Republish one BMW message locally (raw, legacy and optional split topics).
+// Runs on the forwarder thread, or on the BMW thread when FWD_QUEUE_SIZE=0.
+static void forward_message(const char* topic, const void* payload_ptr, int payloadlen,
+                            std::chrono::steady_clock::time_point received = std::chrono::steady_clock::now()){
+    const std::string_view in_topic(topic);
+
+    // Republishing: 1) RAW (neu)  2) Legacy (alt)
+    const EventTopics& et = g_event_topics.get(in_topic, {}, [&]{
+        auto pos = in_topic.find('/');
+        EventTopics t;
+        t.raw    = LOCAL_PREFIX + "raw";
+        t.legacy = LOCAL_PREFIX;
+        if (pos != std::string_view::npos) {
+            t.raw.append(in_topic.substr(pos));
+            t.legacy.append(in_topic.substr(pos + 1));
+        } else {
+            t.legacy.append(in_topic);
+        }
+        return t;
+    });
+
+    bool retain_flag = (MQTT_RETAIN != 0);
+    PublishMeta meta{vin_from_topic(in_topic), {}, OutClass::Raw};
+    int rc1;
+    static std::string raw_encoded;
+    if (RAW_ENCODING != Encoding::Json && payload_ptr && payloadlen > 0 &&
+        encode_payload(std::string_view(static_cast<const char*>(payload_ptr), static_cast<size_t>(payloadlen)),
+                       RAW_ENCODING, raw_encoded)) {
+        rc1 = forward_publish(et.raw.c_str(), static_cast<int>(raw_encoded.size()), raw_encoded.data(),
+                              retain_flag, RAW_ENCODING, &meta);
+    } else {
+        rc1 = forward_publish(et.raw.c_str(), payloadlen, payload_ptr, retain_flag, Encoding::Json, &meta);
+    }
+    meta.cls = OutClass::Legacy;
+    int rc2 = forward_publish(et.legacy.c_str(), payloadlen, payload_ptr, retain_flag, Encoding::Json, &meta);
+       
+    g_log.write(LogLevel::Info, LogCat::Fwd,
+                "[bridge] fwd rc1=%d rc2=%d retain=%d in='%s' raw='%s' legacy='%s' bytes=%d",
+                rc1, rc2, retain_flag ? 1 : 0, topic, et.raw.c_str(), et.legacy.c_str(),
+                payloadlen);
+
+    // Optional: Splitten / State / History aktiv?
+    if ((!SPLIT_TOPICS && !g_state_on && !HISTORY && !E2E_LATENCY) || !payload_ptr || payloadlen <= 0)
+        return;
+
+    // streaming split: one pass over the payload, values are published as the
+    // raw bytes they had in the BMW message (no DOM, no dump())
+    static split_scan::Scanner scanner;
+    static std::vector<split_scan::Prop> props;
+    const std::string_view payload(static_cast<const char*>(payload_ptr),
+                                   static_cast<size_t>(payloadlen));
+    std::string_view vin;
+
+    const split_scan::Result res = scanner.scan(payload, vin, props);
+    switch (res) {
+    case split_scan::Result::Ok:
+    case split_scan::Result::NoData:
+        break;
+    case split_scan::Result::Fallback:
+        split_payload_dom(in_topic, payload, retain_flag, received);
+        return;
+    case split_scan::Result::Malformed:
+        g_log.write(LogLevel::Warn, LogCat::Split, "[bridge] JSON parse error: malformed payload");
+        return;
+    }
+
+    if (vin.empty()) vin = vin_from_topic(in_topic);
+    if (vin.size() != 17) {
+        g_log.write(LogLevel::Warn, LogCat::Split, "[bridge] JSON parse error: invalid or missing VIN");
+        return;
+    }
+    if (res == split_scan::Result::NoData) {
+        g_log.write(LogLevel::Warn, LogCat::Split, "[bridge] JSON parse error: No valid data in payload");
+        return;
+    }
+
+    for (const auto& p : props) {
+        if (!p.has_value) continue;
+        uint64_t h = fnv1a64(p.member_value);
+        if (!p.member_unit.empty()) h = fnv1a64(p.member_unit, h);
+        if (SPLIT_TOPICS) publish_split(vin, p.name, p.value, h, retain_flag, p.member_timestamp);
+        if (g_state_on) state_merge(vin, p.name, p.value, h);
+        if (HISTORY) history_append(vin, p.name, p.member_value, p.member_timestamp);
+        if (E2E_LATENCY) e2e_signal(p.member_timestamp);
+    }
+    if (E2E_LATENCY) e2e_record(vin, received);
+}
+
+static void observe_forward(std::chrono::steady_clock::time_point received){
+    g_metrics.forwarded.inc();
+    g_metrics.forward_seconds.observe(
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - received).count());
+}
+
+// BMW loop threads that may call on_bmw_message concurrently (make-before-break
+// swap, several accounts) are serialized here; set in main, never in reactor mode
+static std::mutex          g_bmw_msg_mu;
+static bool                g_bmw_msg_lock = false;
+
+static void on_bmw_message(struct mosquitto*, void* obj, const struct mosquitto_message* m){
+    if (!m || !m->topic) return;
+    const auto received = std::chrono::steady_clock::now();
+
+    // several BMW loop threads may call in concurrently (swap, accounts); the
+    // topic tables and the handoff below have a single owner/producer
+    std::unique_lock<std::mutex> lk(g_bmw_msg_mu, std::defer_lock);
+    if (g_bmw_msg_lock) lk.lock();
+
+    g_metrics.received.inc();
+    if (m->payloadlen > 0) g_metrics.received_bytes.inc(static_cast<uint64_t>(m->payloadlen));
+
+    BmwSession* s = bmw_session(obj);
+    if (BMW_MAKE_BEFORE_BREAK && s) {
+        const long until = s->overlap_until.load(std::memory_order_relaxed);
+        if (until != 0) {
+            if (mono_secs() <= until) {
+                uint64_t h = fnv1a64(m->topic);
+                if (m->payload && m->payloadlen > 0)
+                    h = fnv1a64(std::string_view(static_cast<const char*>(m->payload),
+                                                 static_cast<size_t>(m->payloadlen)), h);
+                if (s->overlap_seen.seen_or_add(h)) {
+                    g_metrics.overlap_dropped.inc();
+                    return;
+                }
+            } else {
+                s->overlap_until.store(0, std::memory_order_relaxed);
+                s->overlap_seen.clear();
+            }
+        }
+    }
+
+    if (!g_fwd_queue) {
+        forward_message(m->topic, m->payload, m->payloadlen, received);
+        observe_forward(received);
+        return;
+    }
+
+    // hand off to the forwarder thread; never block the BMW socket
+    ForwardItem* it = g_fwd_queue->reserve();
+    if (!it) {
+        unsigned long long n = g_fwd_queue->overflow();
+        if (n == 1 || n % 1000 == 0)
+            g_log.write(LogLevel::Warn, LogCat::Fwd,
+                        "[bridge] forward queue full (%zu slots), dropped %llu message(s) so far",
+                        g_fwd_queue->capacity(), n);
+        return;
+    }
+    it->topic.assign(m->topic);
+    if (m->payload && m->payloadlen > 0)
+        it->payload.assign(static_cast<const char*>(m->payload), static_cast<size_t>(m->payloadlen));
+    else
+        it->payload.clear();
+    it->received = received;
+    g_fwd_queue->commit();
+}
+
+// forwarder thread: drains g_fwd_queue until g_fwd_stop, then empties it
+static void forwarder_run(){
+    for (;;) {
+        ForwardItem* it = g_fwd_queue->front();
+        if (!it) {
+            if (g_fwd_stop.load()) break;
+            g_fwd_queue->wait(std::chrono::milliseconds(500));
+            continue;
+        }
+        forward_message(it->topic.c_str(), it->payload.data(), static_cast<int>(it->payload.size()), it->received);
+        observe_forward(it->received);
+        g_fwd_queue->pop();
+    }
+}
+
+// log callback: set last_connect_attempt when "sending CONNECT" appears; filter ping spam
+static void on_bmw_log(struct mosquitto* /*mosq*/, void* userdata,
                        int level, const char* str)
 {
     if(!str) return;
     if (std::strstr(str, "PINGREQ") || std::strstr(str, "PINGRESP")) return;
 
-    if (std::strstr(str, "sending CONNECT")) {
-        g_last_connect_attempt = time(nullptr);
+    // watchdog/backoff state belongs to the primary client
+    const bool primary = bmw_role(userdata) == BmwRole::Primary;
+    BmwSession* s = bmw_session(userdata);
+
+    if (primary && s && std::strstr(str, "sending CONNECT")) {
+        s->last_connect_attempt = mono_ms();
+        g_loop.wake();   // arms the CONNECT watchdog
     }
 
     // nur auf echte Fehler reagieren – KEIN generisches "SSL" matchen
@@ -463,26 +1231,39 @@ static void on_bmw_log(struct mosquitto* /*mosq*/, void* /*userdata*/,
         (level == MOSQ_LOG_ERR) ||
         (level == MOSQ_LOG_WARNING);
 
-    if (is_err_level &&
+    if (primary && s && is_err_level &&
     (std::strstr(str, "OpenSSL Error") ||
         std::strstr(str, "SSL error") ||               // nur Fehler, nicht jede SSL-Zeile
         std::strstr(str, "Connection reset by peer") ||
         std::strstr(str, "unexpected eof") ||
         std::strstr(str, "protocol error")))
     {
-        g_connected = false;
-        publish_status(false);
-        long now = time(nullptr);
-        g_next_connect_after = now + 5 + (jitter_ms(0)/1000);
+        s->connected = false;
+        publish_status();
+        s->next_connect_after = mono_ms() + 5000 + jitter_ms(0);
+        g_loop.wake();
     }
 
-    std::cerr << "[bmw/log] level=" << level << " " << str << "\n";
+    LogLevel lvl = (level == MOSQ_LOG_ERR)     ? LogLevel::Error
+                 : (level == MOSQ_LOG_WARNING) ? LogLevel::Warn
+                                               : LogLevel::Info;
+    if (s && !s->name.empty())
+        g_log.write(lvl, LogCat::BmwLog, "[bmw/log:%s] level=%d %s", s->name.c_str(), level, str);
+    else
+        g_log.write(lvl, LogCat::BmwLog, "[bmw/log] level=%d %s", level, str);
 }
 
-static void on_bmw_suback(struct mosquitto* /*mosq*/, void* /*userdata*/,
+static void on_bmw_suback(struct mosquitto* /*mosq*/, void* userdata,
                           int mid, int qos_count, const int* granted_qos)
 {
-    std::cerr << "[bmw] SUBACK mid=" << mid
+    if (bmw_role(userdata) == BmwRole::Standby) {
+        auto* ctx = static_cast<BmwClientCtx*>(userdata);
+        if (qos_count > 0 && granted_qos && granted_qos[0] <= 2) ctx->subscribed = true;
+        else ctx->failed = true;
+        g_loop.wake();   // promotion happens in the main loop
+    }
+    BmwSession* s = bmw_session(userdata);
+    std::cerr << "[bmw" << (s && !s->name.empty() ? ":" + s->name : std::string()) << "] SUBACK mid=" << mid
               << " qos_count=" << qos_count;
     if (qos_count > 0 && granted_qos) std::cerr << " granted0=" << granted_qos[0];
     std::cerr << "\n";
@@ -490,8 +1271,16 @@ static void on_bmw_suback(struct mosquitto* /*mosq*/, void* /*userdata*/,
 
 // ===================== BMW client factory =====================
 
-static mosquitto* create_bmw_client() {
-    mosquitto* m = mosquitto_new(CLIENT_ID.c_str(), true, nullptr);
+// slot selects the MQTT client id / role context (see BmwClientCtx)
+static mosquitto* create_bmw_client(BmwSession& s, int slot) {
+    BmwClientCtx& ctx = s.ctx[slot];
+    ctx.session = &s;
+    if (ctx.client_id.empty()) ctx.client_id = slot == 0 ? s.client_id : s.client_id + "-mbb";
+    ctx.role = static_cast<int>(BmwRole::Primary);
+    ctx.subscribed = false;
+    ctx.failed = false;
+
+    mosquitto* m = mosquitto_new(ctx.client_id.c_str(), true, &ctx);
     if(!m) return nullptr;
 
     // enable MQTT v5
@@ -506,26 +1295,885 @@ static mosquitto* create_bmw_client() {
     mosquitto_log_callback_set(m, on_bmw_log);
     mosquitto_subscribe_callback_set(m, on_bmw_suback);
 
-    // TLS with system CA
-    mosquitto_tls_set(
-        m,
-        "/etc/ssl/certs/ca-certificates.crt",
-        NULL, NULL, NULL, NULL
-    );
+    // TLS with system CA: shared context with session resumption, or per client
+    if (g_bmw_tls.ctx()) {
+        mosquitto_void_option(m, MOSQ_OPT_SSL_CTX, g_bmw_tls.ctx());
+        mosquitto_int_option(m, MOSQ_OPT_SSL_CTX_WITH_DEFAULTS, 0);
+    } else {
+        mosquitto_tls_set(
+            m,
+            BMW_CA_FILE,
+            NULL, NULL, NULL, NULL
+        );
+    }
 
     // auth
-    mosquitto_username_pw_set(m, GCID.c_str(), g_id_token.c_str());
+    mosquitto_username_pw_set(m, s.gcid.c_str(), s.id_token.c_str());
 
     return m;
 }
 
+// make-before-break, step 1: second client with the new token in the other slot
+static bool bmw_start_standby(BmwSession& s){
+    const int slot = 1 - s.slot;
+    s.standby = create_bmw_client(s, slot);
+    if (!s.standby) return false;
+    s.ctx[slot].role = static_cast<int>(BmwRole::Standby);
+
+    s.overlap_until = std::numeric_limits<long>::max();   // dedupe from now on
+    client_loop_start(s.standby);
+    int rc = mosquitto_connect_async(s.standby, BMW_HOST.c_str(), BMW_PORT, 30);
+    std::cerr << s.tag << " make-before-break: connecting new session as '"
+              << s.ctx[slot].client_id << "' rc=" << rc << "\n";
+    if (rc != MOSQ_ERR_SUCCESS) {
+        bmw_destroy(s.standby);
+        s.overlap_until = 0;
+        return false;
+    }
+    s.standby_since = mono_ms();
+    return true;
+}
+
+// make-before-break, step 2: standby is subscribed → it becomes s.bmw, the old
+// client is disconnected cleanly. Duplicates stay filtered for a few seconds.
+static void bmw_promote_standby(BmwSession& s){
+    const int old_slot = s.slot;
+    s.ctx[old_slot].role     = static_cast<int>(BmwRole::Retiring);
+    s.ctx[1 - old_slot].role = static_cast<int>(BmwRole::Primary);
+
+    mosquitto* old = s.bmw;
+    s.bmw = s.standby;
+    s.standby = nullptr;
+    s.slot = 1 - old_slot;
+    s.connected = true;
+    s.last_connect_attempt = 0;
+
+    if (old) {
+        mosquitto_disconnect(old);
+        mosquitto_loop_stop(old, false);   // loop exits after sending DISCONNECT
+        mosquitto_destroy(old);
+    }
+    s.overlap_until = mono_secs() + 5;
+    g_metrics.bmw_swaps.inc();
+    std::cerr << s.tag << " make-before-break: switched to session '"
+              << s.ctx[s.slot].client_id << "' after "
+              << (mono_ms() - s.standby_since) / 1000 << "s overlap\n";
+}
+
+// ===================== Local broker =====================
+
+static void on_local_connect(struct mosquitto*, void*, int rc, int /*flags*/, const mosquitto_property* props){
+    if (LOCAL_MQTT5) {
+        // aliases start over on every connection, within the broker's limit (absent = 0)
+        uint16_t broker_max = 0;
+        if (props) mosquitto_property_read_int16(props, MQTT_PROP_TOPIC_ALIAS_MAXIMUM, &broker_max, false);
+        std::lock_guard<std::mutex> lk(g_alias_mu);
+        g_topic_alias.reset(rc == 0 ? std::min<uint16_t>(broker_max, static_cast<uint16_t>(LOCAL_TOPIC_ALIASES)) : 0);
+    }
+    g_local_connected = (rc == 0);
+    if (rc == 0) g_loop.wake();   // start replaying the spool
+    std::cerr << "[bridge] local broker connect rc=" << rc;
+    if (rc == 0 && !g_spool.empty())
+        std::cerr << ", " << g_spool.records() << " spooled message(s) to replay";
+    std::cerr << "\n";
+}
+
+static void on_local_disconnect(struct mosquitto*, void*, int rc){
+    g_local_connected = false;
+    if (LOCAL_MQTT5) {
+        std::lock_guard<std::mutex> lk(g_alias_mu);
+        g_topic_alias.reset(0);
+    }
+    std::cerr << "[bridge] local broker disconnect rc=" << rc
+              << (g_spool.is_open() ? " (spooling)" : "") << "\n";
+}
+
+// PUBACK (QoS 1) or written (QoS 0); only QoS 1 mids are known to g_outq
+static void on_local_publish(struct mosquitto*, void*, int mid){
+    g_ack_latency.acked(mid);
+    if (LOCAL_QOS) g_outq.acked(mid);
+}
+
+static void on_local_publish_v5(struct mosquitto*, void*, int mid, int reason_code, const mosquitto_property*){
+    // a rejected message (e.g. not authorized) is not retried either
+    if (reason_code >= 0x80) g_metrics.local_rejected.inc();
+    on_local_publish(nullptr, nullptr, mid);
+}
+
+// replay spooled messages (main loop, at most once per second). While the spool
+// is not empty new messages are appended behind it to keep the order, so each
+// pass replays what was appended since the last one plus SPOOL_REPLAY_RATE:
+// the backlog shrinks by SPOOL_REPLAY_RATE per second whatever the CarData rate.
+static void replay_spool(){
+    static unsigned long long appended_seen = 0;   // g_metrics.spooled at the last pass
+    const unsigned long long appended = g_metrics.spooled.value();
+    const unsigned long long appended_since = appended - appended_seen;
+    appended_seen = appended;   // appends during an outage do not raise the rate
+    if (!g_spool.is_open() || g_spool.empty() || !g_local_connected.load()) return;
+    size_t n = g_spool.replay(static_cast<size_t>(SPOOL_REPLAY_RATE + appended_since),
+        [](const std::string& topic, const char* payload, size_t len, bool retain, uint8_t tag,
+           std::string_view vin, std::string_view timestamp){
+            const Encoding enc = tag <= static_cast<uint8_t>(Encoding::Msgpack) ? static_cast<Encoding>(tag)
+                                                                                : Encoding::Json;
+            const PublishMeta meta{vin, timestamp, OutClass::Replay};
+            if (!LOCAL_QOS)
+                return local_publish(topic.c_str(), static_cast<int>(len), payload, retain, enc, &meta) == MOSQ_ERR_SUCCESS;
+            bool full = false;   // stays spooled until the queue has room again
+            return local_publish_tracked(topic.c_str(), static_cast<int>(len), payload, retain, enc, &meta,
+                                         full) == MOSQ_ERR_SUCCESS && !full;
+        });
+    g_metrics.replayed.inc(n);
+    if (n && g_spool.empty())
+        std::cerr << "[bridge] spool drained (" << g_metrics.replayed.value() << " replayed so far)\n";
+}
+
+// Shutdown with LOCAL_QOS=1: wait up to max_ms for outstanding PUBACKs, then
+// move what is still unacknowledged into the spool (replayed on the next start;
+// the broker may have got some of it already - QoS 1 is at least once).
+static constexpr long long LOCAL_FLUSH_MS = 2000;
+static void flush_outbound(long long max_ms){
+    const long long until = mono_ms() + max_ms;
+    while (g_outq.pending() && g_local_connected.load() && mono_ms() < until) {
+        if (MQTT_REACTOR) mosquitto_loop(g_local, 50, 1);   // no network thread to wait for
+        else std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    size_t spooled = 0;
+    const size_t n = g_outq.drain([&](const OutboundQueue::Message& m){
+        if (g_spool.is_open() &&
+            g_spool.append(m.topic, m.payload.data(), m.payload.size(), m.retain, m.tag, m.vin, m.timestamp))
+            ++spooled;
+    });
+    if (n) std::cerr << "[bridge] " << n << " unacknowledged QoS 1 message(s) at shutdown, "
+                     << spooled << " spooled\n";
+}
+
+// <prefix>stats: local ACK latency per output class over the last STATS_INTERVAL
+// seconds (main loop; not retained)
+static void publish_stats(){
+    std::string payload = "{\"timestamp\":" + std::to_string(static_cast<long>(time(nullptr)))
+        + ",\"interval\":" + std::to_string(STATS_INTERVAL)
+        + ",\"ack_latency_us\":" + g_ack_latency.report(true)
+        + ",\"waiting\":" + std::to_string(g_ack_latency.waiting())
+        + ",\"lost\":" + std::to_string(g_ack_latency.lost()) + "}";
+    const std::string topic = LOCAL_PREFIX + "stats";
+    local_publish(topic.c_str(), static_cast<int>(payload.size()), payload.data(), false);
+}
+
+// E2E_LATENCY: <prefix>vehicles/<VIN>/latency for every VIN heard from in the
+// last window (main loop, with the stats topic; not retained)
+static void publish_e2e(){
+    g_e2e.report(static_cast<long>(time(nullptr)), [](const std::string& vin, const std::string& payload){
+        const std::string topic = LOCAL_PREFIX + "vehicles/" + vin + "/latency";
+        const PublishMeta meta{vin, {}, OutClass::Status};
+        local_publish(topic.c_str(), static_cast<int>(payload.size()), payload.data(), false, Encoding::Json, &meta);
+    });
+}
+
+// publish the vehicles/<VIN>/state snapshots that are due (main loop; always retained)
+static void publish_state(long long now){
+    g_state.flush(now, [](const std::string& vin, const std::string& payload){
+        const std::string topic = LOCAL_PREFIX + "vehicles/" + vin + "/state";
+        static std::string encoded;
+        std::string_view out = payload;
+        Encoding enc = Encoding::Json;
+        if (STATE_ENCODING != Encoding::Json && encode_payload(payload, STATE_ENCODING, encoded)) {
+            out = encoded;
+            enc = STATE_ENCODING;
+        }
+        const PublishMeta meta{vin, {}, OutClass::State};
+        int rc = forward_publish(topic.c_str(), static_cast<int>(out.size()), out.data(), true, enc, &meta);
+        g_metrics.state_snapshots.inc();
+        g_log.write(LogLevel::Info, LogCat::Split, "[bridge] state '%s' bytes=%zu rc=%d",
+                    topic.c_str(), payload.size(), rc);
+    });
+}
+
+// last-known state from a previous run, so the first snapshot is complete
+static void load_state(const std::string& path){
+    const std::string text = read_file(path);
+    if (text.empty()) return;
+    try {
+        auto j = json::parse(text);
+        size_t n = 0;
+        for (auto& [vin, props] : j.items()) {
+            if (vin.size() != 17 || !props.is_object()) continue;
+            for (auto& [name, obj] : props.items()) {
+                if (!obj.is_object() || !obj.contains("value")) continue;
+                uint64_t h = fnv1a64(obj["value"].dump());
+                if (obj.contains("unit")) h = fnv1a64(obj["unit"].dump(), h);
+                g_state.restore(vin, name, obj.dump(), h);
+                ++n;
+            }
+        }
+        std::cerr << "[bridge] state: " << g_state.vehicles() << " vehicle(s), " << n
+                  << " properties restored from " << path << "\n";
+    } catch (const std::exception& e) {
+        std::cerr << "[bridge] state: ignoring " << path << ": " << e.what() << "\n";
+    }
+}
+
+static void save_state(const std::string& path){
+    if (!write_file_atomic(path, g_state.dump(), 0644))
+        std::cerr << "[bridge] state: cannot write " << path << "\n";
+}
+
+// ===================== MQTT reactor =====================
+// MQTT_REACTOR=1: no mosquitto_loop_start() threads. The sockets of the local
+// client and of each session's BMW client and make-before-break standby are
+// watched by g_loop; the main loop dispatches readiness to mosquitto_loop_read/write and
+// runs mosquitto_loop_misc (keepalive). All callbacks, the forwarding and the
+// local publish then run on the main thread, one message at a time. The
+// reconnect the loop thread would do is scheduled here (1..10 s, doubling;
+// the BMW client also respects the backoff fence).
+
+struct ReactorConn {
+    std::string             name;
+    mosquitto**             client;   // &g_local, &session->bmw, &session->standby
+    std::atomic<bool>*      up;       // connection flag; nullptr = never reconnect
+    std::atomic<long long>* fence;    // backoff fence (BMW) or nullptr
+    mosquitto*         seen = nullptr;     // client the state below belongs to
+    int                fd = -1;            // socket registered with g_loop
+    bool               want_write = false;
+    bool               had_socket = false; // connected once → reconnect after loss
+                                           // (never got one: BMW CONNECT watchdog rebuilds)
+    long long          reconnect_at = 0;   // mono_ms(); 0 = none scheduled
+    int                delay = 1;          // next reconnect delay in s
+};
+static std::vector<ReactorConn> g_reactor;   // fixed after reactor_init()
+static constexpr long long REACTOR_MISC_MS = 5000;   // keepalive check (keepalive is 30 s)
+static long long g_reactor_misc_at = 0;
+
+// after the sessions are set up (the vector must not grow later)
+static void reactor_init(){
+    g_reactor.clear();
+    g_reactor.push_back({"local", &g_local, &g_local_connected, nullptr});
+    for (auto& s : g_sessions) {
+        const std::string sfx = s->name.empty() ? std::string() : " (" + s->name + ")";
+        g_reactor.push_back({"BMW" + sfx, &s->bmw, &s->connected, &s->next_connect_after});
+        g_reactor.push_back({"BMW standby" + sfx, &s->standby, nullptr, nullptr});
+    }
+}
+
+// Before each wait: (re)register sockets, start due reconnects. Returns the
+// earliest reactor deadline (reconnect or keepalive check).
+static long long reactor_arm(long long now){
+    long long next = g_reactor_misc_at;
+    for (auto& c : g_reactor) {
+        mosquitto* m = *c.client;
+        if (m != c.seen) {   // new or destroyed client (rebuild, swap)
+            c.seen = m;
+            c.fd = -1;
+            c.want_write = false;
+            c.had_socket = false;
+            c.reconnect_at = 0;
+            c.delay = 1;
+        }
+        if (!m) continue;
+        if (c.up && c.up->load()) c.delay = 1;
+
+        int fd = mosquitto_socket(m);
+        if (fd < 0 && c.up && c.had_socket) {
+            if (!c.reconnect_at) {
+                c.reconnect_at = now + c.delay * 1000LL;
+                if (c.fence) c.reconnect_at = std::max(c.reconnect_at, c.fence->load());
+                c.delay = std::min(c.delay * 2, 10);
+            }
+            if (now >= c.reconnect_at) {
+                c.reconnect_at = 0;
+                int rc = mosquitto_reconnect_async(m);
+                std::cerr << "[bridge] reactor: " << c.name << " reconnect rc=" << rc << "\n";
+                fd = mosquitto_socket(m);
+                c.fd = -1;   // may be a new socket with the old number
+            } else {
+                next = std::min(next, c.reconnect_at);
+            }
+        }
+        if (fd < 0) { c.fd = -1; continue; }
+
+        c.had_socket = true;
+        const bool ww = mosquitto_want_write(m);
+        if (fd != c.fd || ww != c.want_write) {
+            if (!g_loop.watch(fd, EPOLLIN | (ww ? static_cast<uint32_t>(EPOLLOUT) : 0u)))
+                std::cerr << "[bridge] reactor: cannot watch " << c.name << " socket: " << std::strerror(errno) << "\n";
+            c.fd = fd;
+            c.want_write = ww;
+        }
+    }
+    return next;
+}
+
+// After each wait: let libmosquitto read/write the ready sockets; callbacks
+// run from here.
+static void reactor_dispatch(long long now){
+    const bool misc = now >= g_reactor_misc_at;
+    if (misc) g_reactor_misc_at = now + REACTOR_MISC_MS;
+
+    for (auto& c : g_reactor) {
+        mosquitto* m = *c.client;
+        if (!m || m != c.seen || c.fd < 0) continue;
+        const uint32_t ev = g_loop.events(c.fd);
+        int rc = MOSQ_ERR_SUCCESS;
+        if (ev & (EPOLLIN | EPOLLERR | EPOLLHUP)) rc = mosquitto_loop_read(m, 1);
+        if (rc == MOSQ_ERR_SUCCESS && (ev & EPOLLOUT)) rc = mosquitto_loop_write(m, 1);
+        if (rc == MOSQ_ERR_SUCCESS && misc) rc = mosquitto_loop_misc(m);
+        if (rc != MOSQ_ERR_SUCCESS) {
+            // libmosquitto closed the socket and ran the disconnect callback
+            g_log.write(LogLevel::Info, LogCat::Bridge, "[bridge] reactor: %s connection lost rc=%d (%s)",
+                        c.name.c_str(), rc, mosquitto_strerror(rc));
+            c.fd = -1;
+            c.want_write = false;
+        }
+    }
+}
+
+// ===================== Metrics endpoint =====================
+
+static std::string render_metrics(){
+    metrics::Writer w;
+    w.counter("bmw_bridge_messages_received", "Messages received from BMW CarData", g_metrics.received.value());
+    w.counter("bmw_bridge_received_bytes", "Payload bytes received from BMW CarData", g_metrics.received_bytes.value());
+    w.counter("bmw_bridge_messages_forwarded", "Messages republished to the local broker", g_metrics.forwarded.value());
+    w.counter("bmw_bridge_local_publishes", "Successful local publishes (all topics)", g_metrics.published.value());
+    w.counter("bmw_bridge_published_bytes", "Payload bytes published to the local broker", g_metrics.published_bytes.value());
+    w.code_counter("bmw_bridge_publish_errors", "Failed local publishes by mosquitto_publish return code",
+                   "rc", g_metrics.publish_errors);
+    if (LOCAL_MQTT5) {
+        std::lock_guard<std::mutex> lk(g_alias_mu);
+        w.counter("bmw_bridge_local_topic_alias_hits", "Local publishes sent with a topic alias instead of the topic",
+                  g_topic_alias.hits());
+        w.counter("bmw_bridge_local_topic_alias_remaps", "Topic aliases reassigned to another topic (LRU)",
+                  g_topic_alias.remaps());
+        w.gauge("bmw_bridge_local_topic_aliases", "Topic aliases in use on the local connection",
+                (double)g_topic_alias.size());
+    }
+    w.counter("bmw_bridge_split_published", "Split topic publishes", g_split_published.load());
+    w.counter("bmw_bridge_split_suppressed", "Split publishes suppressed as unchanged (SPLIT_CHANGE_ONLY)",
+              g_split_suppressed.load());
+    w.counter("bmw_bridge_state_snapshots", "Snapshots published to vehicles/<VIN>/state (STATE_SNAPSHOT)",
+              g_metrics.state_snapshots.value());
+    w.counter("bmw_bridge_api_requests", "State API responses", g_metrics.api_requests.value());
+    w.counter("bmw_bridge_api_not_modified", "State API 304 responses (If-None-Match)", g_metrics.api_not_modified.value());
+    w.gauge("bmw_bridge_state_vehicles", "Vehicles in the last-known state store", (double)g_state.vehicles());
+    if (g_history.is_open()) {
+        const history::Writer::Stats hs = g_history.stats();
+        w.counter("bmw_bridge_history_points", "Signal values appended to the history", hs.points);
+        w.counter("bmw_bridge_history_dropped", "History values dropped (timestamp not newer than the last)", hs.dropped);
+        w.counter("bmw_bridge_history_commits", "History group commits", hs.commits);
+        w.counter("bmw_bridge_history_written_bytes", "Chunk bytes written by history commits", hs.bytes);
+        w.counter("bmw_bridge_history_errors", "History series that failed to commit", hs.errors);
+        w.gauge("bmw_bridge_history_series", "Signal series in the history", (double)g_history.series_count());
+    }
+    w.histogram("bmw_bridge_forward_latency_seconds", "BMW receive to local publish done, per message",
+                g_metrics.forward_seconds);
+    if (g_fwd_queue) {
+        w.gauge("bmw_bridge_forward_queue_depth", "Messages waiting in the forward queue", (double)g_fwd_queue->depth());
+        w.gauge("bmw_bridge_forward_queue_high_water", "Highest forward queue depth seen", (double)g_fwd_queue->high_water());
+        w.counter("bmw_bridge_forward_queue_overflow", "Messages dropped because the forward queue was full",
+                  g_fwd_queue->overflow());
+    }
+    size_t up = 0;
+    for (auto& ss : g_sessions) if (ss->connected.load()) ++up;
+    w.gauge("bmw_bridge_bmw_connected", "BMW CarData sessions connected (1 per account)", (double)up);
+    w.gauge("bmw_bridge_bmw_sessions", "Configured BMW CarData sessions (accounts)", (double)g_sessions.size());
+    w.code_counter("bmw_bridge_bmw_connacks", "BMW CONNACKs by reason code", "reason_code", g_metrics.bmw_connack);
+    w.code_counter("bmw_bridge_bmw_disconnects", "BMW disconnects by reason code", "reason_code", g_metrics.bmw_disconnect);
+    w.counter("bmw_bridge_bmw_rebuilds", "Full BMW client rebuilds", g_metrics.bmw_rebuilds.value());
+    w.counter("bmw_bridge_bmw_session_swaps", "Make-before-break session swaps", g_metrics.bmw_swaps.value());
+    w.counter("bmw_bridge_overlap_duplicates_dropped", "Duplicate messages dropped during a session swap",
+              g_metrics.overlap_dropped.value());
+    w.counter_family("bmw_bridge_token_refreshes", "Token refresh attempts by result",
+                     {{"result=\"ok\"", g_metrics.refresh_ok.value()},
+                      {"result=\"failed\"", g_metrics.refresh_failed.value()}});
+    w.histogram("bmw_bridge_token_refresh_duration_seconds", "Duration of token refresh requests",
+                g_metrics.refresh_seconds);
+    w.counter("bmw_bridge_bmw_tls_handshakes", "BMW TLS handshakes", g_metrics.tls_handshakes.value());
+    w.counter("bmw_bridge_bmw_tls_resumed", "BMW TLS handshakes that resumed a cached session",
+              g_metrics.tls_resumed.value());
+    w.histogram("bmw_bridge_bmw_tls_handshake_seconds", "Duration of BMW TLS handshakes",
+                g_metrics.tls_handshake_seconds);
+    w.counter("bmw_bridge_token_refresh_connection_reused", "Token refreshes that reused an open connection",
+              g_metrics.refresh_reused.value());
+    if (g_spool.is_open()) {
+        w.gauge("bmw_bridge_spool_messages", "Messages waiting in the spool", (double)g_spool.records());
+        w.gauge("bmw_bridge_spool_bytes", "Bytes used in the spool", (double)g_spool.bytes_used());
+        w.gauge("bmw_bridge_spool_capacity_bytes", "Size of the spool data area", (double)g_spool.capacity());
+        w.counter("bmw_bridge_spooled", "Messages written to the spool", g_metrics.spooled.value());
+        w.counter("bmw_bridge_spool_replayed", "Spooled messages published after reconnect", g_metrics.replayed.value());
+        w.counter("bmw_bridge_spool_evicted", "Oldest spooled messages dropped because the spool was full",
+                  g_spool.evicted());
+        w.counter("bmw_bridge_spool_corrupt", "Spooled messages discarded after a CRC mismatch", g_spool.corrupt());
+    }
+    if (LOCAL_QOS) {
+        w.gauge("bmw_bridge_local_queue_messages", "QoS 1 messages published but not yet acknowledged",
+                (double)g_outq.pending());
+        w.gauge("bmw_bridge_local_queue_bytes", "Bytes held for unacknowledged QoS 1 messages", (double)g_outq.bytes());
+        w.gauge("bmw_bridge_local_queue_high_water", "Most unacknowledged QoS 1 messages at once",
+                (double)g_outq.high_water());
+        w.counter("bmw_bridge_local_acked", "QoS 1 messages acknowledged by the local broker", g_outq.acked_total());
+        w.counter("bmw_bridge_local_queue_full", "Messages not published because the outbound queue was full",
+                  g_outq.full_total());
+        w.counter("bmw_bridge_local_queue_dropped", "Messages dropped because the outbound queue was full (no spool)",
+                  g_metrics.local_queue_dropped.value());
+        w.counter("bmw_bridge_local_rejected", "QoS 1 messages the local broker rejected (v5 reason code)",
+                  g_metrics.local_rejected.value());
+    }
+    w.gauge("bmw_bridge_local_connected", "1 if connected to the local broker", g_local_connected.load() ? 1 : 0);
+    w.counter("bmw_bridge_main_loop_wakeups", "Main loop wakeups (deadline or event)", g_metrics.loop_wakeups.value());
+    w.counter("bmw_bridge_log_dropped", "Log lines dropped because the log ring was full", g_log.dropped());
+    return w.finish();
+}
+
+static HttpResponse metrics_http(const HttpRequest& req){
+    HttpResponse r;
+    if (req.path != "/metrics") {
+        r.status = 404;
+        r.body = "not found\n";
+        return r;
+    }
+    r.content_type = metrics::Writer::CONTENT_TYPE;
+    r.body = render_metrics();
+    return r;
+}
+
+// ===================== State API =====================
+// Read-only JSON view of g_state (API_PORT):
+//   GET /api/vehicles               {"vehicles":["<VIN>",...]}
+//   GET /api/vehicles/<VIN>         snapshot, same payload as vehicles/<VIN>/state
+//   GET /api/vehicles/<VIN>/<prop>  one property object as received
+// Every response has an ETag; a matching If-None-Match gives 304 without a
+// body, and with ?wait=<s> the request is held until the resource changes
+// (long-poll). Bodies come from the store's cache, rebuilt only on change.
+
+static constexpr int API_WAIT_MAX_SECS = 60;
+
+// "<run>-<version>": versions restart with the process, the run id keeps old tags from matching
+static std::string api_etag(uint64_t version){
+    static const std::string run = [] {
+        char buf[24];
+        std::snprintf(buf, sizeof(buf), "%lx", static_cast<unsigned long>(time(nullptr)));
+        return std::string(buf);
+    }();
+    return "\"" + run + "-" + std::to_string(version) + "\"";
+}
+
+static bool etag_matches(const std::string& if_none_match, const std::string& etag){
+    size_t i = 0;
+    while (i < if_none_match.size()) {
+        size_t comma = if_none_match.find(',', i);
+        if (comma == std::string::npos) comma = if_none_match.size();
+        std::string t = trim_copy(if_none_match.substr(i, comma - i));
+        if (t.rfind("W/", 0) == 0) t.erase(0, 2);   // weak comparison
+        if (t == "*" || t == etag) return true;
+        i = comma + 1;
+    }
+    return false;
+}
+
+static std::string url_decode(std::string_view s){
+    std::string out;
+    out.reserve(s.size());
+    for (size_t i = 0; i < s.size(); ++i) {
+        auto hex = [](char c) -> int {
+            if (c >= '0' && c <= '9') return c - '0';
+            if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+            if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+            return -1;
+        };
+        if (s[i] == '%' && i + 2 < s.size() && hex(s[i + 1]) >= 0 && hex(s[i + 2]) >= 0) {
+            out.push_back(static_cast<char>(hex(s[i + 1]) * 16 + hex(s[i + 2])));
+            i += 2;
+        } else {
+            out.push_back(s[i]);
+        }
+    }
+    return out;
+}
+
+static HttpResponse api_http(const HttpRequest& req){
+    g_metrics.api_requests.inc();
+    HttpResponse r;
+    r.content_type = "application/json";
+
+    // /api/vehicles[/<VIN>[/<prop>]]
+    const std::string_view base = "/api/vehicles";
+    std::string_view rest(req.path);
+    if (rest.substr(0, base.size()) != base || (rest.size() > base.size() && rest[base.size()] != '/')) {
+        r.status = 404;
+        r.body = "{\"error\":\"not found\"}\n";
+        return r;
+    }
+    rest.remove_prefix(base.size());
+    while (!rest.empty() && rest.front() == '/') rest.remove_prefix(1);
+    while (!rest.empty() && rest.back() == '/') rest.remove_suffix(1);
+    const size_t slash = rest.find('/');
+    const std::string vin  = url_decode(rest.substr(0, slash));
+    const std::string prop = slash == std::string_view::npos ? std::string() : url_decode(rest.substr(slash + 1));
+
+    auto fetch = [&](uint64_t& version) -> VehicleStateStore::Body {
+        if (vin.empty())  return g_state.vehicle_list(version);
+        if (prop.empty()) return g_state.vehicle_state(vin, version);
+        return g_state.property(vin, prop, version);
+    };
+
+    uint64_t version = 0;
+    VehicleStateStore::Body body = fetch(version);
+    if (!body) {
+        r.status = 404;
+        r.body = "{\"error\":\"not found\"}\n";
+        return r;
+    }
+
+    const std::string inm = req.header("if-none-match");
+    if (!inm.empty() && etag_matches(inm, api_etag(version))) {
+        // long-poll: hold the request until the resource changes (or wait/shutdown)
+        int wait = std::atoi(req.query_param("wait").c_str());
+        wait = std::clamp(wait, 0, API_WAIT_MAX_SECS);
+        const auto until = std::chrono::steady_clock::now() + std::chrono::seconds(wait);
+        uint64_t cur = version;
+        while (cur == version && !g_stop.load()) {
+            const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                until - std::chrono::steady_clock::now());
+            if (left.count() <= 0) break;
+            cur = g_state.wait_changed(vin, prop, version, std::min(left, std::chrono::milliseconds(500)));
+        }
+        if (cur == version) {
+            g_metrics.api_not_modified.inc();
+            r.status = 304;
+            r.headers.push_back({"ETag", api_etag(version)});
+            return r;
+        }
+        body = fetch(version);
+    }
+
+    r.headers.push_back({"ETag", api_etag(version)});
+    r.headers.push_back({"Cache-Control", "no-cache"});
+    r.body = *body;
+    return r;
+}
+
+// metrics and API on one port (API_PORT == METRICS_PORT)
+static HttpResponse http_dispatch(const HttpRequest& req){
+    if (req.path.rfind("/api/", 0) == 0) return api_http(req);
+    return metrics_http(req);
+}
+
+// ===================== Token refresh worker =====================
+// The HTTP refresh runs on its own thread with a persistent curl session, so
+// the main loop (CONNECT watchdog, status debounce, spool replay) keeps
+// running while a request is in flight. A finished refresh is handed back
+// through the session's atomic result pointer and wakes the main loop, which
+// applies it. One worker (one thread, one curl session and connection to the
+// token endpoint) serves all accounts; requests are handled in order.
+
+class RefreshWorker {
+public:
+    ~RefreshWorker(){ stop(); }
+
+    void start(){
+        if (th_.joinable()) return;
+        stop_ = false;
+        http().set_abort_flag(&stop_);
+        th_ = std::thread([this]{ run(); });
+    }
+
+    void stop(){
+        if (!th_.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            stop_ = true;
+        }
+        cv_.notify_one();
+        th_.join();   // a request in flight is aborted via the progress callback
+        pending_.clear();
+        http_.reset(); // before curl_global_cleanup()
+    }
+
+    // queue a refresh for s; false if one is already queued or running
+    bool request(BmwSession& s){
+        std::lock_guard<std::mutex> lk(mu_);
+        if (s.refresh_busy.load()) return false;
+        s.refresh_busy = true;
+        pending_.push_back(&s);
+        cv_.notify_one();
+        return true;
+    }
+
+    bool busy(const BmwSession& s) const { return s.refresh_busy.load(); }
+
+    // finished refresh of s or nullptr (main thread)
+    std::unique_ptr<RefreshResult> take(BmwSession& s){
+        return std::unique_ptr<RefreshResult>(s.refresh_result.exchange(nullptr, std::memory_order_acq_rel));
+    }
+
+    // synchronous refresh on the caller's thread (startup, worker not running)
+    RefreshResult run_now(const BmwSession& s){ return perform(s); }
+
+private:
+    CurlSession& http(){
+        if (!http_) http_.reset(new CurlSession());
+        return *http_;
+    }
+
+    // one refresh with duration/result accounting
+    RefreshResult perform(const BmwSession& s){
+        RefreshResult r;
+        const auto t0 = std::chrono::steady_clock::now();
+        std::unique_ptr<TokenSet> t = fetch_tokens(http(), s);
+        g_metrics.refresh_seconds.observe(
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count());
+        if (t) {
+            r.ok = true;
+            r.tokens = std::move(*t);
+        }
+        (r.ok ? g_metrics.refresh_ok : g_metrics.refresh_failed).inc();
+        return r;
+    }
+
+    void run(){
+        std::unique_lock<std::mutex> lk(mu_);
+        for (;;) {
+            cv_.wait(lk, [this]{ return stop_.load() || !pending_.empty(); });
+            if (stop_) break;
+            BmwSession* s = pending_.front();
+            pending_.pop_front();
+            lk.unlock();
+
+            // small jitter to avoid sync with other processes
+            std::this_thread::sleep_for(std::chrono::milliseconds(100 + (jitter_() % 200)));
+            RefreshResult* r = new RefreshResult(perform(*s));
+            delete s->refresh_result.exchange(r, std::memory_order_acq_rel);
+            s->refresh_busy = false;   // after the result is visible
+            g_loop.wake();
+
+            lk.lock();
+        }
+    }
+
+    std::unique_ptr<CurlSession> http_;
+    std::minstd_rand jitter_{std::random_device{}()};   // worker thread only
+    std::thread th_;
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::deque<BmwSession*> pending_;            // guarded by mu_
+    std::atomic<bool> stop_{false};
+};
+
+static RefreshWorker g_refresh;
+
+// synchronous refresh (startup only; the main loop uses g_refresh)
+static bool refresh_tokens(BmwSession& s){
+    RefreshResult r = g_refresh.run_now(s);
+    if (r.ok) apply_tokens(s, r.tokens);
+    return r.ok;
+}
+
+// ===================== Sessions =====================
+// BMW_BRIDGE_NO_MAIN: lets bench/bmw_bench.cpp include this file and drive
+// on_bmw_message() directly without the bridge's own main().
+#ifndef BMW_BRIDGE_NO_MAIN
+
+
+// refresh / watchdog constants (mono_ms() unless noted)
+static constexpr long      CLOCK_SKEW_SECS    = 60;            // 1 min safety for clock drift
+static constexpr long long CONNECT_TIMEOUT_MS = 30*1000;       // until we assume "CONNECT hung"
+static constexpr long      SOFT_MARGIN_SECS   = 10*60;         // refresh 10 min before exp
+static constexpr long long HARD_REFRESH_MS    = 45*60*1000LL;  // refresh at least every 45 min
+static constexpr long long REFRESH_RETRY_MS   = 10*1000;       // min. gap between refresh attempts
+
+// session for the account in dir (id_token.txt / refresh_token.txt there)
+static std::unique_ptr<BmwSession> make_session(const std::string& name, const std::string& dir,
+                                                const std::string& client_id, const std::string& gcid){
+    auto s = std::make_unique<BmwSession>();
+    s->name               = name;
+    s->tag                = name.empty() ? std::string("[bridge]") : "[bridge:" + name + "]";
+    s->client_id          = client_id;
+    s->gcid               = gcid;
+    s->id_token_file      = (std::filesystem::path(dir) / "id_token.txt").string();
+    s->refresh_token_file = (std::filesystem::path(dir) / "refresh_token.txt").string();
+    return s;
+}
+
+// initial tokens of a session (refreshed once if the id_token has no exp)
+static bool session_load_tokens(BmwSession& s){
+    s.id_token      = trim(read_file(s.id_token_file));
+    s.refresh_token = trim(read_file(s.refresh_token_file));
+    if (s.id_token.empty() || s.refresh_token.empty()) {
+        std::cerr << "✖ id_token.txt or refresh_token.txt missing/empty in "
+                  << dirname_of(s.id_token_file) << "\n";
+        return false;
+    }
+    s.id_token_exp = jwt_exp_unix(s.id_token);
+    if (s.id_token_exp.load() == 0) {
+        std::cerr << "✖ invalid id_token (no exp) → trying refresh\n";
+        if (!refresh_tokens(s)) {
+            std::cerr << "✖ cannot obtain valid token" << (s.name.empty() ? "" : " for account " + s.name) << "\n";
+            return false;
+        }
+    }
+    const long long now = mono_ms();
+    s.last_successful_refresh = now;
+    s.last_refresh_attempt    = now - REFRESH_RETRY_MS - 1;
+    return true;
+}
+
+// first BMW client + connect (respects the backoff fence). The CONNECT
+// watchdog is armed in every case: if connect_async fails (e.g. DNS not ready
+// at boot) there is no socket, so neither "sending CONNECT" nor - with
+// MQTT_REACTOR - a reconnect would ever follow; the watchdog rebuild does.
+static bool session_start(BmwSession& s){
+    s.bmw = create_bmw_client(s, s.slot);
+    if (!s.bmw) return false;
+    client_loop_start(s.bmw);
+
+    if (mono_ms() >= s.next_connect_after.load()) {
+        int rc = mosquitto_connect_async(s.bmw, BMW_HOST.c_str(), BMW_PORT, 30);
+        if(rc != MOSQ_ERR_SUCCESS){
+            std::cerr << s.tag << " connect BMW failed (host/port/TLS?) rc=" << rc << "\n";
+            // do not exit; watchdog will retry later
+        }
+    } else {
+        std::cerr << s.tag << " initial connect delayed due to backoff\n";
+    }
+    s.last_connect_attempt = mono_ms();
+    return true;
+}
+
+static void session_stop(BmwSession& s){
+    bmw_destroy(s.standby);
+    if (s.bmw) {
+        mosquitto_loop_stop(s.bmw, true);
+        mosquitto_disconnect(s.bmw);
+        mosquitto_destroy(s.bmw);
+        s.bmw = nullptr;
+    }
+}
+
+// One main loop pass for a session: refresh result, make-before-break,
+// backoff, scheduled rebuild, token refresh and CONNECT watchdog. Lowers
+// wake_at to the session's next deadline.
+static void session_tick(BmwSession& s, long long now, long long& wake_at){
+    auto wake_by = [&](long long t){ if (t < wake_at) wake_at = t; };
+
+    // finished refresh from the worker? (applied even inside a backoff window)
+    if (auto r = g_refresh.take(s)) {
+        if (r->ok) {
+            apply_tokens(s, r->tokens);
+            s.last_successful_refresh = now;
+
+            if (BMW_MAKE_BEFORE_BREAK && s.connected.load() && !s.standby &&
+                bmw_start_standby(s)) {
+                // old session keeps forwarding until the new one is subscribed
+            } else {
+                int upw_rc = mosquitto_username_pw_set(s.bmw, s.gcid.c_str(), s.id_token.c_str());
+                if (upw_rc != MOSQ_ERR_SUCCESS) {
+                    std::cerr << s.tag << " username_pw_set rc=" << upw_rc << "\n";
+                }
+
+                s.connected = false;
+                publish_status();
+
+                // leichtes Backoff + Jitter wie beim Script-Flow: rebuild in ~2s
+                // (scheduled, the loop keeps running meanwhile)
+                s.next_connect_after = now + 1000; // 1s Sperre, nur zur Sicherheit
+                s.rebuild_after_refresh_at = now + 2000;
+            }
+        } else {
+            s.next_connect_after = now + 15*1000;
+            std::cerr << s.tag << " refresh failed, retry soon\n";
+        }
+    }
+
+    // make-before-break in progress?
+    if (s.standby) {
+        BmwClientCtx& sc = s.ctx[1 - s.slot];
+        if (sc.subscribed.load()) {
+            bmw_promote_standby(s);
+        } else if (sc.failed.load() || (now - s.standby_since) > CONNECT_TIMEOUT_MS) {
+            std::cerr << s.tag << " make-before-break: new session failed -> full rebuild\n";
+            bmw_destroy(s.standby);
+            s.overlap_until = 0;
+            s.connected = false;
+            publish_status();
+            s.rebuild_after_refresh_at = now;
+        } else {
+            wake_by(s.standby_since + CONNECT_TIMEOUT_MS + 1);
+        }
+    }
+
+    // 0) Backoff window active? → do not trigger new actions
+    const long long fence = s.next_connect_after.load();
+    if (now < fence) { wake_by(fence); return; }
+
+    if (s.rebuild_after_refresh_at && now >= s.rebuild_after_refresh_at) {
+        s.rebuild_after_refresh_at = 0;
+        // kompletter Rebuild → verhindert TLS/State-Races
+        bmw_full_reconnect(s);
+    }
+    if (s.rebuild_after_refresh_at) wake_by(s.rebuild_after_refresh_at);
+
+    // token refresh: soft (before exp) or hard (max. age); the worker wakes
+    // the loop when it is done. exp is wall clock, converted on every pass.
+    const long secs_left = s.id_token_exp.load() - static_cast<long>(time(nullptr));
+    const long long soft_at = now + (secs_left - SOFT_MARGIN_SECS - CLOCK_SKEW_SECS) * 1000LL;
+    const long long hard_at = s.last_successful_refresh + HARD_REFRESH_MS;
+    bool due_soft = now >= soft_at;
+    bool due_hard = now >= hard_at;
+    if (!g_refresh.busy(s) && !s.rebuild_after_refresh_at) {
+        if (due_soft || due_hard) {
+            if (now - s.last_refresh_attempt > REFRESH_RETRY_MS) {
+                std::cout << s.tag << " token refresh (" << (due_soft ? "soft" : "hard") << ")\n";
+                s.last_refresh_attempt = now;
+                g_refresh.request(s);   // result is picked up above after the wake
+            } else {
+                wake_by(s.last_refresh_attempt + REFRESH_RETRY_MS + 1);
+            }
+        } else {
+            wake_by(std::min(soft_at, hard_at));
+        }
+    }
+
+    // CONNECT watchdog: CONNECT sent but no CONNACK in time
+    long long last_attempt = s.last_connect_attempt.load();
+    bool connect_hung = (last_attempt != 0) && ((now - last_attempt) > CONNECT_TIMEOUT_MS);
+    if (connect_hung) {
+        std::cerr << s.tag << " CONNECT timed out or handshake failed -> full mosquitto client rebuild\n";
+        g_metrics.bmw_rebuilds.inc();
+        s.connected = false;
+        publish_status();
+
+        bmw_destroy(s.standby);
+        bmw_destroy(s.bmw);
+
+        s.bmw = create_bmw_client(s, s.slot);
+        if(!s.bmw){
+            std::cerr << s.tag << " rebuild failed (mosquitto_new)\n";
+            s.next_connect_after = now + 2000;   // retry after the fence
+            wake_by(now + 2000);
+            return;
+        }
+        client_loop_start(s.bmw);
+
+        if (mono_ms() >= s.next_connect_after.load()) {
+            int rc = mosquitto_connect_async(s.bmw, BMW_HOST.c_str(), BMW_PORT, 30);
+            std::cerr << s.tag << " rebuild+connect rc=" << rc << "\n";
+            s.last_connect_attempt = mono_ms();
+        } else {
+            std::cerr << s.tag << " rebuild done, connect delayed due to backoff\n";
+        }
+        last_attempt = s.last_connect_attempt.load();
+    }
+    if (last_attempt != 0) wake_by(last_attempt + CONNECT_TIMEOUT_MS + 1);
+}
+
 // ===================== Main =====================
 
-static void sigint_handler(int){ g_stop = true; }
+static void sigint_handler(int){ g_stop = true; g_loop.wake(); }
+static void sigusr1_handler(int){ g_dump_stats = true; g_loop.wake(); }
 
 int main(){
     std::signal(SIGINT,  sigint_handler);
     std::signal(SIGTERM, sigint_handler);
+    std::signal(SIGUSR1, sigusr1_handler);
 
     // load .env from fixed token directory (created by bmw_flow.sh)
     const std::string TDIR = token_dir();
@@ -535,6 +2183,7 @@ int main(){
     // initialize
     CLIENT_ID        = env_str("CLIENT_ID",        "");
     GCID             = env_str("GCID",             "");
+    ACCOUNTS         = env_str("ACCOUNTS",         "");
     BMW_HOST         = env_str("BMW_HOST",         "customer.streaming-cardata.bmwgroup.com");
     BMW_PORT         = env_int("BMW_PORT",         9000);
     LOCAL_HOST       = env_str("LOCAL_HOST",       "127.0.0.1");
@@ -542,12 +2191,65 @@ int main(){
     LOCAL_PREFIX     = env_str("LOCAL_PREFIX",     "bmw/");
     LOCAL_USER       = env_str("LOCAL_USER",       "");
     LOCAL_PASSWORD   = env_str("LOCAL_PASSWORD",   "");
+    LOCAL_MQTT5      = env_int("LOCAL_MQTT5",      1);
+    LOCAL_TOPIC_ALIASES = env_int("LOCAL_TOPIC_ALIASES", 64);
+    if (LOCAL_TOPIC_ALIASES < 0) LOCAL_TOPIC_ALIASES = 0;
+    if (LOCAL_TOPIC_ALIASES > 65535) LOCAL_TOPIC_ALIASES = 65535;
+    LOCAL_QOS        = env_int("LOCAL_QOS",        0) ? 1 : 0;
+    LOCAL_INFLIGHT   = env_int("LOCAL_INFLIGHT",   100);
+    if (LOCAL_INFLIGHT < 1) LOCAL_INFLIGHT = 1;
+    if (LOCAL_INFLIGHT > 65535) LOCAL_INFLIGHT = 65535;
+    LOCAL_QUEUE_MAX  = env_int("LOCAL_QUEUE_MAX",  10000);
+    if (LOCAL_QUEUE_MAX < LOCAL_INFLIGHT) LOCAL_QUEUE_MAX = LOCAL_INFLIGHT;
+    LOCAL_QUEUE_MB   = env_int("LOCAL_QUEUE_MB",   16);
+    if (LOCAL_QUEUE_MB < 1) LOCAL_QUEUE_MB = 1;
+    g_outq.configure(static_cast<size_t>(LOCAL_QUEUE_MAX), static_cast<size_t>(LOCAL_QUEUE_MB) * 1024 * 1024);
     SPLIT_TOPICS     = env_int("SPLIT_TOPICS",     0);
     MQTT_RETAIN      = env_int("MQTT_RETAIN",      0);
+    TOPIC_CACHE_MAX  = env_int("TOPIC_CACHE_MAX",  4096);
+    if (TOPIC_CACHE_MAX < 16) TOPIC_CACHE_MAX = 16;
+    g_event_topics.set_max_entries(static_cast<size_t>(TOPIC_CACHE_MAX));
+    g_split_topics.set_max_entries(static_cast<size_t>(TOPIC_CACHE_MAX));
+
+    FWD_QUEUE_SIZE   = env_int("FWD_QUEUE_SIZE",   1024);
+    if (FWD_QUEUE_SIZE < 0) FWD_QUEUE_SIZE = 0;
+    SPLIT_CHANGE_ONLY = env_int("SPLIT_CHANGE_ONLY", 0);
+    SPLIT_HEARTBEAT   = env_int("SPLIT_HEARTBEAT",   300);
+    if (SPLIT_HEARTBEAT < 0) SPLIT_HEARTBEAT = 0;
+    SPLIT_ENCODING    = env_encoding("SPLIT_ENCODING");
+    RAW_ENCODING      = env_encoding("RAW_ENCODING");
+    STATE_SNAPSHOT    = env_int("STATE_SNAPSHOT",    0);
+    STATE_COALESCE_MS = env_int("STATE_COALESCE_MS", 1000);
+    if (STATE_COALESCE_MS < 0) STATE_COALESCE_MS = 0;
+    STATE_INTERVAL    = env_int("STATE_INTERVAL",    0);
+    if (STATE_INTERVAL < 0) STATE_INTERVAL = 0;
+    STATE_ENCODING    = env_encoding("STATE_ENCODING");
+    g_state.configure(STATE_COALESCE_MS, STATE_INTERVAL * 1000LL);
+    METRICS_PORT = env_int("METRICS_PORT", 0);
+    METRICS_BIND = env_str("METRICS_BIND", "127.0.0.1");
+    API_PORT     = env_int("API_PORT",     0);
+    API_BIND     = env_str("API_BIND",     "127.0.0.1");
+    g_state_on = STATE_SNAPSHOT || API_PORT > 0;
+    HISTORY             = env_int("HISTORY",             0);
+    HISTORY_COMMIT_SECS = env_int("HISTORY_COMMIT_SECS", 60);
+    if (HISTORY_COMMIT_SECS < 1) HISTORY_COMMIT_SECS = 1;
+    SPOOL_MAX_MB      = env_int("SPOOL_MAX_MB",      16);
+    if (SPOOL_MAX_MB < 0) SPOOL_MAX_MB = 0;
+    SPOOL_REPLAY_RATE = env_int("SPOOL_REPLAY_RATE", 500);
+    if (SPOOL_REPLAY_RATE < 1) SPOOL_REPLAY_RATE = 1;
+    BMW_MAKE_BEFORE_BREAK = env_int("BMW_MAKE_BEFORE_BREAK", 0);
+    BMW_TLS_RESUME        = env_int("BMW_TLS_RESUME", 1);
+    // several accounts: one thread for all connections by default
+    MQTT_REACTOR          = env_int("MQTT_REACTOR", ACCOUNTS.empty() ? 0 : 1);
+    if (SPLIT_TOPICS && SPLIT_CHANGE_ONLY) {
+        std::cerr << "[bridge] split topics: change-only, heartbeat "
+                  << SPLIT_HEARTBEAT << "s\n";
+    }
+
+    g_log.set_level(LogRing::parse_level(env_str("LOG_LEVEL", "info")));
+    g_log.parse_sampling(env_str("LOG_SAMPLE", ""));
+    g_log.start();
 
-    // fixed token files (no env overrides)
-    ID_TOKEN_FILE       = (std::filesystem::path(TDIR) / "id_token.txt").string();
-    REFRESH_TOKEN_FILE  = (std::filesystem::path(TDIR) / "refresh_token.txt").string();
     // Prefix-Fallback + normalization
     if (LOCAL_PREFIX.empty()) {
         LOCAL_PREFIX = "bmw/";             // Fallback: keeps bmw/status as default
@@ -561,6 +2263,17 @@ int main(){
     STATUS_STABLE_DELAY = env_int("STATUS_STABLE_DELAY", 5);
     if (STATUS_STABLE_DELAY < 0) STATUS_STABLE_DELAY = 0;
     if (STATUS_STABLE_DELAY > 3600) STATUS_STABLE_DELAY = 3600;
+    STATS_INTERVAL = env_int("STATS_INTERVAL", 60);
+    if (STATS_INTERVAL < 0) STATS_INTERVAL = 0;
+    E2E_LATENCY    = env_int("E2E_LATENCY", 0);
+    if (E2E_LATENCY) {
+        g_e2e.configure(E2E_OFFSET_WINDOWS);
+        if (STATS_INTERVAL)
+            std::cerr << "[bridge] end-to-end latency: " << LOCAL_PREFIX << "vehicles/<VIN>/latency every "
+                      << STATS_INTERVAL << " s\n";
+        else
+            std::cerr << "[bridge] E2E_LATENCY=1 has no effect with STATS_INTERVAL=0\n";
+    }
     std::cerr << "[bridge] status delay: " << STATUS_STABLE_DELAY << "s\n";
 
 
@@ -571,47 +2284,146 @@ int main(){
         return 1;
     }
 
-    // validate required IDs (no defaults; reject placeholders)
-    if (is_placeholder_uuid(CLIENT_ID)) {
-        std::cerr << "✖ CLIENT_ID missing or placeholder in " << ENV_PATH << "\n";
-        return 1;
-    }
-    if (is_placeholder_uuid(GCID)) {
-        std::cerr << "✖ GCID missing or placeholder in " << ENV_PATH << "\n";
-        return 1;
+    // accounts: fixed token files (no env overrides) in TDIR, or with
+    // ACCOUNTS=a,b in TDIR/accounts/<name>, each with its own .env
+    if (ACCOUNTS.empty()) {
+        // validate required IDs (no defaults; reject placeholders)
+        if (is_placeholder_uuid(CLIENT_ID)) {
+            std::cerr << "✖ CLIENT_ID missing or placeholder in " << ENV_PATH << "\n";
+            return 1;
+        }
+        if (is_placeholder_uuid(GCID)) {
+            std::cerr << "✖ GCID missing or placeholder in " << ENV_PATH << "\n";
+            return 1;
+        }
+        g_sessions.push_back(make_session("", TDIR, CLIENT_ID, GCID));
+    } else {
+        std::stringstream ss(ACCOUNTS);
+        std::string name;
+        while (std::getline(ss, name, ',')) {
+            name = trim_copy(name);
+            if (name.empty()) continue;
+            if (name.find_first_of("/+#") != std::string::npos || name == "." || name == "..") {
+                std::cerr << "✖ invalid account name '" << name << "', skipped\n";
+                continue;
+            }
+            const std::string dir = (std::filesystem::path(TDIR) / "accounts" / name).string();
+            const std::string env_path = (std::filesystem::path(dir) / ".env").string();
+            std::string cid, gcid;
+            for (auto& [k, v] : parse_env_file(env_path)) {
+                if (k == "CLIENT_ID") cid = v;
+                else if (k == "GCID") gcid = v;
+            }
+            if (is_placeholder_uuid(cid) || is_placeholder_uuid(gcid)) {
+                std::cerr << "✖ CLIENT_ID/GCID missing or placeholder in " << env_path
+                          << ", account '" << name << "' skipped\n";
+                continue;
+            }
+            bool dup = false;
+            for (auto& o : g_sessions) dup = dup || o->name == name;
+            if (dup) continue;
+            g_sessions.push_back(make_session(name, dir, cid, gcid));
+        }
+        if (g_sessions.empty()) {
+            std::cerr << "✖ no usable account in ACCOUNTS=" << ACCOUNTS << "\n"
+                      << "   Run scripts/bmw_flow.sh <account> first.\n";
+            return 1;
+        }
+        std::cerr << "[bridge] accounts: " << g_sessions.size() << "\n";
     }
 
-    // refresh logic constants
-    constexpr long CLOCK_SKEW_SECS   = 60;    // 1 min safety for clock drift
-
     std::ios::sync_with_stdio(false);
     std::cout.setf(std::ios::unitbuf); // auto-flush stdout
 
-    // initial tokens
-    g_id_token = trim(read_file(ID_TOKEN_FILE));
-    g_refresh_token = trim(read_file(REFRESH_TOKEN_FILE));
-    if(g_id_token.empty() || g_refresh_token.empty()){
-        std::cerr << "✖ id_token.txt or refresh_token.txt missing/empty in " << TDIR << "\n";
-        return 1;
+    // libs init (curl before the first refresh)
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+
+    // initial tokens; in multi-account mode a broken account is dropped
+    for (size_t i = 0; i < g_sessions.size();) {
+        if (session_load_tokens(*g_sessions[i])) { ++i; continue; }
+        if (ACCOUNTS.empty()) { std::cerr << "✖ exiting\n"; return 1; }
+        std::cerr << "✖ account '" << g_sessions[i]->name << "' skipped\n";
+        g_sessions.erase(g_sessions.begin() + static_cast<long>(i));
     }
-    g_id_token_exp = jwt_exp_unix(g_id_token);
-    if (g_id_token_exp.load() == 0) {
-        std::cerr << "✖ invalid id_token (no exp) → trying refresh\n";
-        if (!refresh_tokens()) {
-            std::cerr << "✖ cannot obtain valid token, exiting\n";
-            return 1;
+    if (g_sessions.empty()) return 1;
+
+    const std::string state_path = (std::filesystem::path(TDIR) / "state.json").string();
+    if (g_state_on) load_state(state_path);
+    if (STATE_SNAPSHOT) {
+        std::cerr << "[bridge] state snapshots: " << LOCAL_PREFIX << "vehicles/<VIN>/state (coalesce "
+                  << STATE_COALESCE_MS << " ms, interval " << STATE_INTERVAL << " s)\n";
+    }
+    if (HISTORY) {
+        const std::string history_dir = (std::filesystem::path(TDIR) / "history").string();
+        std::string err;
+        if (g_history.open(history_dir, err)) {
+            g_history.start(HISTORY_COMMIT_SECS * 1000LL);
+            std::cerr << "[bridge] history: " << history_dir << " (commit every " << HISTORY_COMMIT_SECS << " s)\n";
+        } else {
+            std::cerr << "[bridge] history disabled (" << history_dir << "): " << err << "\n";
+            HISTORY = 0;
         }
     }
 
-    // libs init
-    curl_global_init(CURL_GLOBAL_DEFAULT);
+    // spool for forwarded messages while the local broker is unreachable
+    if (SPOOL_MAX_MB > 0) {
+        const std::string spool_path = (std::filesystem::path(TDIR) / "spool.dat").string();
+        std::string err;
+        if (g_spool.open(spool_path, static_cast<size_t>(SPOOL_MAX_MB) * 1024 * 1024, err)) {
+            std::cerr << "[bridge] spool: " << spool_path << " (" << g_spool.capacity() / (1024 * 1024)
+                      << " MB, " << g_spool.records() << " message(s) pending)\n";
+            if (g_spool.resized_from())
+                std::cerr << "[bridge] spool resized from " << g_spool.resized_from() / (1024 * 1024)
+                          << " MB to SPOOL_MAX_MB=" << SPOOL_MAX_MB << ", " << g_spool.evicted()
+                          << " oldest message(s) dropped\n";
+        } else {
+            std::cerr << "[bridge] spool disabled, cannot open " << spool_path << ": " << err << "\n";
+        }
+    }
+
+    // main loop wait (opened before any callback can call wake())
+    {
+        std::string err;
+        if (!g_loop.open(err)) {
+            std::cerr << "[bridge] event loop unavailable (" << err << "), polling once per second\n";
+            if (MQTT_REACTOR) std::cerr << "[bridge] MQTT_REACTOR needs epoll, using loop threads\n";
+            MQTT_REACTOR = 0;
+        }
+    }
+    if (MQTT_REACTOR) {
+        // one thread: messages are forwarded inside the BMW read, no handoff
+        FWD_QUEUE_SIZE = 0;
+        std::cerr << "[bridge] MQTT reactor: all clients on the main thread, forwarding inline\n";
+        reactor_init();
+    }
+    // several BMW network threads (or old + new session) call on_bmw_message()
+    g_bmw_msg_lock = !MQTT_REACTOR && (BMW_MAKE_BEFORE_BREAK || g_sessions.size() > 1);
+
     mosquitto_lib_init();
 
     // local broker
     g_local = mosquitto_new("bmw-local-forwarder", true, nullptr);
     if(!g_local){ std::cerr << "mosquitto_new local failed\n"; return 2; }
 
+    if (LOCAL_MQTT5) {
+        mosquitto_int_option(g_local, MOSQ_OPT_PROTOCOL_VERSION, MQTT_PROTOCOL_V5);
+        std::cerr << "[bridge] local broker: MQTT v5, up to " << LOCAL_TOPIC_ALIASES << " topic aliases\n";
+    }
+    if (LOCAL_QOS) {
+        // in-flight window; libmosquitto queues the rest and resends unacknowledged
+        // messages after a reconnect (v5: capped by the broker's Receive Maximum).
+        // Both only work because QoS 1 publishes never use a topic alias
+        // (local_publish_v5).
+        if (LOCAL_MQTT5) mosquitto_int_option(g_local, MOSQ_OPT_SEND_MAXIMUM, LOCAL_INFLIGHT);
+        else mosquitto_max_inflight_messages_set(g_local, static_cast<unsigned>(LOCAL_INFLIGHT));
+        std::cerr << "[bridge] local broker: QoS 1, " << LOCAL_INFLIGHT << " in flight, queue "
+                  << LOCAL_QUEUE_MAX << " messages / " << LOCAL_QUEUE_MB << " MB\n";
+    }
     mosquitto_reconnect_delay_set(g_local, 1, 10, true);
+    mosquitto_connect_v5_callback_set(g_local, on_local_connect);
+    mosquitto_disconnect_callback_set(g_local, on_local_disconnect);
+    if (LOCAL_MQTT5) mosquitto_publish_v5_callback_set(g_local, on_local_publish_v5);
+    else mosquitto_publish_callback_set(g_local, on_local_publish);
     const char* lwt = "{\"connected\":false}";
     mosquitto_will_set(g_local, LOCAL_STATUS_TOPIC.c_str(), strlen(lwt), lwt, 0, true);
 
@@ -623,138 +2435,195 @@ int main(){
     if(mosquitto_connect(g_local, LOCAL_HOST.c_str(), LOCAL_PORT, 30) != MOSQ_ERR_SUCCESS){
         std::cerr << "connect local failed\n"; return 3;
     }
-    mosquitto_loop_start(g_local);
-    publish_status(false);
-
-    // BMW broker
-    g_bmw = create_bmw_client();
-    if(!g_bmw){ std::cerr << "mosquitto_new bmw failed\n"; return 4; }
-    mosquitto_loop_start(g_bmw);
-
-    // initial connect (respect backoff)
-    if (time(nullptr) >= g_next_connect_after.load()) {
-        int rc = mosquitto_connect_async(g_bmw, BMW_HOST.c_str(), BMW_PORT, 30);
-        if(rc != MOSQ_ERR_SUCCESS){
-            std::cerr << "connect BMW failed (host/port/TLS?) rc=" << rc << "\n";
-            // do not exit; watchdog will retry later
+    client_loop_start(g_local);
+    publish_status();
+
+    // optional OpenMetrics endpoint (plus the API when it shares the port)
+    static HttpServer metrics_server;
+    const bool api_shared = API_PORT > 0 && API_PORT == METRICS_PORT;
+    if (METRICS_PORT > 0) {
+        std::string err;
+        if (metrics_server.start(METRICS_BIND, METRICS_PORT, api_shared ? http_dispatch : metrics_http, err)) {
+            std::cerr << "[bridge] metrics on http://" << METRICS_BIND << ":" << METRICS_PORT << "/metrics\n";
+            if (api_shared)
+                std::cerr << "[bridge] state API on http://" << METRICS_BIND << ":" << METRICS_PORT << "/api/vehicles\n";
+        } else {
+            std::cerr << "[bridge] metrics endpoint failed (" << METRICS_BIND << ":" << METRICS_PORT
+                      << "): " << err << "\n";
         }
-    } else {
-        std::cerr << "[bridge] initial connect delayed due to backoff\n";
     }
 
-    std::cout << "[bridge] running… (Ctrl+C / SIGTERM to stop)\n";
-
-    // === Token refresh + CONNECT watchdog + backoff ===
-    const long CONNECT_TIMEOUT = 30; // seconds until we assume "CONNECT hung"
-    long last_refresh_attempt = 0;
-    long last_successful_refresh = time(nullptr);
-    constexpr long SOFT_MARGIN_SECS = 10*60;   // refresh 10 min before exp
-    constexpr long HARD_REFRESH_SECS = 45*60;  // refresh at least every 45 min
-
-    auto needs_soft_refresh = [&](long now){
-        return (g_id_token_exp.load() - now) <= (SOFT_MARGIN_SECS + CLOCK_SKEW_SECS);
-    };
-
-    auto needs_hard_refresh = [&](long now){
-            return (now - last_successful_refresh) >= HARD_REFRESH_SECS;
-    };
-
-    while(!g_stop){
-        std::this_thread::sleep_for(std::chrono::seconds(1));
-        long now = time(nullptr);
-
-        // 0) Backoff window active? → do not trigger new actions
-        if (now < g_next_connect_after.load()) continue;
-
-        bool due_soft = needs_soft_refresh(now);
-        bool due_hard = needs_hard_refresh(now);
-        bool should_try = (due_soft || due_hard) && (now - last_refresh_attempt > 10);
+    // optional state API (long-poll requests hold a connection each)
+    static HttpServer api_server(32);
+    if (API_PORT > 0 && !api_shared) {
+        std::string err;
+        if (api_server.start(API_BIND, API_PORT, api_http, err)) {
+            std::cerr << "[bridge] state API on http://" << API_BIND << ":" << API_PORT << "/api/vehicles\n";
+        } else {
+            std::cerr << "[bridge] state API failed (" << API_BIND << ":" << API_PORT << "): " << err << "\n";
+        }
+    }
 
-        if (should_try){
-            // small jitter to avoid sync with other processes
-            std::this_thread::sleep_for(std::chrono::milliseconds(100 + (rng() % 200)));
+    // forwarder thread (BMW network thread only copies into the handoff queue)
+    if (FWD_QUEUE_SIZE > 0) {
+        g_fwd_queue.reset(new SpscQueue<ForwardItem>(static_cast<size_t>(FWD_QUEUE_SIZE)));
+        g_fwd_thread = std::thread(forwarder_run);
+        std::cerr << "[bridge] forward queue: " << g_fwd_queue->capacity() << " slots\n";
+    }
 
-            std::cout << "[bridge] token refresh (" << (due_soft ? "soft" : "hard") << ")\n";
+    // BMW TLS context, built once and shared by every client rebuild
+    if (BMW_TLS_RESUME) {
+        const auto t0 = std::chrono::steady_clock::now();
+        std::string err;
+        if (g_bmw_tls.init(BMW_CA_FILE, BMW_HOST, err)) {
+            g_bmw_tls.set_handshake_hook([](double secs, bool resumed){
+                g_metrics.tls_handshakes.inc();
+                if (resumed) g_metrics.tls_resumed.inc();
+                g_metrics.tls_handshake_seconds.observe(secs);
+                g_log.write(LogLevel::Info, LogCat::Bridge, "[bridge] BMW TLS handshake %.0f ms (%s)",
+                            secs * 1000, resumed ? "resumed" : "full");
+            });
+            std::cerr << "[bridge] TLS: CA store loaded once in "
+                      << std::chrono::duration_cast<std::chrono::milliseconds>(
+                             std::chrono::steady_clock::now() - t0).count()
+                      << " ms, session resumption enabled\n";
+        } else {
+            std::cerr << "[bridge] TLS: shared context failed (" << err << "), using mosquitto_tls_set\n";
+        }
+    }
 
-            if (refresh_tokens()){
-                last_refresh_attempt    = now;
-                last_successful_refresh = now;
+    // BMW broker, one client per account
+    for (auto& sp : g_sessions) {
+        if (!session_start(*sp)) { std::cerr << "mosquitto_new bmw failed\n"; return 4; }
+    }
 
-                int upw_rc = mosquitto_username_pw_set(g_bmw, GCID.c_str(), g_id_token.c_str());
-                if (upw_rc != MOSQ_ERR_SUCCESS) {
-                    std::cerr << "[bridge] username_pw_set rc=" << upw_rc << "\n";
-                }
+    g_refresh.start();
 
-                g_connected = false;
-                publish_status(false);
+    std::cout << "[bridge] running… (Ctrl+C / SIGTERM to stop)\n";
 
-                // leichtes Backoff + Jitter wie beim Script-Flow
-                long delay_ms = 1500 + (rng()%500);
-                g_next_connect_after = time(nullptr) + 1; // 1s Sperre, nur zur Sicherheit
-                std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+    // === Token refresh + CONNECT watchdog + backoff (per session, see session_tick) ===
+    // Event driven: each pass collects the earliest deadline in wake_at and the
+    // loop sleeps exactly until then, or until a callback/the refresh worker
+    // calls g_loop.wake().
+    constexpr long long SPLIT_STATS_MS    = 10*60*1000LL; // change-only summary interval
+    constexpr long long IDLE_WAKE_MS      = 60*1000;      // longest sleep (queue overflow report)
+    constexpr long long ACK_MAX_AGE_US    = 5*60*1000000LL; // unacknowledged after this: lost
+    const long long     stats_ms = (STATS_INTERVAL ? STATS_INTERVAL : 60) * 1000LL;
+    constexpr long long STATE_SAVE_MS     = 10*60*1000LL; // state.json rewrite interval (if changed)
+
+    long long next_spool_replay = 0;
+    unsigned long long reported_fwd_overflow = 0;
+    long long last_split_stats = mono_ms();
+    long long last_stats = mono_ms();
+    long long last_state_save = mono_ms();
+    unsigned long long saved_merged = 0;
+
+    long long wake_at = 0;   // first pass runs at once
+    while(!g_stop){
+        if (MQTT_REACTOR) wake_at = std::min(wake_at, reactor_arm(mono_ms()));
+        const unsigned what = g_loop.wait_until(wake_at);
+        if (g_stop) break;
+        g_metrics.loop_wakeups.inc();
+
+        const long long now = mono_ms();
+        if (MQTT_REACTOR) {
+            reactor_dispatch(now);
+            // only socket traffic, nothing due: skip the housekeeping below
+            // (callbacks that changed state have called wake())
+            if (what == EventLoop::IO && now < wake_at) continue;
+        }
+        wake_at = now + IDLE_WAKE_MS;
+        auto wake_by = [&](long long t){ if (t < wake_at) wake_at = t; };
 
-                // kompletter Rebuild → verhindert TLS/State-Races
-                bmw_full_reconnect();
-            } else {
-                last_refresh_attempt = now;
-                g_next_connect_after = now + 15;
-                std::cerr << "[bridge] refresh failed, retry soon\n";
+        // spool replay: SPOOL_REPLAY_RATE per second (plus new appends) while anything is left
+        if (now >= next_spool_replay) {
+            replay_spool();
+            next_spool_replay = now + 1000;
+        }
+        if (g_spool.is_open() && !g_spool.empty() && g_local_connected.load()) wake_by(next_spool_replay);
+
+        // status debounce runs independent of the backoff windows
+        publish_status();
+        if (long long due = status_deadline()) wake_by(due);
+
+        // ACK latency: stats topic; forget messages that were never acknowledged
+        if ((now - last_stats) >= stats_ms) {
+            last_stats = now;
+            g_ack_latency.prune(ACK_MAX_AGE_US);
+            if (STATS_INTERVAL && g_local_connected.load()) {
+                publish_stats();
+                if (E2E_LATENCY) publish_e2e();
             }
         }
+        wake_by(last_stats + stats_ms);
+        if (g_dump_stats.exchange(false))
+            std::cerr << "[bridge] local ACK latency since start (us):\n" << g_ack_latency.dump();
 
-        // CONNECT watchdog: CONNECT sent but no CONNACK in time
-        long last_attempt = g_last_connect_attempt.load();
-        bool connect_hung = (last_attempt != 0) && ((now - last_attempt) > CONNECT_TIMEOUT);
-        if (connect_hung) {
-            if (now < g_next_connect_after.load()) continue;
-
-            std::cerr << "[bridge] CONNECT timed out or handshake failed -> full mosquitto client rebuild\n";
-            g_connected = false;
-            publish_status(false);
-
-            if (g_bmw) {
-                mosquitto_loop_stop(g_bmw, true);
-                mosquitto_destroy(g_bmw);
-                g_bmw = nullptr;
+        if (STATE_SNAPSHOT) {
+            publish_state(now);
+            if (long long due = g_state.due()) wake_by(due);
+        }
+        if (g_state_on) {
+            if ((now - last_state_save) >= STATE_SAVE_MS) {
+                last_state_save = now;
+                if (g_state.merged() != saved_merged) {
+                    saved_merged = g_state.merged();
+                    save_state(state_path);
+                }
             }
+            wake_by(last_state_save + STATE_SAVE_MS);
+        }
 
-            g_bmw = create_bmw_client();
-            if(!g_bmw){
-                std::cerr << "[bridge] rebuild failed (mosquitto_new)\n";
-                std::this_thread::sleep_for(std::chrono::seconds(2));
-                continue;
+        if (SPLIT_CHANGE_ONLY) {
+            if ((now - last_split_stats) >= SPLIT_STATS_MS) {
+                last_split_stats = now;
+                std::cerr << "[bridge] split change-only: published=" << g_split_published.load()
+                          << " suppressed=" << g_split_suppressed.load() << "\n";
             }
-            mosquitto_loop_start(g_bmw);
+            wake_by(last_split_stats + SPLIT_STATS_MS);
+        }
 
-            if (time(nullptr) >= g_next_connect_after.load()) {
-                int rc = mosquitto_connect_async(g_bmw, BMW_HOST.c_str(), BMW_PORT, 30);
-                std::cerr << "[bridge] rebuild+connect rc=" << rc << "\n";
-                g_last_connect_attempt = time(nullptr);
-            } else {
-                std::cerr << "[bridge] rebuild done, connect delayed due to backoff\n";
-            }
+        if (g_fwd_queue && g_fwd_queue->overflow() != reported_fwd_overflow) {
+            reported_fwd_overflow = g_fwd_queue->overflow();
+            std::cerr << "[bridge] forward queue overflow: dropped=" << reported_fwd_overflow
+                      << " depth=" << g_fwd_queue->depth()
+                      << " high_water=" << g_fwd_queue->high_water()
+                      << "/" << g_fwd_queue->capacity() << "\n";
         }
 
-        publish_status(g_connected.load());
+        for (auto& sp : g_sessions) session_tick(*sp, now, wake_at);
     }
 
-    // Cleanup
-    if (g_bmw) {
-        mosquitto_loop_stop(g_bmw, true);
-        mosquitto_disconnect(g_bmw);
-        mosquitto_destroy(g_bmw);
+    // Cleanup (g_loop stays open until every thread that wakes it is gone)
+    for (auto& sp : g_sessions) session_stop(*sp);
+    if (g_fwd_thread.joinable()) {
+        g_fwd_stop = true;
+        g_fwd_queue->wake();
+        g_fwd_thread.join();    // forwards what is still queued
     }
+    if (STATE_SNAPSHOT) publish_state(std::numeric_limits<long long>::max());   // pending changes go out now
+    if (g_state_on) save_state(state_path);
+    g_history.stop();   // final group commit
+    g_refresh.stop();
+    metrics_server.stop();
+    api_server.stop();
+    if (g_local && LOCAL_QOS) flush_outbound(LOCAL_FLUSH_MS);
     if (g_local) {
         mosquitto_loop_stop(g_local, true);
         mosquitto_disconnect(g_local);
         mosquitto_destroy(g_local);
     }
+    g_spool.close();
     mosquitto_lib_cleanup();
     curl_global_cleanup();
+    g_loop.close();
+    g_log.stop();
     std::cout << "[bridge] bye\n";
     return 0;
 }
 
+#endif // BMW_BRIDGE_NO_MAIN
+
 
 // ============= refresh tokens =============
 
@@ -774,28 +2643,6 @@ static bool write_file_mode(const std::string& path, const std::string& data, mo
     return true;
 }
 
-// form-urlencode for a key/value with libcurl (uses its own CURL easy handle)
-static std::string urlencode_component(const std::string& s){
-    CURL* h = curl_easy_init();
-    if(!h) return s; // worst case: unencoded
-    char* esc = curl_easy_escape(h, s.c_str(), (int)s.size());
-    std::string out = esc ? esc : "";
-    if (esc) curl_free(esc);
-    curl_easy_cleanup(h);
-    return out;
-}
-
-static std::string build_form_body(const std::vector<std::pair<std::string,std::string>>& kv){
-    std::ostringstream oss;
-    bool first = true;
-    for (auto& [k,v] : kv){
-        if(!first) oss << "&";
-        first = false;
-        oss << urlencode_component(k) << "=" << urlencode_component(v);
-    }
-    return oss.str();
-}
-
 static bool write_file_atomic(const std::string& final_path,
                               const std::string& data,
                               mode_t mode = 0644)
@@ -868,68 +2715,51 @@ static bool write_file_atomic(const std::string& final_path,
     return true;
 }
 
-static bool refresh_tokens() {
+// HTTP refresh + atomic write of the token files (refresh worker thread).
+// Does not touch the in-memory tokens; see apply_tokens().
+static std::unique_ptr<TokenSet> fetch_tokens(CurlSession& http, const BmwSession& s) {
 
-    std::cout << "[bridge] refresh started\n";
+    std::cout << s.tag << " refresh started\n";
 
     // load current refresh token (as in the script)
-    std::string cur_refresh = trim(read_file(REFRESH_TOKEN_FILE));
+    std::string cur_refresh = trim(read_file(s.refresh_token_file));
     if (cur_refresh.empty()) {
-        std::cerr << "[bridge] refresh: refresh_token.txt missing/empty\n";
-        return false;
+        std::cerr << s.tag << " refresh: refresh_token.txt missing/empty\n";
+        return nullptr;
+    }
+    if (!http.ok()) {
+        std::cerr << "[bridge] curl_easy_init failed\n";
+        return nullptr;
     }
 
     // form body
     const std::string url = "https://customer.bmwgroup.com/gcdm/oauth/token";
-    const std::string body = build_form_body({
+    const std::string body = http.form_body({
         {"grant_type",   "refresh_token"},
         {"refresh_token",cur_refresh},
-        {"client_id",    CLIENT_ID}
+        {"client_id",    s.client_id}
     });
 
-    // HTTP Request via libcurl
+    // HTTP Request via the persistent curl session
     std::string resp;
     long http_code = 0;
+    CurlSession::Timing tm;
 
-    CURL* c = curl_easy_init();
-    if(!c){
-        std::cerr << "[bridge] curl_easy_init failed\n";
-        return false;
-    }
-
-    struct curl_slist* hdrs = nullptr;
-    hdrs = curl_slist_append(hdrs, "Content-Type: application/x-www-form-urlencoded");
-
-    curl_easy_setopt(c, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(c, CURLOPT_HTTPHEADER, hdrs);
-    curl_easy_setopt(c, CURLOPT_POST, 1L);
-    curl_easy_setopt(c, CURLOPT_POSTFIELDS, body.c_str());
-    curl_easy_setopt(c, CURLOPT_POSTFIELDSIZE, (long)body.size());
-
-    // Timeout/SSL
-    curl_easy_setopt(c, CURLOPT_TIMEOUT, 20L);
-    curl_easy_setopt(c, CURLOPT_CONNECTTIMEOUT, 10L);
-    curl_easy_setopt(c, CURLOPT_FOLLOWLOCATION, 0L);
-    curl_easy_setopt(c, CURLOPT_NOSIGNAL, 1L); // threadsafe timeouts
-    curl_easy_setopt(c, CURLOPT_WRITEFUNCTION, curl_write_cb);
-    curl_easy_setopt(c, CURLOPT_WRITEDATA, &resp);
-    curl_easy_setopt(c, CURLOPT_USERAGENT, "bmw-mqtt-bridge/1.0");
-
-    CURLcode rc = curl_easy_perform(c);
+    CURLcode rc = http.post_form(url, body, resp, http_code, &tm);
     if (rc != CURLE_OK) {
         std::cerr << "[bridge] curl perform failed: " << curl_easy_strerror(rc) << "\n";
-        curl_slist_free_all(hdrs);
-        curl_easy_cleanup(c);
-        return false;
+        return nullptr;
     }
-    curl_easy_getinfo(c, CURLINFO_RESPONSE_CODE, &http_code);
-
-    curl_slist_free_all(hdrs);
-    curl_easy_cleanup(c);
+    if (tm.reused) g_metrics.refresh_reused.inc();
+    std::cout << s.tag << " refresh HTTP " << http_code << " in " << static_cast<long>(tm.total * 1000) << " ms ("
+              << (tm.reused ? std::string("connection reused")
+                            : "connect " + std::to_string(static_cast<long>(tm.connect * 1000)) +
+                              " ms, tls " + std::to_string(static_cast<long>(tm.tls * 1000)) + " ms")
+              << ")\n";
 
     // determine target paths based on configured files
-    std::string id_path  = ID_TOKEN_FILE;
-    std::string rt_path  = REFRESH_TOKEN_FILE;
+    std::string id_path  = s.id_token_file;
+    std::string rt_path  = s.refresh_token_file;
     std::string dir      = dirname_of(id_path);
     std::string at_path  = (std::filesystem::path(dir) / "access_token.txt").string();
 
@@ -945,18 +2775,18 @@ static bool refresh_tokens() {
 
     if (http_code != 200) {
         std::cerr << "✖ Refresh HTTP " << http_code << ":\n" << resp << "\n";
-        return false;
+        return nullptr;
     }
 
     // parse JSON & check error
     json j = json::parse(resp, nullptr, false);
     if (j.is_discarded()) {
         std::cerr << "✖ Refresh: invalid JSON\n";
-        return false;
+        return nullptr;
     }
     if (j.contains("error") && !j["error"].is_null()) {
         std::cerr << "✖ Refresh failed:\n" << j.dump(2) << "\n";
-        return false;
+        return nullptr;
     }
 
     // extract tokens
@@ -971,7 +2801,7 @@ static bool refresh_tokens() {
 
     if (new_id.empty() || new_rt.empty() || new_acc.empty()) {
         std::cerr << "✖ Refresh: missing data in response\n";
-        return false;
+        return nullptr;
     }
 
     // --- Atomar direkt ins Zielverzeichnis schreiben (kein /tmp mehr) ---
@@ -981,20 +2811,27 @@ static bool refresh_tokens() {
     ok &= write_file_atomic(at_path, new_acc, 0644);
 
     if (!ok) {
-        std::cerr << "[bridge] writing tokens atomically failed\n";
-        return false;
+        std::cerr << s.tag << " writing tokens atomically failed\n";
+        return nullptr;
     }
 
-    // update in-memory
-    g_id_token      = new_id;
-    g_refresh_token = new_rt;
-    g_id_token_exp  = jwt_exp_unix(g_id_token);
+    auto t = std::make_unique<TokenSet>();
+    t->id_token      = new_id;
+    t->refresh_token = new_rt;
+    t->exp           = jwt_exp_unix(new_id);
 
-    std::cout << "✔ New Tokens saved:\n"
+    std::cout << "✔ New Tokens saved" << (s.name.empty() ? std::string() : " for account " + s.name) << ":\n"
               << "   id_token.txt, refresh_token.txt, access_token.txt\n";
-    std::cout << "[bridge] token refreshed via HTTP, exp=" << g_id_token_exp
-              << " (in " << (g_id_token_exp.load() - time(nullptr)) << "s)\n";
+    return t;
+}
 
-    return true;
+// take over refreshed tokens (main thread)
+static void apply_tokens(BmwSession& s, const TokenSet& t) {
+    s.id_token      = t.id_token;
+    s.refresh_token = t.refresh_token;
+    s.id_token_exp  = t.exp;
+
+    std::cout << s.tag << " token refreshed via HTTP, exp=" << s.id_token_exp
+              << " (in " << (s.id_token_exp.load() - time(nullptr)) << "s)\n";
 }
 
@@ -0,0 +1,157 @@
+// curl_session.hpp
+//
+// Persistent libcurl handle for the token refresh.
+//
+// One easy handle lives for the whole run instead of one per request (and one
+// per URL-encoded form field). It is attached to a share handle that keeps the
+// DNS cache, TLS session cache and connection cache, so a refresh can reuse
+// the connection to the token endpoint, or at least resume the TLS session,
+// instead of doing a full DNS + TCP + TLS handshake every time.
+//
+// A session is used by one thread at a time (startup, then the refresh
+// worker); the share locks make handing it between threads safe.
+//
+// Copyright (c) 2025 Kurt, DJ0ABR – MIT License (see bmw_mqtt_bridge.cpp)
+
+#pragma once
+
+#include <curl/curl.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+class CurlSession {
+public:
+    struct Timing {
+        double connect = 0;     // seconds until TCP connected (0 if reused)
+        double tls = 0;         // seconds until TLS done (0 if reused)
+        double total = 0;
+        bool   reused = false;  // no new connection was needed
+    };
+
+    CurlSession(){
+        share_ = curl_share_init();
+        if (share_) {
+            curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, &CurlSession::lock_cb);
+            curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, &CurlSession::unlock_cb);
+            curl_share_setopt(share_, CURLSHOPT_USERDATA, this);
+            curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+            curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+            curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+        }
+        easy_ = curl_easy_init();
+        hdrs_ = curl_slist_append(nullptr, "Content-Type: application/x-www-form-urlencoded");
+    }
+
+    ~CurlSession(){
+        if (easy_) curl_easy_cleanup(easy_);
+        if (share_) curl_share_cleanup(share_);
+        if (hdrs_) curl_slist_free_all(hdrs_);
+    }
+
+    CurlSession(const CurlSession&) = delete;
+    CurlSession& operator=(const CurlSession&) = delete;
+
+    bool ok() const { return easy_ != nullptr; }
+
+    // a running request is aborted once *flag becomes true (shutdown)
+    void set_abort_flag(const std::atomic<bool>* flag){ abort_ = flag; }
+
+    // application/x-www-form-urlencoded body, encoded with the session's handle
+    std::string form_body(const std::vector<std::pair<std::string, std::string>>& kv){
+        std::string out;
+        for (auto& [k, v] : kv) {
+            if (!out.empty()) out += '&';
+            append_escaped(out, k);
+            out += '=';
+            append_escaped(out, v);
+        }
+        return out;
+    }
+
+    // POST a form body; resp/http_code are filled on CURLE_OK
+    CURLcode post_form(const std::string& url, const std::string& body,
+                       std::string& resp, long& http_code, Timing* timing = nullptr){
+        if (!easy_) return CURLE_FAILED_INIT;
+        resp.clear();
+        http_code = 0;
+
+        // reset per-request options; the share (DNS/TLS/connections) survives
+        curl_easy_reset(easy_);
+        if (share_) curl_easy_setopt(easy_, CURLOPT_SHARE, share_);
+        curl_easy_setopt(easy_, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(easy_, CURLOPT_HTTPHEADER, hdrs_);
+        curl_easy_setopt(easy_, CURLOPT_POST, 1L);
+        curl_easy_setopt(easy_, CURLOPT_POSTFIELDS, body.c_str());
+        curl_easy_setopt(easy_, CURLOPT_POSTFIELDSIZE, static_cast<long>(body.size()));
+
+        // Timeout/SSL
+        curl_easy_setopt(easy_, CURLOPT_TIMEOUT, 20L);
+        curl_easy_setopt(easy_, CURLOPT_CONNECTTIMEOUT, 10L);
+        curl_easy_setopt(easy_, CURLOPT_FOLLOWLOCATION, 0L);
+        curl_easy_setopt(easy_, CURLOPT_NOSIGNAL, 1L); // threadsafe timeouts
+        curl_easy_setopt(easy_, CURLOPT_WRITEFUNCTION, &CurlSession::write_cb);
+        curl_easy_setopt(easy_, CURLOPT_WRITEDATA, &resp);
+        curl_easy_setopt(easy_, CURLOPT_USERAGENT, "bmw-mqtt-bridge/1.0");
+
+        // refreshes are ~45 min apart: keep DNS and idle connections long
+        // enough to be useful (the server may still close the connection;
+        // then the cached TLS session shortens the new handshake)
+        curl_easy_setopt(easy_, CURLOPT_DNS_CACHE_TIMEOUT, 3600L);
+        curl_easy_setopt(easy_, CURLOPT_MAXAGE_CONN, 3600L);
+        curl_easy_setopt(easy_, CURLOPT_TCP_KEEPALIVE, 1L);
+
+        if (abort_) {
+            curl_easy_setopt(easy_, CURLOPT_NOPROGRESS, 0L);
+            curl_easy_setopt(easy_, CURLOPT_XFERINFOFUNCTION, &CurlSession::progress_cb);
+            curl_easy_setopt(easy_, CURLOPT_XFERINFODATA, this);
+        }
+
+        CURLcode rc = curl_easy_perform(easy_);
+        if (rc == CURLE_OK) curl_easy_getinfo(easy_, CURLINFO_RESPONSE_CODE, &http_code);
+        if (timing) {
+            long connects = 0;
+            curl_easy_getinfo(easy_, CURLINFO_NUM_CONNECTS, &connects);
+            curl_easy_getinfo(easy_, CURLINFO_CONNECT_TIME, &timing->connect);
+            curl_easy_getinfo(easy_, CURLINFO_APPCONNECT_TIME, &timing->tls);
+            curl_easy_getinfo(easy_, CURLINFO_TOTAL_TIME, &timing->total);
+            timing->reused = (rc == CURLE_OK && connects == 0);
+        }
+        return rc;
+    }
+
+private:
+    void append_escaped(std::string& out, const std::string& s){
+        char* esc = easy_ ? curl_easy_escape(easy_, s.c_str(), static_cast<int>(s.size())) : nullptr;
+        if (!esc) { out += s; return; } // worst case: unencoded
+        out += esc;
+        curl_free(esc);
+    }
+
+    static size_t write_cb(void* ptr, size_t size, size_t nmemb, void* userdata){
+        static_cast<std::string*>(userdata)->append(static_cast<const char*>(ptr), size * nmemb);
+        return size * nmemb;
+    }
+
+    static int progress_cb(void* self, curl_off_t, curl_off_t, curl_off_t, curl_off_t){
+        const std::atomic<bool>* f = static_cast<CurlSession*>(self)->abort_;
+        return (f && f->load()) ? 1 : 0;
+    }
+
+    static void lock_cb(CURL*, curl_lock_data data, curl_lock_access, void* self){
+        static_cast<CurlSession*>(self)->locks_[static_cast<size_t>(data) % LOCKS].lock();
+    }
+    static void unlock_cb(CURL*, curl_lock_data data, void* self){
+        static_cast<CurlSession*>(self)->locks_[static_cast<size_t>(data) % LOCKS].unlock();
+    }
+
+    static constexpr size_t LOCKS = 8;   // one per curl_lock_data value
+    CURL*   easy_ = nullptr;
+    CURLSH* share_ = nullptr;
+    curl_slist* hdrs_ = nullptr;
+    const std::atomic<bool>* abort_ = nullptr;
+    std::mutex locks_[LOCKS];
+};
@@ -0,0 +1,155 @@
+// e2e_latency.hpp
+//
+// End-to-end latency per vehicle: car → BMW → bridge, and bridge receive →
+// local publish.
+//
+// Every CarData property carries the time the car measured it ("timestamp").
+// For each message the bridge hands in those times, its own receive time
+// (wall clock) and how long forwarding took:
+//
+//   signal_ms    receive time − the signal's timestamp (each signal)
+//   message_ms   receive time − the newest timestamp in the message
+//   pipeline_us  receive → all local publishes done (queue wait included)
+//
+// Clock skew: the car's clock is not ours. Per VIN the smallest
+// receive − timestamp seen over the last `windows` report windows is taken as
+// the clock offset (car clock behind ours plus the fastest transport the
+// data ever had); signal_ms and message_ms are recorded relative to it, so
+// they show the delay on top of the best case. The raw offset is reported as
+// well – a large or drifting one points at the car's clock, not at BMW.
+//
+// Percentiles are rolling: report() hands out one window per VIN (only VINs
+// with samples) and starts the next.
+//
+// Notes:
+//   - Thread-safe: record() runs on the forwarding thread, report() on the
+//     main loop; one mutex, taken once per message.
+//   - Timestamps in the future (car clock ahead) count as "ahead" and lower
+//     the offset; with the offset applied they are not negative.
+//
+// Copyright (c) 2025 Kurt, DJ0ABR – MIT License (see bmw_mqtt_bridge.cpp)
+
+#pragma once
+
+#include "latency_hist.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class EndToEndLatency {
+public:
+    void configure(size_t windows){
+        std::lock_guard<std::mutex> lk(mu_);
+        windows_ = windows ? windows : 1;
+    }
+
+    // one forwarded message: signal timestamps (unix ms, 0 = none), receive
+    // time (unix ms) and forwarding time
+    void record(std::string_view vin, const std::vector<int64_t>& signal_ms, int64_t received_ms,
+                int64_t pipeline_us){
+        std::lock_guard<std::mutex> lk(mu_);
+        auto it = vehicles_.find(vin);
+        if (it == vehicles_.end()) it = vehicles_.emplace(std::string(vin), Vehicle{}).first;
+        Vehicle& v = it->second;
+
+        v.pipeline_us.record(pipeline_us > 0 ? static_cast<uint64_t>(pipeline_us) : 0);
+        ++v.messages;
+
+        int64_t newest = 0;
+        for (int64_t t : signal_ms) {
+            if (t <= 0) continue;
+            const int64_t raw = received_ms - t;
+            if (raw < 0) ++v.ahead;
+            v.window_min = std::min(v.window_min, raw);
+            v.signal_ms.record(relative(v, raw));
+            newest = std::max(newest, t);
+        }
+        if (newest) v.message_ms.record(relative(v, received_ms - newest));
+    }
+
+    // publish(vin, json) for every VIN with samples in the window, then start
+    // a new window:
+    // {"timestamp":..,"messages":..,"clock_offset_ms":..,"ahead":..,
+    //  "signal_ms":{..},"message_ms":{..},"pipeline_us":{..}}
+    // with {"count","mean","p50","p90","p99","max"} each
+    size_t report(long now_unix, const std::function<void(const std::string&, const std::string&)>& publish){
+        std::vector<std::pair<std::string, std::string>> out;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            for (auto& [vin, v] : vehicles_) {
+                if (v.window_min != NONE) {
+                    v.mins.push_back(v.window_min);
+                    while (v.mins.size() > windows_) v.mins.pop_front();
+                }
+                v.window_min = NONE;
+                if (!v.messages) continue;
+
+                std::string s = "{\"timestamp\":" + std::to_string(now_unix)
+                              + ",\"messages\":" + std::to_string(v.messages);
+                const int64_t off = offset(v);
+                if (off != NONE) s += ",\"clock_offset_ms\":" + std::to_string(off);
+                s += ",\"ahead\":" + std::to_string(v.ahead);
+                s += ",\"signal_ms\":";   append_stats(s, v.signal_ms);
+                s += ",\"message_ms\":";  append_stats(s, v.message_ms);
+                s += ",\"pipeline_us\":"; append_stats(s, v.pipeline_us);
+                s += '}';
+                out.emplace_back(vin, std::move(s));
+
+                v.signal_ms.reset();
+                v.message_ms.reset();
+                v.pipeline_us.reset();
+                v.messages = v.ahead = 0;
+            }
+        }
+        for (auto& [vin, body] : out) publish(vin, body);
+        return out.size();
+    }
+
+    size_t vehicles() const { std::lock_guard<std::mutex> lk(mu_); return vehicles_.size(); }
+
+private:
+    static constexpr int64_t NONE = std::numeric_limits<int64_t>::max();
+
+    struct Vehicle {
+        HdrHistogram signal_ms, message_ms, pipeline_us;   // current window
+        uint64_t messages = 0, ahead = 0;
+        int64_t  window_min = NONE;                        // min receive − timestamp, this window
+        std::deque<int64_t> mins;                          // ... of the previous windows
+    };
+
+    // smallest receive − timestamp over the kept windows (NONE = no samples)
+    static int64_t offset(const Vehicle& v){
+        int64_t m = v.window_min;
+        for (int64_t x : v.mins) m = std::min(m, x);
+        return m;
+    }
+
+    // delay on top of the clock offset (window_min already includes raw)
+    static uint64_t relative(const Vehicle& v, int64_t raw){
+        const int64_t d = raw - offset(v);
+        return d > 0 ? static_cast<uint64_t>(d) : 0;
+    }
+
+    static void append_stats(std::string& s, const HdrHistogram& h){
+        char buf[160];
+        std::snprintf(buf, sizeof(buf),
+                      "{\"count\":%llu,\"mean\":%.0f,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"max\":%llu}",
+                      (unsigned long long)h.count(), h.mean(),
+                      (unsigned long long)h.value_at(50), (unsigned long long)h.value_at(90),
+                      (unsigned long long)h.value_at(99), (unsigned long long)h.max());
+        s += buf;
+    }
+
+    mutable std::mutex mu_;
+    std::map<std::string, Vehicle, std::less<>> vehicles_;
+    size_t windows_ = 10;
+};
@@ -0,0 +1,173 @@
+// event_loop.hpp
+//
+// Deadline wait for the bridge's main loop (epoll + timerfd + eventfd).
+//
+// The main loop computes the earliest of its deadlines (token refresh,
+// CONNECT watchdog, backoff end, status debounce, ...) and sleeps in
+// wait_until() until exactly that monotonic time. Other threads (mosquitto
+// callbacks, the refresh worker) and signal handlers call wake() when they
+// changed state the loop has to look at, e.g. a disconnect.
+//
+//   - deadlines are CLOCK_MONOTONIC milliseconds, the same clock as
+//     std::chrono::steady_clock on Linux (see now_ms())
+//   - wake() is a single eventfd write: async-signal-safe, wakes coalesce.
+//     close() only after every thread that may wake() has been joined; a
+//     wake() racing with close() could write into a file that reused the fd
+//   - without epoll/timerfd/eventfd (open() failed) wait_until() falls back
+//     to sleeping at most one second, i.e. the old polling behaviour
+//   - sockets can be added with watch(); after a wait, events(fd) tells what
+//     they are ready for (MQTT_REACTOR drives the mosquitto clients this way)
+//
+// Copyright (c) 2025 Kurt, DJ0ABR – MIT License (see bmw_mqtt_bridge.cpp)
+
+#pragma once
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <thread>
+
+class EventLoop {
+public:
+    // bits returned by wait_until()
+    static constexpr unsigned TIMER = 1;   // deadline reached
+    static constexpr unsigned WOKEN = 2;   // wake() was called
+    static constexpr unsigned IO    = 4;   // a watched fd is ready, see events()
+
+    EventLoop() = default;
+    ~EventLoop(){ close(); }
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    bool open(std::string& err){
+        close();
+        ep_    = ::epoll_create1(EPOLL_CLOEXEC);
+        timer_ = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        wake_  = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (ep_ < 0 || timer_ < 0 || wake_.load() < 0) {
+            err = std::strerror(errno);
+            close();
+            return false;
+        }
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = timer_;
+        if (::epoll_ctl(ep_, EPOLL_CTL_ADD, timer_, &ev) != 0) { err = std::strerror(errno); close(); return false; }
+        ev.data.fd = wake_.load();
+        if (::epoll_ctl(ep_, EPOLL_CTL_ADD, wake_.load(), &ev) != 0) { err = std::strerror(errno); close(); return false; }
+        return true;
+    }
+
+    void close(){
+        const int w = wake_.exchange(-1);   // later wake() calls are no-ops
+        if (ep_ >= 0)    ::close(ep_);
+        if (timer_ >= 0) ::close(timer_);
+        if (w >= 0)      ::close(w);
+        ep_ = timer_ = -1;
+    }
+
+    bool is_open() const { return ep_ >= 0; }
+
+    // Add fd or change its interest set (EPOLLIN/EPOLLOUT, level triggered).
+    // A closed fd leaves the epoll set by itself, so a new socket that got
+    // the same number is simply added again.
+    bool watch(int fd, uint32_t events){
+        if (ep_ < 0 || fd < 0) return false;
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.fd = fd;
+        if (::epoll_ctl(ep_, EPOLL_CTL_MOD, fd, &ev) == 0) return true;
+        if (errno != ENOENT) return false;
+        return ::epoll_ctl(ep_, EPOLL_CTL_ADD, fd, &ev) == 0;
+    }
+
+    void unwatch(int fd){
+        if (ep_ >= 0 && fd >= 0) ::epoll_ctl(ep_, EPOLL_CTL_DEL, fd, nullptr);
+    }
+
+    // readiness of a watched fd from the last wait_until() (0 = not ready)
+    uint32_t events(int fd) const {
+        for (int i = 0; i < nready_; ++i)
+            if (ready_[i].data.fd == fd) return ready_[i].events;
+        return 0;
+    }
+
+    // any thread or signal handler; no-op before open()
+    void wake(){
+        const int fd = wake_.load(std::memory_order_acquire);
+        if (fd < 0) return;
+        const uint64_t one = 1;
+        (void)!::write(fd, &one, sizeof(one));
+    }
+
+    // Sleep until deadline_ms (now_ms() clock; in the past = return at once)
+    // or wake() or a watched fd. Returns TIMER/WOKEN/IO bits, 0 if
+    // interrupted by a signal.
+    unsigned wait_until(long long deadline_ms){
+        if (!is_open()) {
+            const long long left = std::min(deadline_ms - now_ms(), 1000LL);
+            if (left > 0) std::this_thread::sleep_for(std::chrono::milliseconds(left));
+            nready_ = 0;
+            return TIMER;
+        }
+
+        // absolute timer; an all-zero it_value would disarm it, so clamp to 1 ns
+        itimerspec its{};
+        if (deadline_ms > 0) {
+            its.it_value.tv_sec  = static_cast<time_t>(deadline_ms / 1000);
+            its.it_value.tv_nsec = static_cast<long>((deadline_ms % 1000) * 1000000);
+        } else {
+            its.it_value.tv_nsec = 1;
+        }
+        ::timerfd_settime(timer_, TFD_TIMER_ABSTIME, &its, nullptr);
+
+        epoll_event evs[MAX_EVENTS];
+        nready_ = 0;
+        const int n = ::epoll_wait(ep_, evs, MAX_EVENTS, -1);
+        if (n < 0) return 0;   // EINTR: caller re-checks its stop flag
+
+        unsigned what = 0;
+        uint64_t cnt;
+        for (int i = 0; i < n; ++i) {
+            if (evs[i].data.fd == timer_) {
+                while (::read(timer_, &cnt, sizeof(cnt)) > 0) {}
+                what |= TIMER;
+            } else if (evs[i].data.fd == wake_.load(std::memory_order_relaxed)) {
+                while (::read(evs[i].data.fd, &cnt, sizeof(cnt)) > 0) {}
+                what |= WOKEN;
+            } else {
+                ready_[nready_++] = evs[i];
+                what |= IO;
+            }
+        }
+        return what;
+    }
+
+    // CLOCK_MONOTONIC in milliseconds
+    static long long now_ms(){
+        timespec ts{};
+        ::clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<long long>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+    }
+
+private:
+    static constexpr int MAX_EVENTS = 16;  // timer + wake + a few sockets per account
+
+    int ep_    = -1;
+    int timer_ = -1;
+    std::atomic<int> wake_{-1};   // read by wake() from any thread / signal handler
+    static_assert(std::atomic<int>::is_always_lock_free, "wake() must stay async-signal-safe");
+    epoll_event ready_[MAX_EVENTS];
+    int nready_ = 0;
+};
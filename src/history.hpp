@@ -0,0 +1,839 @@
+// history.hpp
+//
+// Append-only, compressed on-disk history of every signal (HISTORY=1), and the
+// mmap reader used by the bmw-history tool.
+//
+// One series per (VIN, signal), two files in <dir>/<VIN>/:
+//
+//   <signal>.dat   chunks of compressed points, appended back to back
+//   <signal>.idx   [ IdxHeader (256 bytes, signal name) ][ IdxEntry per chunk ]
+//
+// The index is sparse: one 40-byte entry per chunk (first/last time, offset,
+// size, point count, CRC), so a range read binary-searches the entries and
+// decodes only the chunks that overlap it; both files are read through mmap.
+//
+// Chunk encoding (Gorilla style, bit stream, MSB first), per point:
+//   time   first point: none (t_first in the index entry); then the
+//          delta-of-delta of the millisecond timestamps:
+//            '0' dod == 0 | '10' 7 bits | '110' 9 bits | '1110' 12 bits
+//            '11110' 32 bits | '11111' 64 bits
+//   value  NUM/BOOL: first point the 64 IEEE bits; then XOR with the previous
+//          value: '0' same | '10' meaningful bits inside the previous window |
+//          '11' 5 bits leading zeros, 6 bits length, meaningful bits
+//          TEXT (strings, objects; raw JSON): '0' same as before |
+//          '1' varint length + bytes
+// A chunk holds one value type and is sealed at MAX_POINTS points or
+// MAX_BYTES bytes; a type change seals it early.
+//
+// Writes are group commits: append() only encodes into the open chunk in
+// memory, a writer thread writes every dirty series' chunk tail once per
+// commit interval (the open chunk is rewritten in place until sealed), syncs
+// the file system once, then writes the index entries and syncs once more.
+// File descriptors stay open between commits. A crash loses at most one
+// interval; a torn chunk fails its CRC and is skipped by readers.
+//
+// Timestamps must increase per series: older or equal ones (BMW re-sends) are
+// dropped.
+//
+// Copyright (c) 2025 Kurt, DJ0ABR – MIT License (see bmw_mqtt_bridge.cpp)
+
+#pragma once
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace history {
+
+enum class Type : uint8_t { Num = 1, Bool = 2, Text = 3 };
+
+struct Point {
+    int64_t     t = 0;      // unix milliseconds
+    Type        type = Type::Num;
+    double      num = 0;    // Num, Bool (0/1)
+    std::string text;       // Text: raw JSON
+};
+
+// ---------------------------------------------------------------- format
+
+static constexpr size_t   IDX_HEADER_BYTES = 256;
+static constexpr uint32_t FORMAT_VERSION = 1;
+static constexpr uint32_t MAX_POINTS = 1024;   // per chunk
+static constexpr size_t   MAX_BYTES = 8192;    // per chunk
+
+struct IdxHeader {
+    char     magic[8];      // "BMWHIDX1"
+    uint32_t version;
+    uint32_t entry_bytes;
+    uint32_t name_len;
+    char     name[IDX_HEADER_BYTES - 20];
+};
+static_assert(sizeof(IdxHeader) == IDX_HEADER_BYTES, "index header size");
+
+struct IdxEntry {
+    int64_t  t_first;
+    int64_t  t_last;
+    uint64_t offset;        // in .dat
+    uint32_t bytes;
+    uint32_t count;
+    uint32_t crc;           // CRC32 of the chunk bytes
+    uint8_t  type;
+    uint8_t  sealed;
+    uint16_t reserved;
+};
+static_assert(sizeof(IdxEntry) == 40, "index entry size");
+
+inline uint32_t crc32(const void* data, size_t len){
+    static const auto table = []{
+        struct T { uint32_t v[256]; } t{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t.v[i] = c;
+        }
+        return t;
+    }();
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    uint32_t crc = ~0u;
+    while (len--) crc = table.v[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// file name for a signal: [A-Za-z0-9._-], anything else becomes '_'
+inline std::string file_key(std::string_view signal){
+    std::string s(signal);
+    for (auto& c : s) {
+        const bool ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+                        c == '.' || c == '_' || c == '-';
+        if (!ok) c = '_';
+    }
+    if (s.empty() || s[0] == '.') s.insert(s.begin(), '_');
+    return s;
+}
+
+// "2025-03-01T12:34:56.789Z" / "+01:00" offsets / quoted JSON string → unix ms; 0 = no time
+inline int64_t parse_time_ms(std::string_view s){
+    if (s.size() >= 2 && s.front() == '"' && s.back() == '"') s = s.substr(1, s.size() - 2);
+    if (s.size() < 19 || s[4] != '-' || s[7] != '-' || (s[10] != 'T' && s[10] != ' ') ||
+        s[13] != ':' || s[16] != ':') return 0;
+    auto num = [&](size_t pos, size_t n) -> int {
+        int v = 0;
+        for (size_t i = pos; i < pos + n; ++i) {
+            if (s[i] < '0' || s[i] > '9') return -1;
+            v = v * 10 + (s[i] - '0');
+        }
+        return v;
+    };
+    std::tm tm{};
+    tm.tm_year = num(0, 4) - 1900;
+    tm.tm_mon  = num(5, 2) - 1;
+    tm.tm_mday = num(8, 2);
+    tm.tm_hour = num(11, 2);
+    tm.tm_min  = num(14, 2);
+    tm.tm_sec  = num(17, 2);
+    if (tm.tm_year < 0 || tm.tm_mon < 0 || tm.tm_mday < 0 || tm.tm_hour < 0 || tm.tm_min < 0 || tm.tm_sec < 0)
+        return 0;
+    size_t i = 19;
+    int64_t ms = 0;
+    if (i < s.size() && s[i] == '.') {
+        int digits = 0;
+        for (++i; i < s.size() && s[i] >= '0' && s[i] <= '9'; ++i, ++digits)
+            if (digits < 3) ms = ms * 10 + (s[i] - '0');
+        for (; digits < 3; ++digits) ms *= 10;
+    }
+    int64_t offset_s = 0;
+    if (i < s.size() && (s[i] == '+' || s[i] == '-') && i + 6 <= s.size()) {
+        const int hh = num(i + 1, 2), mm = num(i + 4, 2);
+        if (hh >= 0 && mm >= 0) offset_s = (s[i] == '+' ? 1 : -1) * (hh * 3600 + mm * 60);
+    }
+    const int64_t secs = static_cast<int64_t>(::timegm(&tm)) - offset_s;
+    return secs * 1000 + ms;
+}
+
+// classify a raw JSON value; false for null / empty
+inline bool classify(std::string_view raw, Type& type, double& num){
+    if (raw.empty() || raw == "null") return false;
+    if (raw == "true" || raw == "false") { type = Type::Bool; num = raw == "true" ? 1 : 0; return true; }
+    const char c = raw.front();
+    if ((c >= '0' && c <= '9') || c == '-') {
+        char buf[64];
+        if (raw.size() < sizeof(buf)) {
+            std::memcpy(buf, raw.data(), raw.size());
+            buf[raw.size()] = '\0';
+            char* end = nullptr;
+            num = std::strtod(buf, &end);
+            if (end == buf + raw.size()) { type = Type::Num; return true; }
+        }
+    }
+    type = Type::Text;
+    return true;
+}
+
+// ---------------------------------------------------------------- bits
+
+class BitWriter {
+public:
+    void write(uint64_t v, int n){
+        while (n > 0) {
+            if (free_ == 0) { buf_.push_back(0); free_ = 8; }
+            const int take = std::min(n, free_);
+            const uint64_t bits = (v >> (n - take)) & ((take == 64) ? ~0ULL : ((1ULL << take) - 1));
+            buf_.back() |= static_cast<uint8_t>(bits << (free_ - take));
+            free_ -= take;
+            n -= take;
+        }
+    }
+    void bit(bool b){ write(b ? 1 : 0, 1); }
+    size_t bytes() const { return buf_.size(); }
+    const std::vector<uint8_t>& data() const { return buf_; }
+private:
+    std::vector<uint8_t> buf_;
+    int free_ = 0;   // unused bits in buf_.back()
+};
+
+class BitReader {
+public:
+    BitReader(const uint8_t* p, size_t n) : p_(p), nbits_(n * 8) {}
+    bool ok() const { return !overrun_; }
+    uint64_t read(int n){
+        uint64_t v = 0;
+        while (n > 0) {
+            if (pos_ >= nbits_) { overrun_ = true; return 0; }
+            const size_t byte = pos_ >> 3;
+            const int off = static_cast<int>(pos_ & 7);
+            const int take = std::min(n, 8 - off);
+            const uint64_t bits = (p_[byte] >> (8 - off - take)) & ((1u << take) - 1);
+            v = (v << take) | bits;
+            pos_ += static_cast<size_t>(take);
+            n -= take;
+        }
+        return v;
+    }
+    bool bit(){ return read(1) != 0; }
+private:
+    const uint8_t* p_;
+    size_t nbits_;
+    size_t pos_ = 0;
+    bool overrun_ = false;
+};
+
+inline uint64_t f64_bits(double d){ uint64_t u; std::memcpy(&u, &d, 8); return u; }
+inline double   bits_f64(uint64_t u){ double d; std::memcpy(&d, &u, 8); return d; }
+
+// ---------------------------------------------------------------- chunk codec
+
+class ChunkEncoder {
+public:
+    explicit ChunkEncoder(Type type) : type_(type) {}
+
+    Type type() const { return type_; }
+    uint32_t count() const { return count_; }
+    int64_t t_first() const { return t_first_; }
+    int64_t t_last() const { return t_prev_; }
+    const std::vector<uint8_t>& data() const { return w_.data(); }
+    bool full() const { return count_ >= MAX_POINTS || w_.bytes() >= MAX_BYTES; }
+
+    void add(int64_t t, double num, std::string_view text){
+        if (count_ == 0) {
+            t_first_ = t;
+        } else {
+            const int64_t delta = t - t_prev_;
+            write_dod(delta - delta_prev_);
+            delta_prev_ = delta;
+        }
+        t_prev_ = t;
+
+        if (type_ == Type::Text) write_text(text);
+        else write_num(num);
+        ++count_;
+    }
+
+private:
+    void write_dod(int64_t d){
+        if (d == 0)                         { w_.bit(false); }
+        else if (d >= -63 && d <= 64)       { w_.write(0b10, 2);    w_.write(static_cast<uint64_t>(d + 63), 7); }
+        else if (d >= -255 && d <= 256)     { w_.write(0b110, 3);   w_.write(static_cast<uint64_t>(d + 255), 9); }
+        else if (d >= -2047 && d <= 2048)   { w_.write(0b1110, 4);  w_.write(static_cast<uint64_t>(d + 2047), 12); }
+        else if (d >= INT32_MIN && d <= INT32_MAX) {
+            w_.write(0b11110, 5);
+            w_.write(static_cast<uint32_t>(static_cast<int32_t>(d)), 32);
+        } else {
+            w_.write(0b11111, 5);
+            w_.write(static_cast<uint64_t>(d), 64);
+        }
+    }
+
+    void write_num(double v){
+        const uint64_t bits = f64_bits(v);
+        if (count_ == 0) { w_.write(bits, 64); v_prev_ = bits; return; }
+        const uint64_t x = bits ^ v_prev_;
+        v_prev_ = bits;
+        if (x == 0) { w_.bit(false); return; }
+        int lead = __builtin_clzll(x);
+        const int trail = __builtin_ctzll(x);
+        if (lead > 31) lead = 31;   // 5 bits
+        if (window_ && lead >= lead_ && trail >= trail_) {
+            w_.write(0b10, 2);
+            w_.write(x >> trail_, 64 - lead_ - trail_);
+            return;
+        }
+        const int len = 64 - lead - trail;   // 1..64, stored as len-1 in 6 bits
+        w_.write(0b11, 2);
+        w_.write(static_cast<uint64_t>(lead), 5);
+        w_.write(static_cast<uint64_t>(len - 1), 6);
+        w_.write(x >> trail, len);
+        window_ = true;
+        lead_ = lead;
+        trail_ = trail;
+    }
+
+    void write_text(std::string_view s){
+        if (count_ > 0 && s == text_prev_) { w_.bit(false); return; }
+        if (count_ > 0) w_.bit(true);
+        uint64_t n = s.size();
+        do {   // varint, 7 bits per byte
+            const uint8_t b = static_cast<uint8_t>(n & 0x7F);
+            n >>= 7;
+            w_.write(n ? (b | 0x80) : b, 8);
+        } while (n);
+        for (unsigned char c : s) w_.write(c, 8);
+        text_prev_.assign(s.data(), s.size());
+    }
+
+    Type type_;
+    BitWriter w_;
+    uint32_t count_ = 0;
+    int64_t t_first_ = 0, t_prev_ = 0, delta_prev_ = 0;
+    uint64_t v_prev_ = 0;
+    bool window_ = false;
+    int lead_ = 0, trail_ = 0;
+    std::string text_prev_;
+};
+
+// Decode count points of a chunk; f(const Point&) returns false to stop.
+// Returns false if the chunk is damaged.
+template <typename F>
+bool decode_chunk(const uint8_t* data, size_t bytes, Type type, uint32_t count, int64_t t_first, F&& f){
+    BitReader r(data, bytes);
+    Point pt;
+    pt.type = type;
+    int64_t t = t_first, delta = 0;
+    uint64_t v = 0;
+    int lead = 0, trail = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (i > 0) {
+            int64_t dod;
+            if (!r.bit())      dod = 0;
+            else if (!r.bit()) dod = static_cast<int64_t>(r.read(7)) - 63;
+            else if (!r.bit()) dod = static_cast<int64_t>(r.read(9)) - 255;
+            else if (!r.bit()) dod = static_cast<int64_t>(r.read(12)) - 2047;
+            else if (!r.bit()) dod = static_cast<int32_t>(static_cast<uint32_t>(r.read(32)));
+            else               dod = static_cast<int64_t>(r.read(64));
+            delta += dod;
+            t += delta;
+        }
+        pt.t = t;
+
+        if (type == Type::Text) {
+            if (i == 0 || r.bit()) {
+                uint64_t n = 0;
+                for (int shift = 0; shift < 64; shift += 7) {
+                    const uint64_t b = r.read(8);
+                    n |= (b & 0x7F) << shift;
+                    if (!(b & 0x80)) break;
+                }
+                if (!r.ok() || n > bytes) return false;
+                pt.text.resize(static_cast<size_t>(n));
+                for (auto& c : pt.text) c = static_cast<char>(r.read(8));
+            }
+        } else if (i == 0) {
+            v = r.read(64);
+        } else if (r.bit()) {
+            uint64_t x;
+            if (!r.bit()) {
+                x = r.read(64 - lead - trail) << trail;
+            } else {
+                lead = static_cast<int>(r.read(5));
+                const int len = static_cast<int>(r.read(6)) + 1;
+                trail = 64 - lead - len;
+                if (trail < 0) return false;
+                x = r.read(len) << trail;
+            }
+            v ^= x;
+        }
+        if (type != Type::Text) pt.num = bits_f64(v);
+        if (!r.ok()) return false;
+        if (!f(pt)) return true;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------- writer
+
+class Writer {
+public:
+    struct Stats {
+        unsigned long long points = 0;     // appended
+        unsigned long long dropped = 0;    // out of order / duplicate time
+        unsigned long long commits = 0;
+        unsigned long long bytes = 0;      // written to .dat (incl. rewrites of open chunks)
+        unsigned long long errors = 0;
+    };
+
+    Writer() = default;
+    ~Writer(){
+        stop();
+        close_files();
+        if (dir_fd_ >= 0) ::close(dir_fd_);
+    }
+
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+
+    bool open(const std::string& dir, std::string& err){
+        if (::mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) { err = std::strerror(errno); return false; }
+        const int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) { err = std::strerror(errno); return false; }
+        if (dir_fd_ >= 0) ::close(dir_fd_);
+        dir_fd_ = fd;
+        dir_ = dir;
+        return true;
+    }
+    bool is_open() const { return !dir_.empty(); }
+
+    // group commit thread: writes every commit_ms
+    void start(long long commit_ms){
+        if (th_.joinable() || dir_.empty()) return;
+        commit_ms_ = commit_ms < 100 ? 100 : commit_ms;
+        stop_ = false;
+        th_ = std::thread([this]{ run(); });
+    }
+
+    // final commit (open chunks are written unsealed; a restart starts new ones)
+    void stop(){
+        if (th_.joinable()) {
+            { std::lock_guard<std::mutex> lk(cv_mu_); stop_ = true; }
+            cv_.notify_one();
+            th_.join();
+        }
+        if (!dir_.empty()) commit();
+    }
+
+    // Append one value (raw JSON) of a signal at t (unix ms). Not blocking on I/O
+    // except once per series to read its last index entry.
+    void append(std::string_view vin, std::string_view signal, int64_t t, std::string_view raw){
+        Type type;
+        double num = 0;
+        if (!classify(raw, type, num)) return;
+
+        std::lock_guard<std::mutex> lk(mu_);
+        Series& s = series(vin, signal);
+        if (s.has_last && t <= s.t_last) { ++stats_.dropped; return; }
+
+        if (s.open && (s.open->type() != type || s.open->full())) seal(s);
+        if (!s.open) {
+            s.open.reset(new ChunkEncoder(type));
+            s.open_offset = s.file_end;
+            s.open_slot = s.next_slot;
+        }
+        s.open->add(t, num, type == Type::Text ? raw : std::string_view());
+        s.t_last = t;
+        s.has_last = true;
+        s.dirty = true;
+        ++stats_.points;
+    }
+
+    // write all dirty series (called by the commit thread and stop(), never
+    // concurrently: files_ belongs to the caller)
+    void commit(){
+        std::vector<Job> jobs;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            for (auto& [key, s] : series_) {
+                if (!s.dirty) continue;
+                Job j;
+                j.idx_path = s.idx_path;
+                j.dat_path = s.dat_path;
+                j.name = s.name;
+                j.writes = std::move(s.sealed);
+                s.sealed.clear();
+                if (s.open && s.open->count()) j.writes.push_back(snapshot(s, *s.open, s.open_offset, s.open_slot, false));
+                s.dirty = false;
+                jobs.push_back(std::move(j));
+            }
+        }
+        if (jobs.empty()) return;
+
+        // chunk bytes of every series, one sync, then the index entries that
+        // make them visible and one more sync (syncfs also covers fds that
+        // were closed in between)
+        unsigned long long bytes = 0, errors = 0;
+        std::vector<bool> written(jobs.size(), false);
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            written[i] = write_chunks(jobs[i], bytes);
+            if (!written[i]) ++errors;
+        }
+        const bool data_synced = ::syncfs(dir_fd_) == 0;
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            if (!written[i]) continue;
+            if (!data_synced || !write_entries(jobs[i])) ++errors;
+        }
+        if (::syncfs(dir_fd_) != 0) errors = jobs.size();
+        std::lock_guard<std::mutex> lk(mu_);
+        ++stats_.commits;
+        stats_.bytes += bytes;
+        stats_.errors += errors;
+    }
+
+    Stats stats() const { std::lock_guard<std::mutex> lk(mu_); return stats_; }
+    size_t series_count() const { std::lock_guard<std::mutex> lk(mu_); return series_.size(); }
+
+private:
+    struct ChunkWrite {
+        IdxEntry entry{};
+        uint64_t slot = 0;
+        std::vector<uint8_t> data;
+    };
+    struct Series {
+        std::string name, idx_path, dat_path;
+        std::unique_ptr<ChunkEncoder> open;
+        uint64_t open_offset = 0, open_slot = 0;
+        uint64_t file_end = 0;      // end of the last sealed / previous-run chunk
+        uint64_t next_slot = 0;     // index entry of the next new chunk
+        std::vector<ChunkWrite> sealed;   // waiting for the next commit
+        int64_t  t_last = 0;
+        bool     has_last = false;
+        bool     dirty = false;
+    };
+    struct Job {
+        std::string idx_path, dat_path, name;
+        std::vector<ChunkWrite> writes;
+    };
+    struct Files {
+        int dat = -1, idx = -1;
+    };
+
+    Series& series(std::string_view vin, std::string_view signal){
+        key_.assign(vin.data(), vin.size());
+        key_.push_back('\x1f');
+        key_.append(signal.data(), signal.size());
+        auto it = series_.find(key_);
+        if (it != series_.end()) return it->second;
+
+        Series s;
+        s.name.assign(signal.data(), signal.size());
+        const std::string vdir = dir_ + "/" + file_key(vin);
+        ::mkdir(vdir.c_str(), 0755);
+        const std::string base = vdir + "/" + file_key(signal);
+        s.idx_path = base + ".idx";
+        s.dat_path = base + ".dat";
+        load_tail(s);
+        return series_.emplace(key_, std::move(s)).first->second;
+    }
+
+    // continue after the last chunk of a previous run
+    static void load_tail(Series& s){
+        int fd = ::open(s.idx_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return;
+        struct stat st{};
+        if (::fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= IDX_HEADER_BYTES + sizeof(IdxEntry)) {
+            const uint64_t n = (static_cast<uint64_t>(st.st_size) - IDX_HEADER_BYTES) / sizeof(IdxEntry);
+            IdxEntry e{};
+            if (::pread(fd, &e, sizeof(e), static_cast<off_t>(IDX_HEADER_BYTES + (n - 1) * sizeof(IdxEntry)))
+                    == static_cast<ssize_t>(sizeof(e))) {
+                s.next_slot = n;
+                s.file_end = e.offset + e.bytes;
+                s.t_last = e.t_last;
+                s.has_last = true;
+            }
+        }
+        ::close(fd);
+    }
+
+    static ChunkWrite snapshot(const Series&, const ChunkEncoder& c, uint64_t offset, uint64_t slot, bool sealed){
+        ChunkWrite w;
+        w.data = c.data();
+        w.slot = slot;
+        w.entry.t_first = c.t_first();
+        w.entry.t_last  = c.t_last();
+        w.entry.offset  = offset;
+        w.entry.bytes   = static_cast<uint32_t>(w.data.size());
+        w.entry.count   = c.count();
+        w.entry.crc     = crc32(w.data.data(), w.data.size());
+        w.entry.type    = static_cast<uint8_t>(c.type());
+        w.entry.sealed  = sealed ? 1 : 0;
+        return w;
+    }
+
+    void seal(Series& s){
+        s.sealed.push_back(snapshot(s, *s.open, s.open_offset, s.open_slot, true));
+        s.file_end = s.open_offset + s.open->data().size();
+        s.next_slot = s.open_slot + 1;
+        s.open.reset();
+    }
+
+    static bool pwrite_all(int fd, const void* p, size_t n, uint64_t off){
+        const char* c = static_cast<const char*>(p);
+        while (n > 0) {
+            ssize_t w = ::pwrite(fd, c, n, static_cast<off_t>(off));
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) return false;
+            c += w; n -= static_cast<size_t>(w); off += static_cast<uint64_t>(w);
+        }
+        return true;
+    }
+
+    static int open_retry(const std::string& path, int flags){
+        int fd;
+        do fd = ::open(path.c_str(), flags | O_CLOEXEC, 0644);
+        while (fd < 0 && errno == EINTR);
+        return fd;
+    }
+
+    // open (or reuse) the series' files; on EMFILE all cached fds are closed
+    // and the open is retried once (pointers are valid until the next call)
+    Files* files(const Job& j){
+        const auto it = files_.find(j.dat_path);
+        if (it != files_.end()) return &it->second;
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            Files f;
+            f.dat = open_retry(j.dat_path, O_WRONLY | O_CREAT);
+            if (f.dat >= 0) f.idx = open_retry(j.idx_path, O_RDWR | O_CREAT);
+            if (f.idx >= 0) return &files_.emplace(j.dat_path, f).first->second;
+            const bool emfile = errno == EMFILE || errno == ENFILE;
+            if (f.dat >= 0) ::close(f.dat);
+            if (!emfile || attempt) break;
+            close_files();
+        }
+        return nullptr;
+    }
+
+    void close_files(){
+        for (auto& [path, f] : files_) {
+            if (f.dat >= 0) ::close(f.dat);
+            if (f.idx >= 0) ::close(f.idx);
+        }
+        files_.clear();
+    }
+
+    // drop a series' fds after an I/O error, so the next commit reopens them
+    void drop_files(const Job& j){
+        auto it = files_.find(j.dat_path);
+        if (it == files_.end()) return;
+        ::close(it->second.dat);
+        ::close(it->second.idx);
+        files_.erase(it);
+    }
+
+    // commit phase 1: chunk bytes (and the index header of a new series)
+    bool write_chunks(const Job& j, unsigned long long& bytes){
+        Files* f = files(j);
+        if (!f) return false;
+
+        bool ok = true;
+        struct stat st{};
+        if (::fstat(f->idx, &st) == 0 && st.st_size < static_cast<off_t>(IDX_HEADER_BYTES)) {
+            IdxHeader h{};
+            std::memcpy(h.magic, "BMWHIDX1", 8);
+            h.version = FORMAT_VERSION;
+            h.entry_bytes = sizeof(IdxEntry);
+            h.name_len = static_cast<uint32_t>(std::min(j.name.size(), sizeof(h.name)));
+            std::memcpy(h.name, j.name.data(), h.name_len);
+            ok = pwrite_all(f->idx, &h, sizeof(h), 0);
+        }
+        for (auto& w : j.writes) {
+            ok = ok && pwrite_all(f->dat, w.data.data(), w.data.size(), w.entry.offset);
+            bytes += w.data.size();
+        }
+        if (!ok) drop_files(j);
+        return ok;
+    }
+
+    // commit phase 2: the index entries that make the synced chunks visible
+    bool write_entries(const Job& j){
+        Files* f = files(j);
+        if (!f) return false;
+        bool ok = true;
+        for (auto& w : j.writes)
+            ok = ok && pwrite_all(f->idx, &w.entry, sizeof(w.entry), IDX_HEADER_BYTES + w.slot * sizeof(IdxEntry));
+        if (!ok) drop_files(j);
+        return ok;
+    }
+
+    void run(){
+        std::unique_lock<std::mutex> lk(cv_mu_);
+        while (!stop_) {
+            cv_.wait_for(lk, std::chrono::milliseconds(commit_ms_), [this]{ return stop_; });
+            if (stop_) break;
+            lk.unlock();
+            commit();
+            lk.lock();
+        }
+    }
+
+    std::string dir_;
+    int dir_fd_ = -1;                 // syncfs() once per commit phase
+    std::map<std::string, Files> files_;   // key: .dat path; commit() caller only
+    mutable std::mutex mu_;           // series_, stats_
+    std::map<std::string, Series> series_;
+    std::string key_;
+    Stats stats_;
+
+    std::thread th_;
+    std::mutex cv_mu_;
+    std::condition_variable cv_;
+    bool stop_ = false;               // guarded by cv_mu_
+    long long commit_ms_ = 60000;
+};
+
+// ---------------------------------------------------------------- reader
+
+// Read-only view of one series; both files are mmapped, nothing is loaded.
+class SeriesReader {
+public:
+    SeriesReader() = default;
+    ~SeriesReader(){ close(); }
+    SeriesReader(const SeriesReader&) = delete;
+    SeriesReader& operator=(const SeriesReader&) = delete;
+
+    bool open(const std::string& idx_path, const std::string& dat_path, std::string& err){
+        close();
+        if (!map(idx_path, idx_, idx_size_, err)) return false;
+        if (idx_size_ < IDX_HEADER_BYTES) { err = "index too short"; close(); return false; }
+        const IdxHeader* h = reinterpret_cast<const IdxHeader*>(idx_);
+        if (std::memcmp(h->magic, "BMWHIDX1", 8) != 0 || h->version != FORMAT_VERSION ||
+            h->entry_bytes != sizeof(IdxEntry)) {
+            err = "not a history index";
+            close();
+            return false;
+        }
+        name_.assign(h->name, std::min<size_t>(h->name_len, sizeof(h->name)));
+        n_ = (idx_size_ - IDX_HEADER_BYTES) / sizeof(IdxEntry);
+        entries_ = reinterpret_cast<const IdxEntry*>(idx_ + IDX_HEADER_BYTES);
+        if (!map(dat_path, dat_, dat_size_, err)) { close(); return false; }
+        return true;
+    }
+
+    void close(){
+        if (idx_) ::munmap(const_cast<uint8_t*>(idx_), idx_size_);
+        if (dat_) ::munmap(const_cast<uint8_t*>(dat_), dat_size_);
+        idx_ = dat_ = nullptr;
+        idx_size_ = dat_size_ = 0;
+        n_ = 0;
+        entries_ = nullptr;
+    }
+
+    const std::string& name() const { return name_; }
+    size_t chunks() const { return n_; }
+    const IdxEntry& entry(size_t i) const { return entries_[i]; }
+    unsigned long long damaged() const { return damaged_; }
+
+    // points with from <= t <= to in time order; f returns false to stop
+    template <typename F>
+    void range(int64_t from, int64_t to, F&& f) const {
+        // first chunk whose t_last >= from (chunks are in time order)
+        size_t lo = 0, hi = n_;
+        while (lo < hi) {
+            const size_t mid = (lo + hi) / 2;
+            if (entries_[mid].t_last < from) lo = mid + 1; else hi = mid;
+        }
+        bool go = true;
+        for (size_t i = lo; i < n_ && go && entries_[i].t_first <= to; ++i) {
+            decode(i, [&](const Point& p){
+                if (p.t < from) return true;
+                if (p.t > to) { go = false; return false; }
+                go = f(p);
+                return go;
+            });
+        }
+    }
+
+    // the last n points (oldest first)
+    template <typename F>
+    void last(size_t n, F&& f) const {
+        size_t have = 0, first = n_;
+        while (first > 0 && have < n) have += entries_[--first].count;
+        size_t skip = have > n ? have - n : 0;
+        bool go = true;
+        for (size_t i = first; i < n_ && go; ++i) {
+            decode(i, [&](const Point& p){
+                if (skip) { --skip; return true; }
+                go = f(p);
+                return go;
+            });
+        }
+    }
+
+private:
+    // decode chunk i if it is intact (damaged ones are counted and skipped)
+    template <typename F>
+    void decode(size_t i, F&& f) const {
+        const IdxEntry& e = entries_[i];
+        if (e.offset + e.bytes > dat_size_ || crc32(dat_ + e.offset, e.bytes) != e.crc ||
+            !decode_chunk(dat_ + e.offset, e.bytes, static_cast<Type>(e.type), e.count, e.t_first, f)) {
+            ++damaged_;
+        }
+    }
+
+    static bool map(const std::string& path, const uint8_t*& p, size_t& size, std::string& err){
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) { err = path + ": " + std::strerror(errno); return false; }
+        struct stat st{};
+        if (::fstat(fd, &st) != 0) { err = std::strerror(errno); ::close(fd); return false; }
+        size = static_cast<size_t>(st.st_size);
+        if (size == 0) { ::close(fd); p = nullptr; return true; }
+        void* m = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (m == MAP_FAILED) { err = std::strerror(errno); size = 0; return false; }
+        p = static_cast<const uint8_t*>(m);
+        return true;
+    }
+
+    const uint8_t* idx_ = nullptr;
+    const uint8_t* dat_ = nullptr;
+    size_t idx_size_ = 0, dat_size_ = 0;
+    size_t n_ = 0;
+    const IdxEntry* entries_ = nullptr;
+    std::string name_;
+    mutable unsigned long long damaged_ = 0;
+};
+
+// sub directories (VINs) / series (signal name → file base path) of a history dir
+inline std::vector<std::string> list_dir(const std::string& dir, bool dirs){
+    std::vector<std::string> out;
+    DIR* d = ::opendir(dir.c_str());
+    if (!d) return out;
+    while (dirent* e = ::readdir(d)) {
+        const std::string n = e->d_name;
+        if (n == "." || n == "..") continue;
+        struct stat st{};
+        if (::stat((dir + "/" + n).c_str(), &st) != 0) continue;
+        if (dirs && S_ISDIR(st.st_mode)) out.push_back(n);
+        if (!dirs && S_ISREG(st.st_mode) && n.size() > 4 && n.compare(n.size() - 4, 4, ".idx") == 0)
+            out.push_back(n.substr(0, n.size() - 4));
+    }
+    ::closedir(d);
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+} // namespace history
@@ -0,0 +1,259 @@
+// http_server.hpp
+//
+// Minimal HTTP/1.1 server for the bridge's local endpoints (metrics, API).
+//
+//   - GET/HEAD only, no request bodies, "Connection: close" after each response
+//   - one accept thread; each connection is served on its own short-lived
+//     thread, capped at max_conns (excess connections get 503)
+//   - handlers may block (long-poll); stop() waits for them to return
+//
+// Meant to be bound to 127.0.0.1 or a trusted network, not the internet.
+//
+// Copyright (c) 2025 Kurt, DJ0ABR – MIT License (see bmw_mqtt_bridge.cpp)
+
+#pragma once
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+struct HttpRequest {
+    std::string method;
+    std::string path;      // without query string
+    std::string query;     // after '?', undecoded
+    std::vector<std::pair<std::string, std::string>> headers; // names lower-case
+
+    std::string header(const std::string& lname) const {
+        for (auto& h : headers) if (h.first == lname) return h.second;
+        return {};
+    }
+    // value of key in the query string ("" if absent)
+    std::string query_param(const std::string& key) const {
+        size_t i = 0;
+        while (i < query.size()) {
+            size_t amp = query.find('&', i);
+            if (amp == std::string::npos) amp = query.size();
+            size_t eq = query.find('=', i);
+            if (eq != std::string::npos && eq < amp && query.compare(i, eq - i, key) == 0)
+                return query.substr(eq + 1, amp - eq - 1);
+            i = amp + 1;
+        }
+        return {};
+    }
+};
+
+struct HttpResponse {
+    int status = 200;
+    std::string content_type = "text/plain; charset=utf-8";
+    std::string body;
+    std::vector<std::pair<std::string, std::string>> headers;
+};
+
+class HttpServer {
+public:
+    using Handler = std::function<HttpResponse(const HttpRequest&)>;
+
+    explicit HttpServer(int max_conns = 16) : max_conns_(max_conns) {}
+    ~HttpServer(){ stop(); }
+
+    HttpServer(const HttpServer&) = delete;
+    HttpServer& operator=(const HttpServer&) = delete;
+
+    bool start(const std::string& bind_addr, int port, Handler h, std::string& err){
+        handler_ = std::move(h);
+        listen_fd_ = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listen_fd_ < 0) { err = std::strerror(errno); return false; }
+        int one = 1;
+        ::setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        sockaddr_in a{};
+        a.sin_family = AF_INET;
+        a.sin_port = htons(static_cast<uint16_t>(port));
+        if (::inet_pton(AF_INET, bind_addr.c_str(), &a.sin_addr) != 1) {
+            err = "invalid bind address '" + bind_addr + "'";
+            ::close(listen_fd_); listen_fd_ = -1;
+            return false;
+        }
+        if (::bind(listen_fd_, reinterpret_cast<sockaddr*>(&a), sizeof(a)) != 0 ||
+            ::listen(listen_fd_, 16) != 0) {
+            err = std::strerror(errno);
+            ::close(listen_fd_); listen_fd_ = -1;
+            return false;
+        }
+        if (::pipe(stop_pipe_) != 0) {
+            err = std::strerror(errno);
+            ::close(listen_fd_); listen_fd_ = -1;
+            return false;
+        }
+        stopping_ = false;
+        accept_thread_ = std::thread([this]{ accept_loop(); });
+        return true;
+    }
+
+    void stop(){
+        if (!accept_thread_.joinable()) return;
+        stopping_ = true;
+        (void)!::write(stop_pipe_[1], "x", 1);
+        accept_thread_.join();
+        ::close(listen_fd_);   listen_fd_ = -1;
+        ::close(stop_pipe_[0]); ::close(stop_pipe_[1]);
+
+        std::unique_lock<std::mutex> lk(mu_);
+        cv_.wait(lk, [this]{ return active_ == 0; });
+    }
+
+    // for handlers that wait (long-poll): true once stop() has been called
+    bool stopping() const { return stopping_.load(); }
+
+private:
+    void accept_loop(){
+        pollfd fds[2] = {{listen_fd_, POLLIN, 0}, {stop_pipe_[0], POLLIN, 0}};
+        while (!stopping_) {
+            if (::poll(fds, 2, -1) < 0) { if (errno == EINTR) continue; break; }
+            if (fds[1].revents) break;
+            if (!(fds[0].revents & POLLIN)) continue;
+
+            int fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0) continue;
+            {
+                std::lock_guard<std::mutex> lk(mu_);
+                if (active_ >= max_conns_) {
+                    HttpResponse busy;
+                    busy.status = 503;
+                    busy.body = "busy\n";
+                    send_response(fd, busy, false);
+                    ::close(fd);
+                    continue;
+                }
+                ++active_;
+            }
+            std::thread([this, fd]{
+                serve(fd);
+                ::close(fd);
+                std::lock_guard<std::mutex> lk(mu_);
+                --active_;
+                cv_.notify_all();
+            }).detach();
+        }
+    }
+
+    void serve(int fd){
+        timeval tv{5, 0};
+        ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+        std::string buf;
+        char tmp[2048];
+        while (buf.find("\r\n\r\n") == std::string::npos) {
+            ssize_t n = ::recv(fd, tmp, sizeof(tmp), 0);
+            if (n <= 0) return;
+            buf.append(tmp, static_cast<size_t>(n));
+            if (buf.size() > 16 * 1024) return;
+        }
+
+        HttpRequest req;
+        if (!parse(buf, req)) {
+            HttpResponse bad;
+            bad.status = 400;
+            bad.body = "bad request\n";
+            send_response(fd, bad, false);
+            return;
+        }
+        if (req.method != "GET" && req.method != "HEAD") {
+            HttpResponse na;
+            na.status = 405;
+            na.headers.push_back({"Allow", "GET, HEAD"});
+            na.body = "method not allowed\n";
+            send_response(fd, na, false);
+            return;
+        }
+        send_response(fd, handler_(req), req.method == "HEAD");
+    }
+
+    static bool parse(const std::string& buf, HttpRequest& req){
+        size_t eol = buf.find("\r\n");
+        const std::string line = buf.substr(0, eol);
+        size_t s1 = line.find(' ');
+        size_t s2 = line.find(' ', s1 == std::string::npos ? s1 : s1 + 1);
+        if (s1 == std::string::npos || s2 == std::string::npos) return false;
+        req.method = line.substr(0, s1);
+        std::string target = line.substr(s1 + 1, s2 - s1 - 1);
+        size_t q = target.find('?');
+        req.path  = target.substr(0, q);
+        req.query = (q == std::string::npos) ? std::string() : target.substr(q + 1);
+
+        size_t pos = eol + 2;
+        while (pos < buf.size()) {
+            size_t e = buf.find("\r\n", pos);
+            if (e == std::string::npos || e == pos) break;
+            std::string h = buf.substr(pos, e - pos);
+            size_t c = h.find(':');
+            if (c != std::string::npos) {
+                std::string name = h.substr(0, c);
+                for (auto& ch : name) ch = static_cast<char>(std::tolower(static_cast<unsigned char>(ch)));
+                size_t v = c + 1;
+                while (v < h.size() && (h[v] == ' ' || h[v] == '\t')) ++v;
+                req.headers.emplace_back(std::move(name), h.substr(v));
+            }
+            pos = e + 2;
+        }
+        return true;
+    }
+
+    static const char* reason(int status){
+        switch (status) {
+        case 200: return "OK";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 503: return "Service Unavailable";
+        default:  return "Status";
+        }
+    }
+
+    static void send_response(int fd, const HttpResponse& r, bool head_only){
+        std::string out = "HTTP/1.1 " + std::to_string(r.status) + " " + reason(r.status) + "\r\n";
+        if (r.status != 304) {
+            out += "Content-Type: " + r.content_type + "\r\n";
+            out += "Content-Length: " + std::to_string(r.body.size()) + "\r\n";
+        }
+        for (auto& h : r.headers) out += h.first + ": " + h.second + "\r\n";
+        out += "Connection: close\r\n\r\n";
+        if (!head_only && r.status != 304) out += r.body;
+
+        const char* p = out.data();
+        size_t left = out.size();
+        while (left > 0) {
+            ssize_t n = ::send(fd, p, left, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return;
+            p += n; left -= static_cast<size_t>(n);
+        }
+    }
+
+    Handler handler_;
+    int listen_fd_ = -1;
+    int stop_pipe_[2] = {-1, -1};
+    std::thread accept_thread_;
+    std::atomic<bool> stopping_{false};
+
+    int max_conns_;
+    int active_ = 0;
+    std::mutex mu_;
+    std::condition_variable cv_;
+};
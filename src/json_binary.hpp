@@ -0,0 +1,422 @@
+// json_binary.hpp
+//
+// Direct JSON → CBOR / MessagePack transcoder without a DOM.
+//
+// Produces the same bytes as nlohmann's to_cbor() / to_msgpack() of the parsed
+// document (object keys sorted bytewise, smallest integer encodings, floats as
+// float32 when exact), so it can replace parse + encode on the hot path.
+// Values are encoded into a scratch buffer that keeps its capacity: after the
+// first messages no heap allocation happens at all.
+//
+//   Transcoder t;
+//   if (!t.encode(text, json_binary::Format::Cbor, out)) { ... use the DOM path ... }
+//
+// encode() returns false for anything it does not handle exactly like
+// nlohmann – invalid JSON, duplicate keys, lone surrogates, integers that
+// overflow 64 bits, numbers longer than 63 characters, nesting deeper than
+// MAX_DEPTH. The caller then takes the DOM path, which decides.
+//
+// Notes:
+//   - Not thread-safe; one Transcoder per thread.
+//   - Strings are validated as UTF-8 (as nlohmann does), escapes decoded.
+//
+// Copyright (c) 2025 Kurt, DJ0ABR – MIT License (see bmw_mqtt_bridge.cpp)
+
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace json_binary {
+
+enum class Format { Cbor, Msgpack };
+
+class Transcoder {
+public:
+    static constexpr int MAX_DEPTH = 128;
+
+    bool encode(std::string_view text, Format fmt, std::string& out){
+        fmt_ = fmt;
+        p_ = text.data();
+        end_ = p_ + text.size();
+        buf_.clear();
+        entries_.clear();
+        skip_ws();
+        if (!value(0)) return false;
+        skip_ws();
+        if (p_ != end_) return false;
+        out.assign(buf_.data(), buf_.size());
+        return true;
+    }
+
+private:
+    struct Entry {
+        size_t key, key_len;    // decoded key bytes in buf_
+        size_t val, val_len;    // encoded value in buf_
+    };
+
+    // ---- parsing ----
+
+    void skip_ws(){
+        while (p_ < end_ && (*p_ == ' ' || *p_ == '\t' || *p_ == '\n' || *p_ == '\r')) ++p_;
+    }
+
+    bool literal(const char* word, size_t n){
+        if (static_cast<size_t>(end_ - p_) < n || std::memcmp(p_, word, n) != 0) return false;
+        p_ += n;
+        return true;
+    }
+
+    bool value(int depth){
+        if (p_ == end_ || depth > MAX_DEPTH) return false;
+        switch (*p_) {
+        case '{': return object(depth);
+        case '[': return array(depth);
+        case '"': {
+            const size_t at = buf_.size();
+            if (!string()) return false;
+            return wrap_string(at);
+        }
+        case 't': if (!literal("true", 4)) return false;  put(fmt_ == Format::Cbor ? 0xf5 : 0xc3); return true;
+        case 'f': if (!literal("false", 5)) return false; put(fmt_ == Format::Cbor ? 0xf4 : 0xc2); return true;
+        case 'n': if (!literal("null", 4)) return false;  put(fmt_ == Format::Cbor ? 0xf6 : 0xc0); return true;
+        default:  return number();
+        }
+    }
+
+    bool object(int depth){
+        ++p_;   // '{'
+        const size_t first = entries_.size();
+        const size_t scratch = buf_.size();
+        skip_ws();
+        if (p_ < end_ && *p_ == '}') {
+            ++p_;
+        } else {
+            for (;;) {
+                skip_ws();
+                if (p_ == end_ || *p_ != '"') return false;
+                Entry e;
+                e.key = buf_.size();
+                if (!string()) return false;
+                e.key_len = buf_.size() - e.key;
+                skip_ws();
+                if (p_ == end_ || *p_ != ':') return false;
+                ++p_;
+                skip_ws();
+                e.val = buf_.size();
+                if (!value(depth + 1)) return false;
+                e.val_len = buf_.size() - e.val;
+                entries_.push_back(e);
+                skip_ws();
+                if (p_ == end_) return false;
+                if (*p_ == ',') { ++p_; continue; }
+                if (*p_ == '}') { ++p_; break; }
+                return false;
+            }
+        }
+
+        // nlohmann keeps objects in a std::map: sorted keys, no duplicates
+        const size_t n = entries_.size() - first;
+        const char* base = buf_.data();
+        auto key = [&](const Entry& e){ return std::string_view(base + e.key, e.key_len); };
+        std::sort(entries_.begin() + static_cast<std::ptrdiff_t>(first), entries_.end(),
+                  [&](const Entry& a, const Entry& b){ return key(a) < key(b); });
+        for (size_t i = first + 1; i < entries_.size(); ++i)
+            if (key(entries_[i - 1]) == key(entries_[i])) return false;
+
+        // assemble header + (key, value)* behind the scratch area, then move it down
+        const size_t body = buf_.size();
+        header(fmt_ == Format::Cbor ? 0xa0 : 0, n, Kind::Map);
+        for (size_t i = first; i < entries_.size(); ++i) {
+            const Entry e = entries_[i];
+            string_header(e.key_len);
+            buf_.append(buf_, e.key, e.key_len);
+            buf_.append(buf_, e.val, e.val_len);
+        }
+        buf_.erase(scratch, body - scratch);
+        entries_.resize(first);
+        return true;
+    }
+
+    bool array(int depth){
+        ++p_;   // '['
+        const size_t scratch = buf_.size();
+        size_t n = 0;
+        skip_ws();
+        if (p_ < end_ && *p_ == ']') {
+            ++p_;
+        } else {
+            for (;;) {
+                skip_ws();
+                if (!value(depth + 1)) return false;
+                ++n;
+                skip_ws();
+                if (p_ == end_) return false;
+                if (*p_ == ',') { ++p_; continue; }
+                if (*p_ == ']') { ++p_; break; }
+                return false;
+            }
+        }
+        // header in front of the elements
+        const size_t body = buf_.size();
+        header(fmt_ == Format::Cbor ? 0x80 : 0, n, Kind::Array);
+        std::rotate(buf_.begin() + static_cast<std::ptrdiff_t>(scratch),
+                    buf_.begin() + static_cast<std::ptrdiff_t>(body), buf_.end());
+        return true;
+    }
+
+    // decode a JSON string at p_ into buf_ (raw bytes, no header)
+    bool string(){
+        ++p_;   // '"'
+        for (;;) {
+            if (p_ == end_) return false;
+            const unsigned char c = static_cast<unsigned char>(*p_);
+            if (c == '"') { ++p_; return true; }
+            if (c < 0x20) return false;
+            if (c == '\\') {
+                if (++p_ == end_) return false;
+                switch (*p_++) {
+                case '"':  buf_ += '"';  break;
+                case '\\': buf_ += '\\'; break;
+                case '/':  buf_ += '/';  break;
+                case 'b':  buf_ += '\b'; break;
+                case 'f':  buf_ += '\f'; break;
+                case 'n':  buf_ += '\n'; break;
+                case 'r':  buf_ += '\r'; break;
+                case 't':  buf_ += '\t'; break;
+                case 'u': {
+                    uint32_t cp;
+                    if (!hex4(cp)) return false;
+                    if (cp >= 0xd800 && cp <= 0xdbff) {          // high surrogate: needs a low one
+                        uint32_t lo;
+                        if (end_ - p_ < 2 || p_[0] != '\\' || p_[1] != 'u') return false;
+                        p_ += 2;
+                        if (!hex4(lo) || lo < 0xdc00 || lo > 0xdfff) return false;
+                        cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+                    } else if (cp >= 0xdc00 && cp <= 0xdfff) {
+                        return false;
+                    }
+                    utf8(cp);
+                    break;
+                }
+                default: return false;
+                }
+                continue;
+            }
+            if (c < 0x80) { buf_ += static_cast<char>(c); ++p_; continue; }
+            const size_t n = utf8_len(reinterpret_cast<const unsigned char*>(p_),
+                                      static_cast<size_t>(end_ - p_));
+            if (!n) return false;
+            buf_.append(p_, n);
+            p_ += n;
+        }
+    }
+
+    bool hex4(uint32_t& v){
+        if (end_ - p_ < 4) return false;
+        v = 0;
+        for (int i = 0; i < 4; ++i) {
+            const char c = *p_++;
+            v <<= 4;
+            if (c >= '0' && c <= '9') v |= static_cast<uint32_t>(c - '0');
+            else if (c >= 'a' && c <= 'f') v |= static_cast<uint32_t>(c - 'a' + 10);
+            else if (c >= 'A' && c <= 'F') v |= static_cast<uint32_t>(c - 'A' + 10);
+            else return false;
+        }
+        return true;
+    }
+
+    // length of the well-formed UTF-8 sequence at s (RFC 3629), 0 = invalid
+    static size_t utf8_len(const unsigned char* s, size_t avail){
+        const unsigned char c = s[0];
+        size_t n;
+        unsigned char lo = 0x80, hi = 0xbf;
+        if (c >= 0xc2 && c <= 0xdf)      n = 2;
+        else if (c == 0xe0)              { n = 3; lo = 0xa0; }
+        else if (c >= 0xe1 && c <= 0xec) n = 3;
+        else if (c == 0xed)              { n = 3; hi = 0x9f; }
+        else if (c >= 0xee && c <= 0xef) n = 3;
+        else if (c == 0xf0)              { n = 4; lo = 0x90; }
+        else if (c >= 0xf1 && c <= 0xf3) n = 4;
+        else if (c == 0xf4)              { n = 4; hi = 0x8f; }
+        else return 0;
+        if (avail < n) return 0;
+        if (s[1] < lo || s[1] > hi) return 0;
+        for (size_t i = 2; i < n; ++i)
+            if (s[i] < 0x80 || s[i] > 0xbf) return 0;
+        return n;
+    }
+
+    void utf8(uint32_t cp){
+        if (cp < 0x80) {
+            buf_ += static_cast<char>(cp);
+        } else if (cp < 0x800) {
+            buf_ += static_cast<char>(0xc0 | (cp >> 6));
+            buf_ += static_cast<char>(0x80 | (cp & 0x3f));
+        } else if (cp < 0x10000) {
+            buf_ += static_cast<char>(0xe0 | (cp >> 12));
+            buf_ += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+            buf_ += static_cast<char>(0x80 | (cp & 0x3f));
+        } else {
+            buf_ += static_cast<char>(0xf0 | (cp >> 18));
+            buf_ += static_cast<char>(0x80 | ((cp >> 12) & 0x3f));
+            buf_ += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+            buf_ += static_cast<char>(0x80 | (cp & 0x3f));
+        }
+    }
+
+    // JSON number grammar; integers as nlohmann reads them (negative →
+    // int64, else uint64), everything else as double
+    bool number(){
+        const char* s = p_;
+        bool is_float = false;
+        if (p_ < end_ && *p_ == '-') ++p_;
+        if (p_ == end_) return false;
+        if (*p_ == '0') {
+            ++p_;
+        } else if (*p_ >= '1' && *p_ <= '9') {
+            while (p_ < end_ && *p_ >= '0' && *p_ <= '9') ++p_;
+        } else {
+            return false;
+        }
+        if (p_ < end_ && *p_ == '.') {
+            is_float = true;
+            ++p_;
+            if (p_ == end_ || *p_ < '0' || *p_ > '9') return false;
+            while (p_ < end_ && *p_ >= '0' && *p_ <= '9') ++p_;
+        }
+        if (p_ < end_ && (*p_ == 'e' || *p_ == 'E')) {
+            is_float = true;
+            ++p_;
+            if (p_ < end_ && (*p_ == '+' || *p_ == '-')) ++p_;
+            if (p_ == end_ || *p_ < '0' || *p_ > '9') return false;
+            while (p_ < end_ && *p_ >= '0' && *p_ <= '9') ++p_;
+        }
+
+        char tmp[64];
+        const size_t len = static_cast<size_t>(p_ - s);
+        if (len >= sizeof(tmp)) return false;
+        std::memcpy(tmp, s, len);
+        tmp[len] = '\0';
+        char* e = nullptr;
+        errno = 0;
+        if (!is_float) {
+            if (*s == '-') {
+                const long long v = std::strtoll(tmp, &e, 10);
+                if (errno == ERANGE) return false;    // nlohmann: double
+                put_int(v);
+            } else {
+                const unsigned long long v = std::strtoull(tmp, &e, 10);
+                if (errno == ERANGE) return false;
+                put_uint(v);
+            }
+            return true;
+        }
+        const double d = std::strtod(tmp, &e);
+        if (!std::isfinite(d)) return false;
+        put_float(d);
+        return true;
+    }
+
+    // ---- encoding ----
+
+    enum class Kind { Map, Array };
+
+    void put(unsigned c){ buf_ += static_cast<char>(c); }
+
+    void put_be(uint64_t v, int bytes){
+        for (int i = bytes - 1; i >= 0; --i) put(static_cast<unsigned>((v >> (8 * i)) & 0xff));
+    }
+
+    // CBOR: major type (0x00 / 0x20 / ...) + argument
+    void cbor_head(unsigned major, uint64_t v){
+        if (v < 24)                       put(major | static_cast<unsigned>(v));
+        else if (v <= 0xff)               { put(major | 24); put_be(v, 1); }
+        else if (v <= 0xffff)             { put(major | 25); put_be(v, 2); }
+        else if (v <= 0xffffffffull)      { put(major | 26); put_be(v, 4); }
+        else                              { put(major | 27); put_be(v, 8); }
+    }
+
+    void put_uint(uint64_t v){
+        if (fmt_ == Format::Cbor) { cbor_head(0x00, v); return; }
+        if (v < 128)                      put(static_cast<unsigned>(v));
+        else if (v <= 0xff)               { put(0xcc); put_be(v, 1); }
+        else if (v <= 0xffff)             { put(0xcd); put_be(v, 2); }
+        else if (v <= 0xffffffffull)      { put(0xce); put_be(v, 4); }
+        else                              { put(0xcf); put_be(v, 8); }
+    }
+
+    void put_int(int64_t v){
+        if (v >= 0) { put_uint(static_cast<uint64_t>(v)); return; }
+        if (fmt_ == Format::Cbor) { cbor_head(0x20, static_cast<uint64_t>(-1 - v)); return; }
+        if (v >= -32)                     put(static_cast<unsigned>(static_cast<uint8_t>(static_cast<int8_t>(v))));
+        else if (v >= INT8_MIN)           { put(0xd0); put_be(static_cast<uint64_t>(v), 1); }
+        else if (v >= INT16_MIN)          { put(0xd1); put_be(static_cast<uint64_t>(v), 2); }
+        else if (v >= INT32_MIN)          { put(0xd2); put_be(static_cast<uint64_t>(v), 4); }
+        else                              { put(0xd3); put_be(static_cast<uint64_t>(v), 8); }
+    }
+
+    void put_float(double d){
+        const bool single = d >= static_cast<double>(std::numeric_limits<float>::lowest()) &&
+                            d <= static_cast<double>(std::numeric_limits<float>::max()) &&
+                            static_cast<double>(static_cast<float>(d)) == d;
+        if (single) {
+            const float f = static_cast<float>(d);
+            uint32_t bits;
+            std::memcpy(&bits, &f, sizeof(bits));
+            put(fmt_ == Format::Cbor ? 0xfa : 0xca);
+            put_be(bits, 4);
+        } else {
+            uint64_t bits;
+            std::memcpy(&bits, &d, sizeof(bits));
+            put(fmt_ == Format::Cbor ? 0xfb : 0xcb);
+            put_be(bits, 8);
+        }
+    }
+
+    void header(unsigned cbor_major, size_t n, Kind kind){
+        if (fmt_ == Format::Cbor) { cbor_head(cbor_major, n); return; }
+        if (kind == Kind::Map) {
+            if (n < 16)                   put(0x80 | static_cast<unsigned>(n));
+            else if (n <= 0xffff)         { put(0xde); put_be(n, 2); }
+            else                          { put(0xdf); put_be(n, 4); }
+        } else {
+            if (n < 16)                   put(0x90 | static_cast<unsigned>(n));
+            else if (n <= 0xffff)         { put(0xdc); put_be(n, 2); }
+            else                          { put(0xdd); put_be(n, 4); }
+        }
+    }
+
+    void string_header(size_t n){
+        if (fmt_ == Format::Cbor) { cbor_head(0x60, n); return; }
+        if (n < 32)                       put(0xa0 | static_cast<unsigned>(n));
+        else if (n <= 0xff)               { put(0xd9); put_be(n, 1); }
+        else if (n <= 0xffff)             { put(0xda); put_be(n, 2); }
+        else                              { put(0xdb); put_be(n, 4); }
+    }
+
+    // raw string bytes at buf_[at..] → header + bytes
+    bool wrap_string(size_t at){
+        const size_t n = buf_.size() - at;
+        string_header(n);
+        std::rotate(buf_.begin() + static_cast<std::ptrdiff_t>(at),
+                    buf_.begin() + static_cast<std::ptrdiff_t>(at + n), buf_.end());
+        return true;
+    }
+
+    Format      fmt_ = Format::Cbor;
+    const char* p_ = nullptr;
+    const char* end_ = nullptr;
+    std::string buf_;               // output, with scratch areas for open objects/arrays
+    std::vector<Entry> entries_;    // members of the open objects (stack)
+};
+
+} // namespace json_binary
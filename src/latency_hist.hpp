@@ -0,0 +1,98 @@
+// latency_hist.hpp
+//
+// HDR-style latency histogram: log-linear buckets with a fixed relative
+// precision over a wide range, constant-time record, percentiles on demand.
+//
+//   values 0..127            one bucket per value (exact)
+//   values >= 128            64 buckets per power of two (≤ 1.6 % wide)
+//   values >= 2^MAX_BITS     clamped into the last bucket (max() stays exact)
+//
+// With microseconds that is 1 µs resolution up to 128 µs and 2 significant
+// digits up to ~19 hours in 2048 buckets (16 KB).
+//
+// Notes:
+//   - Not thread-safe; the owner serializes record() and the readers.
+//   - value_at(p) returns the highest value of the bucket holding the p-th
+//     percentile (capped at max()), like HdrHistogram does.
+//   - merge() adds another histogram (interval → since start).
+//
+// Copyright (c) 2025 Kurt, DJ0ABR – MIT License (see bmw_mqtt_bridge.cpp)
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+class HdrHistogram {
+public:
+    static constexpr int      LINEAR_BITS = 7;                      // 128 exact values
+    static constexpr uint64_t LINEAR = 1ull << LINEAR_BITS;
+    static constexpr uint64_t HALF = LINEAR / 2;                    // buckets per power of two
+    static constexpr int      MAX_BITS = 36;
+    static constexpr size_t   BUCKETS = LINEAR + (MAX_BITS - LINEAR_BITS) * HALF;
+
+    HdrHistogram() : counts_(BUCKETS, 0) {}
+
+    void record(uint64_t v){
+        ++counts_[index(v)];
+        ++count_;
+        sum_ += v;
+        if (v > max_) max_ = v;
+        if (count_ == 1 || v < min_) min_ = v;
+    }
+
+    void merge(const HdrHistogram& o){
+        if (!o.count_) return;
+        for (size_t i = 0; i < BUCKETS; ++i) counts_[i] += o.counts_[i];
+        min_ = count_ ? std::min(min_, o.min_) : o.min_;
+        max_ = std::max(max_, o.max_);
+        count_ += o.count_;
+        sum_ += o.sum_;
+    }
+
+    void reset(){
+        std::fill(counts_.begin(), counts_.end(), 0);
+        count_ = sum_ = max_ = min_ = 0;
+    }
+
+    uint64_t count() const { return count_; }
+    uint64_t max() const { return max_; }
+    uint64_t min() const { return min_; }
+    double   mean() const { return count_ ? static_cast<double>(sum_) / static_cast<double>(count_) : 0.0; }
+
+    // p in [0, 100]
+    uint64_t value_at(double p) const {
+        if (!count_) return 0;
+        p = std::min(100.0, std::max(0.0, p));
+        uint64_t rank = static_cast<uint64_t>(p / 100.0 * static_cast<double>(count_) + 0.5);
+        if (rank < 1) rank = 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            seen += counts_[i];
+            if (seen >= rank) return std::min(highest(i), max_);
+        }
+        return max_;
+    }
+
+private:
+    static size_t index(uint64_t v){
+        if (v < LINEAR) return static_cast<size_t>(v);
+        if (v >> MAX_BITS) return BUCKETS - 1;
+        const int msb = 63 - __builtin_clzll(v);
+        const int shift = msb - (LINEAR_BITS - 1);                  // v >> shift in [HALF, LINEAR)
+        return static_cast<size_t>(LINEAR + (shift - 1) * HALF + ((v >> shift) - HALF));
+    }
+
+    // highest value that lands in bucket i
+    static uint64_t highest(size_t i){
+        if (i < LINEAR) return i;
+        const uint64_t k = i - LINEAR;
+        const int shift = static_cast<int>(k / HALF) + 1;
+        const uint64_t m = k % HALF + HALF;
+        return ((m + 1) << shift) - 1;
+    }
+
+    std::vector<uint64_t> counts_;
+    uint64_t count_ = 0, sum_ = 0, max_ = 0, min_ = 0;
+};
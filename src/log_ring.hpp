@@ -0,0 +1,267 @@
+// log_ring.hpp
+//
+// Asynchronous, bounded ring-buffer logger.
+//
+// Callers on the MQTT network threads format a line into a pre-allocated slot
+// of a lock-free ring (bounded MPMC queue after D. Vyukov) and return; a
+// background flusher thread drains the ring and writes the lines to stderr in
+// batches (one write() per batch). A log call never blocks and never does a
+// syscall on the caller's thread, except for waking an idle flusher.
+//
+//   - levels:     error < warn < info < debug   (LOG_LEVEL)
+//   - categories: per-category sampling, "log every Nth line" (LOG_SAMPLE)
+//   - overflow:   if the ring is full the line is dropped and counted; the
+//                 flusher reports the number of dropped lines
+//
+// Copyright (c) 2025 Kurt, DJ0ABR – MIT License (see bmw_mqtt_bridge.cpp)
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+enum class LogLevel : int { Error = 0, Warn = 1, Info = 2, Debug = 3 };
+
+enum class LogCat : int { Bridge = 0, Fwd, Split, BmwLog, Count };
+
+class LogRing {
+public:
+    static constexpr size_t LINE_BYTES = 512;     // bytes per line incl. '\n'
+
+    explicit LogRing(size_t capacity = 1024, int fd = STDERR_FILENO) : fd_(fd) {
+        size_t cap = 1;
+        while (cap < capacity) cap <<= 1;
+        mask_ = cap - 1;
+        slots_.reset(new Slot[cap]);
+        for (size_t i = 0; i < cap; ++i) slots_[i].seq.store(i, std::memory_order_relaxed);
+        for (auto& s : sample_every_) s.store(1, std::memory_order_relaxed);
+    }
+    ~LogRing(){ stop(); }
+
+    LogRing(const LogRing&) = delete;
+    LogRing& operator=(const LogRing&) = delete;
+
+    // ---- configuration ----
+    void set_level(LogLevel l){ level_.store(static_cast<int>(l), std::memory_order_relaxed); }
+
+    // every Nth line of this category is written; 0 = category off
+    void set_sampling(LogCat c, unsigned n){
+        sample_every_[static_cast<int>(c)].store(n, std::memory_order_relaxed);
+    }
+
+    static const char* category_name(LogCat c){
+        static const char* names[] = {"bridge", "fwd", "split", "bmwlog"};
+        return names[static_cast<int>(c)];
+    }
+
+    // "error" | "warn" | "info" | "debug" (unknown → info)
+    static LogLevel parse_level(const std::string& s){
+        if (s == "error") return LogLevel::Error;
+        if (s == "warn" || s == "warning") return LogLevel::Warn;
+        if (s == "debug") return LogLevel::Debug;
+        return LogLevel::Info;
+    }
+
+    // "fwd:100,split:0" → sampling per category; unknown names are ignored
+    void parse_sampling(const std::string& spec){
+        size_t i = 0;
+        while (i < spec.size()) {
+            size_t comma = spec.find(',', i);
+            if (comma == std::string::npos) comma = spec.size();
+            std::string item = spec.substr(i, comma - i);
+            size_t colon = item.find(':');
+            if (colon != std::string::npos) {
+                std::string name = item.substr(0, colon);
+                unsigned n = static_cast<unsigned>(std::strtoul(item.c_str() + colon + 1, nullptr, 10));
+                for (int c = 0; c < static_cast<int>(LogCat::Count); ++c) {
+                    if (name == category_name(static_cast<LogCat>(c))) set_sampling(static_cast<LogCat>(c), n);
+                }
+            }
+            i = comma + 1;
+        }
+    }
+
+    // ---- producer side (any thread) ----
+    bool enabled(LogLevel l, LogCat c) const {
+        return static_cast<int>(l) <= level_.load(std::memory_order_relaxed) &&
+               sample_every_[static_cast<int>(c)].load(std::memory_order_relaxed) != 0;
+    }
+
+    __attribute__((format(printf, 4, 5)))
+    void write(LogLevel l, LogCat c, const char* fmt, ...){
+        if (!enabled(l, c)) return;
+
+        // sampling: errors/warnings are never sampled away
+        const unsigned every = sample_every_[static_cast<int>(c)].load(std::memory_order_relaxed);
+        if (every > 1 && l > LogLevel::Warn) {
+            unsigned long n = seen_[static_cast<int>(c)].fetch_add(1, std::memory_order_relaxed);
+            if (n % every != 0) return;
+        }
+
+        Slot* s = acquire_slot();
+        if (!s) { dropped_.fetch_add(1, std::memory_order_relaxed); return; }
+
+        va_list ap;
+        va_start(ap, fmt);
+        int n = std::vsnprintf(s->text, LINE_BYTES - 1, fmt, ap);
+        va_end(ap);
+        size_t len = n < 0 ? 0 : (static_cast<size_t>(n) >= LINE_BYTES - 1 ? LINE_BYTES - 2 : static_cast<size_t>(n));
+        s->text[len++] = '\n';
+        s->len = static_cast<uint16_t>(len);
+        publish_slot(s);
+
+        // wake the flusher only if it is parked (Dekker pairing with run())
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (idle_.load(std::memory_order_relaxed)) {
+            { std::lock_guard<std::mutex> lk(mu_); }
+            cv_.notify_one();
+        }
+    }
+
+    // ---- flusher ----
+    void start(){
+        if (th_.joinable()) return;
+        running_ = true;
+        th_ = std::thread([this]{ run(); });
+    }
+
+    void stop(){
+        if (!th_.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            running_ = false;
+        }
+        cv_.notify_one();
+        th_.join();
+        drain(); // whatever came in after the last pass
+    }
+
+    // wait until everything logged so far has been written (bench / shutdown)
+    void flush(){
+        if (!th_.joinable()) { drain(); return; }
+        const size_t target = head_.load(std::memory_order_acquire);
+        cv_.notify_one();
+        while (written_.load(std::memory_order_acquire) < target)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    unsigned long long dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    struct Slot {
+        std::atomic<size_t> seq{0};
+        size_t   seq_pos = 0;   // ring position claimed by the writer
+        uint16_t len = 0;
+        char text[LINE_BYTES];
+    };
+
+    Slot* acquire_slot(){
+        size_t pos = head_.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& s = slots_[pos & mask_];
+            const size_t seq = s.seq.load(std::memory_order_acquire);
+            const intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (dif == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    s.seq_pos = pos;
+                    return &s;
+                }
+            } else if (dif < 0) {
+                return nullptr; // full
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void publish_slot(Slot* s){
+        s->seq.store(s->seq_pos + 1, std::memory_order_release);
+    }
+
+    // single consumer: copy ready lines into buf, one write() per batch
+    void drain(){
+        char buf[16 * 1024];
+        for (;;) {
+            size_t used = 0;
+            while (used + LINE_BYTES <= sizeof(buf)) {
+                Slot& s = slots_[tail_ & mask_];
+                if (s.seq.load(std::memory_order_acquire) != tail_ + 1) break;
+                std::memcpy(buf + used, s.text, s.len);
+                used += s.len;
+                s.seq.store(tail_ + mask_ + 1, std::memory_order_release);
+                ++tail_;
+            }
+            if (used == 0) break;
+            write_all(buf, used);
+            written_.store(tail_, std::memory_order_release);
+        }
+        const unsigned long long d = dropped_.load(std::memory_order_relaxed);
+        if (d != reported_dropped_) {
+            char line[96];
+            int n = std::snprintf(line, sizeof(line), "[log] %llu line(s) dropped (ring full)\n",
+                                  d - reported_dropped_);
+            if (n > 0) write_all(line, static_cast<size_t>(n));
+            reported_dropped_ = d;
+        }
+    }
+
+    void write_all(const char* p, size_t n){
+        while (n > 0) {
+            ssize_t w = ::write(fd_, p, n);
+            if (w < 0) { if (errno == EINTR) continue; return; }
+            p += w; n -= static_cast<size_t>(w);
+        }
+    }
+
+    bool ready() const {
+        return slots_[tail_ & mask_].seq.load(std::memory_order_acquire) == tail_ + 1;
+    }
+
+    void run(){
+        std::unique_lock<std::mutex> lk(mu_);
+        while (running_) {
+            lk.unlock();
+            drain();
+            lk.lock();
+            if (!running_) break;
+
+            // park until a producer wakes us; re-check after announcing so a
+            // line published in between is not left waiting
+            idle_.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!ready()) cv_.wait_for(lk, std::chrono::seconds(5));
+            idle_.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    std::unique_ptr<Slot[]> slots_;
+    size_t mask_ = 0;
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) size_t tail_ = 0;               // flusher only
+    std::atomic<size_t> written_{0};
+    unsigned long long reported_dropped_ = 0;   // flusher only
+
+    std::atomic<int> level_{static_cast<int>(LogLevel::Info)};
+    std::atomic<unsigned> sample_every_[static_cast<int>(LogCat::Count)];
+    std::atomic<unsigned long> seen_[static_cast<int>(LogCat::Count)] = {};
+    std::atomic<unsigned long long> dropped_{0};
+
+    int fd_;
+    std::thread th_;
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::atomic<bool> idle_{false};
+    bool running_ = false;
+};
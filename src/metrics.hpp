@@ -0,0 +1,162 @@
+// metrics.hpp
+//
+// Lock-free counters/histograms and an OpenMetrics text writer.
+//
+// Hot-path updates are single relaxed atomic adds; rendering reads the
+// atomics without stopping writers (values may be a few events apart, which
+// is fine for scraping).
+//
+//   metrics::Counter      – monotonically increasing value
+//   metrics::CodeCounter  – one counter per small integer code (rc, reason code)
+//   metrics::Histogram    – fixed upper bounds, cumulative buckets on output
+//   metrics::Writer       – builds the text exposition (ends with "# EOF")
+//
+// Copyright (c) 2025 Kurt, DJ0ABR – MIT License (see bmw_mqtt_bridge.cpp)
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace metrics {
+
+class Counter {
+public:
+    void inc(uint64_t n = 1){ v_.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t value() const { return v_.load(std::memory_order_relaxed); }
+private:
+    std::atomic<uint64_t> v_{0};
+};
+
+// Counts per code in [0, 255]; anything else is folded into 256 ("other").
+class CodeCounter {
+public:
+    static constexpr int SLOTS = 257;
+    void inc(int code){
+        const int i = (code >= 0 && code < SLOTS - 1) ? code : SLOTS - 1;
+        v_[i].fetch_add(1, std::memory_order_relaxed);
+    }
+    uint64_t value(int slot) const { return v_[slot].load(std::memory_order_relaxed); }
+private:
+    std::atomic<uint64_t> v_[SLOTS] = {};
+};
+
+class Histogram {
+public:
+    Histogram(std::initializer_list<double> bounds) : bounds_(bounds),
+        counts_(new std::atomic<uint64_t>[bounds.size() + 1]) {
+        for (size_t i = 0; i <= bounds_.size(); ++i) counts_[i].store(0, std::memory_order_relaxed);
+    }
+
+    void observe(double v){
+        size_t i = 0;
+        while (i < bounds_.size() && v > bounds_[i]) ++i;
+        counts_[i].fetch_add(1, std::memory_order_relaxed);
+        // sum kept in nanounits to stay a lock-free integer add
+        sum_nano_.fetch_add(static_cast<uint64_t>(v * 1e9), std::memory_order_relaxed);
+    }
+
+    const std::vector<double>& bounds() const { return bounds_; }
+    uint64_t bucket(size_t i) const { return counts_[i].load(std::memory_order_relaxed); }
+    double   sum() const { return static_cast<double>(sum_nano_.load(std::memory_order_relaxed)) / 1e9; }
+
+private:
+    std::vector<double> bounds_;
+    std::unique_ptr<std::atomic<uint64_t>[]> counts_;
+    std::atomic<uint64_t> sum_nano_{0};
+};
+
+class Writer {
+public:
+    // name without "_total"; labels like `rc="4"` (may be empty)
+    void counter(const char* name, const char* help, uint64_t v, const std::string& labels = {}){
+        meta(name, "counter", help);
+        out_ += name;
+        out_ += "_total";
+        label_block(labels);
+        out_ += ' ';
+        out_ += std::to_string(v);
+        out_ += '\n';
+    }
+
+    // several label sets of one counter family, e.g. per return code
+    void counter_family(const char* name, const char* help,
+                        const std::vector<std::pair<std::string, uint64_t>>& samples){
+        meta(name, "counter", help);
+        for (auto& s : samples) {
+            out_ += name;
+            out_ += "_total";
+            label_block(s.first);
+            out_ += ' ';
+            out_ += std::to_string(s.second);
+            out_ += '\n';
+        }
+    }
+
+    // all non-zero codes of a CodeCounter as {label="code"}
+    void code_counter(const char* name, const char* help, const char* label, const CodeCounter& c){
+        std::vector<std::pair<std::string, uint64_t>> samples;
+        for (int i = 0; i < CodeCounter::SLOTS; ++i) {
+            uint64_t v = c.value(i);
+            if (!v) continue;
+            std::string code = (i == CodeCounter::SLOTS - 1) ? std::string("other") : std::to_string(i);
+            samples.emplace_back(std::string(label) + "=\"" + code + "\"", v);
+        }
+        counter_family(name, help, samples);
+    }
+
+    void gauge(const char* name, const char* help, double v){
+        meta(name, "gauge", help);
+        out_ += name;
+        out_ += ' ';
+        out_ += number(v);
+        out_ += '\n';
+    }
+
+    void histogram(const char* name, const char* help, const Histogram& h){
+        meta(name, "histogram", help);
+        uint64_t cum = 0;
+        const auto& b = h.bounds();
+        for (size_t i = 0; i <= b.size(); ++i) {
+            cum += h.bucket(i);
+            out_ += name;
+            out_ += "_bucket{le=\"";
+            out_ += (i < b.size()) ? number(b[i]) : std::string("+Inf");
+            out_ += "\"} ";
+            out_ += std::to_string(cum);
+            out_ += '\n';
+        }
+        out_ += name; out_ += "_count "; out_ += std::to_string(cum); out_ += '\n';
+        out_ += name; out_ += "_sum ";   out_ += number(h.sum());     out_ += '\n';
+    }
+
+    std::string finish(){ out_ += "# EOF\n"; return std::move(out_); }
+
+    static constexpr const char* CONTENT_TYPE =
+        "application/openmetrics-text; version=1.0.0; charset=utf-8";
+
+private:
+    void meta(const char* name, const char* type, const char* help){
+        out_ += "# TYPE "; out_ += name; out_ += ' '; out_ += type; out_ += '\n';
+        out_ += "# HELP "; out_ += name; out_ += ' '; out_ += help; out_ += '\n';
+    }
+    void label_block(const std::string& labels){
+        if (labels.empty()) return;
+        out_ += '{'; out_ += labels; out_ += '}';
+    }
+    static std::string number(double v){
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "%.9g", v);
+        return buf;
+    }
+
+    std::string out_;
+};
+
+} // namespace metrics
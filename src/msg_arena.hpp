@@ -0,0 +1,145 @@
+// msg_arena.hpp
+//
+// Per-message monotonic arena for short-lived DOMs (payload re-encoding, the
+// DOM split fallback): allocation is a pointer bump, deallocation a no-op,
+// and everything is released at once when the message is done. After the
+// first few messages the blocks are reused, so the global heap is not touched.
+//
+//   msg_arena::Scope        marks the thread's arena; its destructor rewinds to
+//                           the mark (scopes nest: an inner one frees only its own)
+//   msg_arena::Allocator<T> allocates from the thread's arena while a Scope is
+//                           open, from the heap otherwise
+//
+//   msg_arena::string       std::basic_string on that allocator
+//
+//   using arena_json = nlohmann::basic_json<std::map, std::vector, msg_arena::string, bool,
+//                                           std::int64_t, std::uint64_t, double,
+//                                           msg_arena::Allocator>;
+//
+// Notes:
+//   - One arena per thread (thread_local); nothing here is shared.
+//   - Objects allocated inside a Scope must be destroyed before it closes –
+//     declare the Scope first. Results that outlive it go into caller-owned
+//     buffers (e.g. a reused std::string).
+//   - deallocate() recognizes arena memory by address, so heap objects may
+//     still be freed while a Scope is open.
+//   - Blocks are kept for the next message; a very large message adds a block
+//     that stays (bounded by the largest message seen).
+//
+// Copyright (c) 2025 Kurt, DJ0ABR – MIT License (see bmw_mqtt_bridge.cpp)
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace msg_arena {
+
+class Arena {
+public:
+    static constexpr size_t BLOCK = 16 * 1024;
+
+    struct Mark {
+        size_t block = 0;
+        size_t used = 0;
+    };
+
+    void* allocate(size_t n, size_t align){
+        for (;;) {
+            if (cur_ < blocks_.size()) {
+                Block& b = blocks_[cur_];
+                const size_t at = (used_ + align - 1) & ~(align - 1);
+                if (at + n <= b.size) {
+                    used_ = at + n;
+                    return b.data.get() + at;
+                }
+                if (cur_ + 1 < blocks_.size() && n <= blocks_[cur_ + 1].size) {
+                    ++cur_;
+                    used_ = 0;
+                    continue;
+                }
+            }
+            // next block: at least BLOCK, big enough for n; inserted after the current one
+            const size_t size = std::max(BLOCK, n + align);
+            const size_t pos = blocks_.empty() ? 0 : cur_ + 1;
+            blocks_.insert(blocks_.begin() + static_cast<std::ptrdiff_t>(pos),
+                           Block{std::unique_ptr<char[]>(new char[size]), size});
+            cur_ = pos;
+            used_ = 0;
+        }
+    }
+
+    bool owns(const void* p) const {
+        const char* c = static_cast<const char*>(p);
+        for (const Block& b : blocks_)
+            if (c >= b.data.get() && c < b.data.get() + b.size) return true;
+        return false;
+    }
+
+    Mark mark() const { return {cur_, used_}; }
+    void rewind(Mark m){ cur_ = m.block; used_ = m.used; }
+
+    int    depth = 0;   // open Scopes
+    size_t blocks() const { return blocks_.size(); }
+    size_t capacity() const { size_t n = 0; for (const Block& b : blocks_) n += b.size; return n; }
+
+private:
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    std::vector<Block> blocks_;
+    size_t cur_ = 0;        // block being filled
+    size_t used_ = 0;       // bytes used in it
+};
+
+inline Arena& thread_arena(){
+    thread_local Arena a;
+    return a;
+}
+
+class Scope {
+public:
+    Scope() : mark_(thread_arena().mark()) { ++thread_arena().depth; }
+    ~Scope(){
+        Arena& a = thread_arena();
+        --a.depth;
+        a.rewind(mark_);
+    }
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+private:
+    Arena::Mark mark_;
+};
+
+template <typename T>
+struct Allocator {
+    using value_type = T;
+
+    Allocator() noexcept = default;
+    template <typename U> Allocator(const Allocator<U>&) noexcept {}
+
+    T* allocate(size_t n){
+        Arena& a = thread_arena();
+        if (a.depth > 0) return static_cast<T*>(a.allocate(n * sizeof(T), alignof(T)));
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* p, size_t n) noexcept {
+        if (thread_arena().owns(p)) return;   // released with the Scope
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    template <typename U> bool operator==(const Allocator<U>&) const noexcept { return true; }
+    template <typename U> bool operator!=(const Allocator<U>&) const noexcept { return false; }
+};
+
+using string = std::basic_string<char, std::char_traits<char>, Allocator<char>>;
+
+} // namespace msg_arena
@@ -0,0 +1,149 @@
+// outbound_queue.hpp
+//
+// Bounded tracking of QoS 1 publishes to the local broker (LOCAL_QOS=1).
+//
+// libmosquitto keeps QoS 1 messages itself until the broker's PUBACK, sends at
+// most the in-flight window (MOSQ_OPT_SEND_MAXIMUM / max_inflight) at once and
+// queues the rest without limit. OutboundQueue sits in front of it:
+//
+//   - send() publishes only while fewer than max_entries messages / max_bytes
+//     are unacknowledged; otherwise it reports "full" and the caller spools or
+//     drops the message. This bounds the memory of both queues.
+//   - every published message is kept (topic, payload, retain, tag, vin,
+//     timestamp) until its PUBACK, so what is still unacknowledged at shutdown
+//     can go to the spool instead of being lost with the client (drain()).
+//
+// Because libmosquitto sends queued messages later and resends unacknowledged
+// ones after a reconnect, the publish must be self-contained: the bridge sends
+// QoS 1 with the full topic, never with a topic alias of the connection.
+//
+// The publish callback only records the acknowledged mid (acked()); the acks
+// are applied under the queue lock by the next send() or reader. This way a
+// PUBACK that arrives while send() is still inside mosquitto_publish (other
+// thread, or the same one) cannot overtake the message it belongs to.
+//
+// Thread-safe: any thread may send(); acked() is called by the client's
+// network thread.
+//
+// Copyright (c) 2025 Kurt, DJ0ABR – MIT License (see bmw_mqtt_bridge.cpp)
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class OutboundQueue {
+public:
+    struct Message {
+        std::string topic;
+        std::string payload;
+        bool        retain = false;
+        uint8_t     tag = 0;       // opaque (the bridge's payload encoding)
+        std::string vin;           // publish metadata, spooled with the message
+        std::string timestamp;
+    };
+
+    void configure(size_t max_entries, size_t max_bytes){
+        std::lock_guard<std::mutex> lk(mu_);
+        max_entries_ = max_entries ? max_entries : 1;
+        max_bytes_ = max_bytes;
+    }
+
+    // Publish via publish(int* mid) → rc (0 = success) and keep the message
+    // until acked(mid). full = caps reached: nothing was published.
+    template <typename Publish>
+    int send(std::string_view topic, const void* payload, size_t len, bool retain, uint8_t tag,
+             std::string_view vin, std::string_view timestamp, Publish&& publish, bool& full){
+        std::lock_guard<std::mutex> lk(mu_);
+        apply_acks_locked();
+        const size_t need = cost(topic.size() + vin.size() + timestamp.size(), len);
+        full = msgs_.size() >= max_entries_ || (!msgs_.empty() && bytes_ + need > max_bytes_);
+        if (full) { ++full_; return 0; }
+
+        int mid = 0;
+        const int rc = publish(&mid);
+        if (rc != 0) return rc;
+
+        Message& m = msgs_[seq_];
+        m.topic.assign(topic.data(), topic.size());
+        if (len) m.payload.assign(static_cast<const char*>(payload), len);
+        m.retain = retain;
+        m.tag = tag;
+        m.vin.assign(vin.data(), vin.size());
+        m.timestamp.assign(timestamp.data(), timestamp.size());
+        by_mid_[mid] = seq_++;
+        bytes_ += need;
+        if (msgs_.size() > high_water_) high_water_ = msgs_.size();
+        return rc;
+    }
+
+    // PUBACK for mid (publish callback); unknown mids (QoS 0) are ignored later
+    void acked(int mid){
+        std::lock_guard<std::mutex> lk(ack_mu_);
+        acks_.push_back(mid);
+    }
+
+    // Hand every unacknowledged message to f(const Message&), oldest first,
+    // and forget them (shutdown: the caller spools them).
+    template <typename F>
+    size_t drain(F&& f){
+        std::lock_guard<std::mutex> lk(mu_);
+        apply_acks_locked();
+        const size_t n = msgs_.size();
+        for (auto& [seq, m] : msgs_) f(m);
+        msgs_.clear();
+        by_mid_.clear();
+        bytes_ = 0;
+        return n;
+    }
+
+    size_t pending(){ std::lock_guard<std::mutex> lk(mu_); apply_acks_locked(); return msgs_.size(); }
+    size_t bytes(){ std::lock_guard<std::mutex> lk(mu_); apply_acks_locked(); return bytes_; }
+    size_t high_water() const { std::lock_guard<std::mutex> lk(mu_); return high_water_; }
+    unsigned long long acked_total(){ std::lock_guard<std::mutex> lk(mu_); apply_acks_locked(); return acked_; }
+    unsigned long long full_total() const { std::lock_guard<std::mutex> lk(mu_); return full_; }
+
+private:
+    static size_t cost(size_t topic_len, size_t payload_len){ return topic_len + payload_len + 64; }
+
+    void apply_acks_locked(){
+        {
+            std::lock_guard<std::mutex> lk(ack_mu_);
+            if (acks_.empty()) return;
+            acks_taken_.swap(acks_);
+        }
+        for (int mid : acks_taken_) {
+            auto it = by_mid_.find(mid);
+            if (it == by_mid_.end()) continue;
+            auto mit = msgs_.find(it->second);
+            if (mit != msgs_.end()) {
+                const Message& m = mit->second;
+                bytes_ -= cost(m.topic.size() + m.vin.size() + m.timestamp.size(), m.payload.size());
+                msgs_.erase(mit);
+                ++acked_;
+            }
+            by_mid_.erase(it);
+        }
+        acks_taken_.clear();
+    }
+
+    mutable std::mutex mu_;                  // everything below except acks_
+    std::map<uint64_t, Message> msgs_;       // by send order
+    std::unordered_map<int, uint64_t> by_mid_;
+    uint64_t seq_ = 0;
+    size_t   bytes_ = 0;
+    size_t   max_entries_ = 10000;
+    size_t   max_bytes_ = 16u << 20;
+    size_t   high_water_ = 0;
+    unsigned long long acked_ = 0, full_ = 0;
+    std::vector<int> acks_taken_;
+
+    std::mutex ack_mu_;
+    std::vector<int> acks_;                  // PUBACKs not applied yet
+};
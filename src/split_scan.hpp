@@ -0,0 +1,398 @@
+// split_scan.hpp
+//
+// Streaming scanner for the SPLIT_TOPICS path.
+//
+// Walks a CarData payload once, without building a JSON DOM:
+//
+//   { "vin": "<VIN>", ..., "data": { "<prop>": { "value": ..., ... }, ... } }
+//
+// and reports the VIN plus, for every member of "data", the property name and
+// the raw bytes of its value as views into the input buffer. The caller can
+// publish those bytes as-is: no copy of the payload, no DOM nodes and no
+// reserialization via dump(). Keys and the VIN with escapes (rare) are
+// decoded into scanner-owned copies, so "val\u0075e" is "value" as for a
+// JSON parser.
+//
+// The whole document is validated before anything is reported, so a malformed
+// payload publishes nothing (same behaviour as json::parse throwing).
+//
+// Result codes:
+//   Ok        – scan complete, vin/props filled
+//   NoData    – valid JSON, but no "data" object
+//   Malformed – not a valid JSON object
+//   Fallback  – nesting deeper than MAX_DEPTH → use json::parse
+//
+// String bodies (property names, timestamps, text values – most of a CarData
+// payload) are skipped 16 bytes at a time with SSE2 (x86-64) or NEON
+// (AArch64), looking for the next '"', '\\' or control character; other
+// targets, or builds with -DBMW_BRIDGE_NO_SIMD, use the byte loop.
+//
+// Copyright (c) 2025 Kurt, DJ0ABR – MIT License (see bmw_mqtt_bridge.cpp)
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if !defined(BMW_BRIDGE_NO_SIMD) && defined(__SSE2__)
+  #include <emmintrin.h>
+  #define SPLIT_SCAN_SSE2 1
+#elif !defined(BMW_BRIDGE_NO_SIMD) && defined(__ARM_NEON)
+  #include <arm_neon.h>
+  #define SPLIT_SCAN_NEON 1
+#endif
+
+namespace split_scan {
+
+// first byte in [p, end) that ends a plain run of string body: '"', '\\' or
+// a control character (< 0x20); end if there is none
+inline const char* find_string_special(const char* p, const char* end){
+#if defined(SPLIT_SCAN_SSE2)
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i bslash = _mm_set1_epi8('\\');
+    const __m128i ctl = _mm_set1_epi8(0x1f);
+    while (end - p >= 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash)),
+                                         _mm_cmpeq_epi8(_mm_max_epu8(v, ctl), ctl));   // v <= 0x1f
+        const int mask = _mm_movemask_epi8(hit);
+        if (mask) return p + __builtin_ctz(static_cast<unsigned>(mask));
+        p += 16;
+    }
+#elif defined(SPLIT_SCAN_NEON)
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t bslash = vdupq_n_u8('\\');
+    const uint8x16_t ctl = vdupq_n_u8(0x20);
+    while (end - p >= 16) {
+        const uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+        const uint8x16_t hit = vorrq_u8(vorrq_u8(vceqq_u8(v, quote), vceqq_u8(v, bslash)), vcltq_u8(v, ctl));
+        // 4 bits per byte
+        const uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(hit), 4)), 0);
+        if (mask) return p + (__builtin_ctzll(mask) >> 2);
+        p += 16;
+    }
+#endif
+    while (p < end) {
+        const unsigned char c = static_cast<unsigned char>(*p);
+        if (c == '"' || c == '\\' || c < 0x20) return p;
+        ++p;
+    }
+    return end;
+}
+
+enum class Result { Ok, NoData, Malformed, Fallback };
+
+struct Prop {
+    std::string_view name;      // key inside "data" (decoded if it had escapes)
+    std::string_view value;     // raw JSON text of the property's value
+    bool             has_value; // value is an object with a top-level "value" member
+    std::string_view member_value; // raw JSON text of its "value" member (if has_value)
+    std::string_view member_unit;  // raw JSON text of its "unit" member (may be empty)
+    std::string_view member_timestamp; // raw JSON text of its "timestamp" member (may be empty)
+};
+
+class Scanner {
+public:
+    // Scan payload; vin/props views point into payload (decoded names and VIN
+    // into the scanner, valid until the next scan). props is cleared first and
+    // keeps its capacity between calls.
+    Result scan(std::string_view payload, std::string_view& vin, std::vector<Prop>& props){
+        p_ = payload.data();
+        end_ = p_ + payload.size();
+        fallback_ = false;
+        decoded_.clear();
+        vin = {};
+        props.clear();
+        bool have_data = false;
+
+        auto fail = [this]{ return fallback_ ? Result::Fallback : Result::Malformed; };
+
+        skip_ws();
+        if (!eat('{')) return Result::Malformed;
+        skip_ws();
+        if (!eat('}')) {
+            for (;;) {
+                std::string_view key;
+                bool key_esc = false;
+                if (!string(key, key_esc)) return fail();
+                if (key_esc) {
+                    if (!unescape(key, key_buf_)) return Result::Malformed;
+                    key = key_buf_;
+                }
+                skip_ws();
+                if (!eat(':')) return fail();
+                skip_ws();
+
+                if (key == "vin" && peek() == '"') {
+                    bool esc = false;
+                    if (!string(vin, esc)) return fail();
+                    if (esc && !decode(vin)) return Result::Malformed;
+                } else if (key == "data" && peek() == '{') {
+                    if (!data_object(props)) return fail();
+                    have_data = true;
+                } else {
+                    if (!value(0)) return fail();
+                }
+
+                skip_ws();
+                if (eat(',')) { skip_ws(); continue; }
+                if (eat('}')) break;
+                return fail();
+            }
+        }
+        skip_ws();
+        if (p_ != end_) return fail();
+
+        if (fallback_) return Result::Fallback;
+        return have_data ? Result::Ok : Result::NoData;
+    }
+
+private:
+    static constexpr int MAX_DEPTH = 64;
+
+    const char* p_ = nullptr;
+    const char* end_ = nullptr;
+    bool fallback_ = false;
+    std::deque<std::string> decoded_;   // escaped names / VIN of this scan (stable addresses)
+    std::string key_buf_;               // escaped key, compared before its value is scanned
+
+    char peek() const { return p_ < end_ ? *p_ : '\0'; }
+    bool eat(char c){ if (p_ < end_ && *p_ == c) { ++p_; return true; } return false; }
+    void skip_ws(){
+        while (p_ < end_ && (*p_ == ' ' || *p_ == '\t' || *p_ == '\n' || *p_ == '\r')) ++p_;
+    }
+
+    // "data": { "<prop>": <value>, ... }
+    bool data_object(std::vector<Prop>& props){
+        ++p_; // '{'
+        skip_ws();
+        if (eat('}')) return true;
+        for (;;) {
+            Prop pr{};
+            bool esc = false;
+            if (!string(pr.name, esc)) return false;
+            if (esc && !decode(pr.name)) return false;
+            skip_ws();
+            if (!eat(':')) return false;
+            skip_ws();
+
+            const char* begin = p_;
+            if (peek() == '{') {
+                if (!object(1, &pr)) return false;
+            } else {
+                if (!value(1)) return false;
+            }
+            pr.value = std::string_view(begin, static_cast<size_t>(p_ - begin));
+            props.push_back(pr);
+
+            skip_ws();
+            if (eat(',')) { skip_ws(); continue; }
+            return eat('}');
+        }
+    }
+
+    bool value(int depth){
+        switch (peek()) {
+        case '{': return object(depth, nullptr);
+        case '[': return array(depth);
+        case '"': { std::string_view s; bool esc; return string(s, esc); }
+        case 't': return literal("true");
+        case 'f': return literal("false");
+        case 'n': return literal("null");
+        default:  return number();
+        }
+    }
+
+    // object; if prop != nullptr, report its "value", "unit" and "timestamp" members
+    bool object(int depth, Prop* prop){
+        if (++depth > MAX_DEPTH) { fallback_ = true; return false; }
+        ++p_; // '{'
+        skip_ws();
+        if (eat('}')) return true;
+        for (;;) {
+            std::string_view key;
+            bool esc = false;
+            if (!string(key, esc)) return false;
+            enum { Other, Value, Unit, Timestamp } member = Other;   // decided before value() reuses key_buf_
+            if (prop) {
+                if (esc) {
+                    if (!unescape(key, key_buf_)) return false;
+                    key = key_buf_;
+                }
+                member = key == "value" ? Value : key == "unit" ? Unit : key == "timestamp" ? Timestamp : Other;
+            }
+            skip_ws();
+            if (!eat(':')) return false;
+            skip_ws();
+            const char* vbegin = p_;
+            if (!value(depth)) return false;
+            const std::string_view v(vbegin, static_cast<size_t>(p_ - vbegin));
+            switch (member) {
+            case Value:     prop->has_value = true; prop->member_value = v; break;
+            case Unit:      prop->member_unit = v; break;
+            case Timestamp: prop->member_timestamp = v; break;
+            case Other:     break;
+            }
+            skip_ws();
+            if (eat(',')) { skip_ws(); continue; }
+            return eat('}');
+        }
+    }
+
+    bool array(int depth){
+        if (++depth > MAX_DEPTH) { fallback_ = true; return false; }
+        ++p_; // '['
+        skip_ws();
+        if (eat(']')) return true;
+        for (;;) {
+            if (!value(depth)) return false;
+            skip_ws();
+            if (eat(',')) { skip_ws(); continue; }
+            return eat(']');
+        }
+    }
+
+    // string body between quotes (escapes validated, not decoded)
+    bool string(std::string_view& out, bool& has_escape){
+        has_escape = false;
+        if (!eat('"')) return false;
+        const char* begin = p_;
+        while (p_ < end_) {
+            p_ = find_string_special(p_, end_);
+            if (p_ == end_) break;
+            const unsigned char c = static_cast<unsigned char>(*p_);
+            if (c == '"') {
+                out = std::string_view(begin, static_cast<size_t>(p_ - begin));
+                ++p_;
+                return true;
+            }
+            if (c < 0x20) return false;
+            if (c == '\\') {
+                has_escape = true;
+                if (++p_ >= end_) return false;
+                switch (*p_) {
+                case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+                    break;
+                case 'u':
+                    for (int i = 0; i < 4; ++i) {
+                        if (++p_ >= end_ || !is_hex(*p_)) return false;
+                    }
+                    break;
+                default:
+                    return false;
+                }
+            }
+            ++p_;
+        }
+        return false;
+    }
+
+    // replace s (escaped string body) by a decoded copy owned by the scanner
+    bool decode(std::string_view& s){
+        decoded_.emplace_back();
+        if (!unescape(s, decoded_.back())) return false;
+        s = decoded_.back();
+        return true;
+    }
+
+    // string body validated by string() → UTF-8; false for unpaired surrogates
+    // (json::parse rejects those as well)
+    static bool unescape(std::string_view in, std::string& out){
+        out.clear();
+        for (size_t i = 0; i < in.size(); ++i) {
+            if (in[i] != '\\') { out.push_back(in[i]); continue; }
+            const char c = in[++i];
+            switch (c) {
+            case 'b': out.push_back('\b'); break;
+            case 'f': out.push_back('\f'); break;
+            case 'n': out.push_back('\n'); break;
+            case 'r': out.push_back('\r'); break;
+            case 't': out.push_back('\t'); break;
+            case 'u': {
+                uint32_t cp = hex4(in.data() + i + 1);
+                i += 4;
+                if (cp >= 0xD800 && cp <= 0xDBFF) {
+                    if (i + 6 >= in.size() || in[i + 1] != '\\' || in[i + 2] != 'u') return false;
+                    const uint32_t lo = hex4(in.data() + i + 3);
+                    if (lo < 0xDC00 || lo > 0xDFFF) return false;
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                    i += 6;
+                } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+                    return false;
+                }
+                append_utf8(out, cp);
+                break;
+            }
+            default: out.push_back(c); break;   // '"', '\\', '/'
+            }
+        }
+        return true;
+    }
+
+    static uint32_t hex4(const char* p){
+        uint32_t v = 0;
+        for (int i = 0; i < 4; ++i) {
+            const char c = p[i];
+            v = v * 16 + static_cast<uint32_t>(c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+        }
+        return v;
+    }
+
+    static void append_utf8(std::string& out, uint32_t cp){
+        if (cp < 0x80) {
+            out.push_back(static_cast<char>(cp));
+        } else if (cp < 0x800) {
+            out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else if (cp < 0x10000) {
+            out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else {
+            out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        }
+    }
+
+    bool literal(std::string_view lit){
+        if (static_cast<size_t>(end_ - p_) < lit.size()) return false;
+        if (std::string_view(p_, lit.size()) != lit) return false;
+        p_ += lit.size();
+        return true;
+    }
+
+    bool number(){
+        const char* start = p_;
+        eat('-');
+        if (eat('0')) {
+            // no leading zeros
+        } else {
+            if (!is_digit(peek())) return false;
+            while (is_digit(peek())) ++p_;
+        }
+        if (eat('.')) {
+            if (!is_digit(peek())) return false;
+            while (is_digit(peek())) ++p_;
+        }
+        if (peek() == 'e' || peek() == 'E') {
+            ++p_;
+            if (peek() == '+' || peek() == '-') ++p_;
+            if (!is_digit(peek())) return false;
+            while (is_digit(peek())) ++p_;
+        }
+        return p_ > start;
+    }
+
+    static bool is_digit(char c){ return c >= '0' && c <= '9'; }
+    static bool is_hex(char c){
+        return is_digit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+    }
+};
+
+} // namespace split_scan
@@ -0,0 +1,407 @@
+// spool.hpp
+//
+// Persistent, bounded message spool (memory-mapped file).
+//
+// Holds messages that could not be published to the local broker so they can
+// be replayed in order once it is reachable again. The file is a fixed-size
+// ring of append-only records; the read/write positions live in a small header
+// at the start of the mapping, so the spool survives a restart of the bridge.
+//
+//   file:   [ header (64 bytes) ][ data area: records ... ]
+//   record: [ RecHdr (24 bytes) ][ topic ][ vin ][ timestamp ][ payload ]  padded to 8 bytes
+//
+// vin and timestamp are the publish metadata (MQTT v5 user properties), kept
+// so a replayed message looks like the live one; either may be empty.
+//
+// Every record carries a CRC32 over flags, lengths, topic, metadata and payload. A record
+// that fails the check (torn write, foreign file) discards the spool contents
+// instead of replaying garbage. When the spool is full the oldest records are
+// evicted (newer vehicle data is worth more than older data).
+//
+// Writes land in the page cache, so a crash or restart of the process loses
+// nothing; on power loss the last few seconds (kernel writeback) may be lost.
+//
+// Thread-safe: append() and replay() serialize on an internal mutex; empty()
+// is lock-free so the common "nothing spooled" case costs one atomic load.
+//
+// Copyright (c) 2025 Kurt, DJ0ABR – MIT License (see bmw_mqtt_bridge.cpp)
+
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class Spool {
+public:
+    Spool() = default;
+    ~Spool(){ close(); }
+
+    Spool(const Spool&) = delete;
+    Spool& operator=(const Spool&) = delete;
+
+    // Map (and create if needed) a spool file of max_bytes. An existing valid
+    // spool keeps its contents; if it was created with another size it is
+    // resized (see resized_from()), dropping the oldest records that no longer
+    // fit. Anything else is reinitialized.
+    bool open(const std::string& path, size_t max_bytes, std::string& err){
+        close();
+        if (max_bytes < HEADER_BYTES + 4096) max_bytes = HEADER_BYTES + 4096;
+        max_bytes &= ~static_cast<size_t>(7);
+
+        fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (fd_ < 0) { err = std::strerror(errno); return false; }
+
+        struct stat st{};
+        if (::fstat(fd_, &st) != 0) { err = std::strerror(errno); close(); return false; }
+
+        size_t size = static_cast<size_t>(st.st_size);
+        bool reuse = size >= HEADER_BYTES + 4096 && valid_header_on_disk(size);
+        if (!reuse) {
+            size = max_bytes;
+            if (::ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+                err = std::strerror(errno);
+                close();
+                return false;
+            }
+        }
+
+        void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (p == MAP_FAILED) { err = std::strerror(errno); close(); return false; }
+        base_ = static_cast<uint8_t*>(p);
+        map_size_ = size;
+        hdr_ = reinterpret_cast<Header*>(base_);
+        data_ = base_ + HEADER_BYTES;
+
+        if (!reuse) init_header(size - HEADER_BYTES);
+        records_.store(hdr_->records, std::memory_order_release);
+        resized_from_ = 0;
+        if (reuse && size != max_bytes) {
+            const uint64_t old_data_size = hdr_->data_size;
+            if (!resize(max_bytes, err)) { close(); return false; }
+            resized_from_ = old_data_size;
+        }
+        return true;
+    }
+
+    void close(){
+        if (base_) {
+            ::msync(base_, map_size_, MS_SYNC);
+            ::munmap(base_, map_size_);
+        }
+        if (fd_ >= 0) ::close(fd_);
+        base_ = nullptr;
+        hdr_ = nullptr;
+        data_ = nullptr;
+        map_size_ = 0;
+        fd_ = -1;
+        records_.store(0, std::memory_order_release);
+    }
+
+    bool is_open() const { return base_ != nullptr; }
+    bool empty() const { return records_.load(std::memory_order_acquire) == 0; }
+
+    // Append one message; evicts the oldest records if needed. tag is an
+    // opaque byte handed back by replay() (the bridge stores the payload
+    // encoding there), vin/timestamp likewise (longer than 64 KiB: dropped).
+    // false only if the record is larger than the whole spool.
+    bool append(std::string_view topic, const void* payload, size_t payloadlen, bool retain,
+                uint8_t tag = 0, std::string_view vin = {}, std::string_view timestamp = {}){
+        std::lock_guard<std::mutex> lk(mu_);
+        if (!base_) return false;
+
+        if (vin.size() > 0xFFFF) vin = {};
+        if (timestamp.size() > 0xFFFF) timestamp = {};
+        const uint32_t meta_len = static_cast<uint32_t>(vin.size()) | (static_cast<uint32_t>(timestamp.size()) << 16);
+        const uint64_t need = record_size(topic.size(), meta_len, payloadlen);
+        if (need > hdr_->data_size) return false;
+
+        if (hdr_->records == 0) reset_locked();
+
+        // record would run past the end → wrap, the tail gap counts as used
+        bool wrap = hdr_->write_pos + need > hdr_->data_size;
+        uint64_t gap = wrap ? hdr_->data_size - hdr_->write_pos : 0;
+        while (hdr_->used + gap + need > hdr_->data_size) {
+            evict_oldest_locked();
+            if (hdr_->records == 0) {
+                reset_locked();
+                wrap = false;
+                gap = 0;
+            }
+        }
+
+        if (wrap) {
+            if (gap >= sizeof(RecHdr)) {
+                RecHdr w{};
+                w.magic = WRAP_MAGIC;
+                std::memcpy(data_ + hdr_->write_pos, &w, sizeof(w));
+            }
+            hdr_->used += gap;
+            hdr_->write_pos = 0;
+        }
+
+        uint8_t* dst = data_ + hdr_->write_pos;
+        RecHdr h{};
+        h.magic       = REC_MAGIC;
+        h.topic_len   = static_cast<uint32_t>(topic.size());
+        h.payload_len = static_cast<uint32_t>(payloadlen);
+        h.flags       = (retain ? FLAG_RETAIN : 0) | (static_cast<uint32_t>(tag) << TAG_SHIFT);
+        h.meta_len    = meta_len;
+        uint8_t* body = dst + sizeof(RecHdr);
+        std::memcpy(body, topic.data(), topic.size());
+        body += topic.size();
+        if (!vin.empty()) std::memcpy(body, vin.data(), vin.size());
+        body += vin.size();
+        if (!timestamp.empty()) std::memcpy(body, timestamp.data(), timestamp.size());
+        body += timestamp.size();
+        if (payloadlen) std::memcpy(body, payload, payloadlen);
+        h.crc = record_crc(h, dst + sizeof(RecHdr));
+        std::memcpy(dst, &h, sizeof(h));
+
+        // header last: a record only counts once it is complete
+        hdr_->write_pos += need;
+        hdr_->used      += need;
+        hdr_->records   += 1;
+        records_.store(hdr_->records, std::memory_order_release);
+        return true;
+    }
+
+    // Replay up to max records, oldest first. publish(topic, payload, len, retain,
+    // tag, vin, timestamp) returns false to stop (record stays spooled). The lock
+    // is held across the publish so a concurrent writer cannot overtake the
+    // record being replayed; vin/timestamp point into the mapping until then.
+    template <typename F>
+    size_t replay(size_t max, F&& publish){
+        std::lock_guard<std::mutex> lk(mu_);
+        size_t n = 0;
+        while (base_ && n < max && hdr_->records > 0) {
+            const uint8_t* rec = front_locked();
+            if (!rec) break;
+            RecHdr h;
+            std::memcpy(&h, rec, sizeof(h));
+            const char* body = reinterpret_cast<const char*>(rec + sizeof(RecHdr));
+            topic_buf_.assign(body, h.topic_len);
+            body += h.topic_len;
+            const std::string_view vin(body, vin_len(h));
+            body += vin.size();
+            const std::string_view timestamp(body, timestamp_len(h));
+            body += timestamp.size();
+            if (!publish(topic_buf_, body, static_cast<size_t>(h.payload_len), (h.flags & FLAG_RETAIN) != 0,
+                         static_cast<uint8_t>(h.flags >> TAG_SHIFT), vin, timestamp))
+                break;
+            pop_locked(record_size(h.topic_len, h.meta_len, h.payload_len));
+            ++n;
+        }
+        return n;
+    }
+
+    // ---- statistics ----
+    uint64_t records() const { return records_.load(std::memory_order_relaxed); }
+    uint64_t bytes_used() const { std::lock_guard<std::mutex> lk(mu_); return hdr_ ? hdr_->used : 0; }
+    uint64_t capacity() const { return hdr_ ? hdr_->data_size : 0; }
+    unsigned long long evicted() const { return evicted_.load(std::memory_order_relaxed); }
+    unsigned long long corrupt() const { return corrupt_.load(std::memory_order_relaxed); }
+    // data area size before open() resized an existing spool; 0 = not resized
+    uint64_t resized_from() const { return resized_from_; }
+
+private:
+    static constexpr size_t   HEADER_BYTES = 64;
+    static constexpr uint32_t VERSION    = 2;   // 2: records carry vin/timestamp
+    static constexpr uint32_t REC_MAGIC  = 0x43525053; // "SPRC"
+    static constexpr uint32_t WRAP_MAGIC = 0x52575053; // "SPWR"
+    static constexpr uint32_t FLAG_RETAIN = 1;
+    static constexpr int      TAG_SHIFT  = 8;   // flags bits 8..15: append() tag
+
+    struct Header {
+        char     magic[8];      // "BMWSPOOL"
+        uint32_t version;
+        uint32_t header_bytes;
+        uint64_t data_size;     // bytes in the data area
+        uint64_t read_pos;      // oldest record (offset into data area)
+        uint64_t write_pos;     // next record
+        uint64_t used;          // bytes from read_pos to write_pos, incl. wrap gap
+        uint64_t records;
+    };
+    static_assert(sizeof(Header) <= HEADER_BYTES, "spool header too large");
+
+    struct RecHdr {
+        uint32_t magic;
+        uint32_t crc;           // over lengths, flags, topic, metadata, payload
+        uint32_t topic_len;
+        uint32_t payload_len;
+        uint32_t flags;
+        uint32_t meta_len;      // bits 0..15: vin, 16..31: timestamp
+    };
+
+    static size_t vin_len(const RecHdr& h){ return h.meta_len & 0xFFFF; }
+    static size_t timestamp_len(const RecHdr& h){ return h.meta_len >> 16; }
+
+    static uint64_t record_size(size_t topic_len, uint32_t meta_len, size_t payload_len){
+        const size_t meta = (meta_len & 0xFFFF) + (meta_len >> 16);
+        return (sizeof(RecHdr) + topic_len + meta + payload_len + 7) & ~static_cast<uint64_t>(7);
+    }
+    static uint64_t record_size(const RecHdr& h){ return record_size(h.topic_len, h.meta_len, h.payload_len); }
+
+    static uint32_t crc32(uint32_t crc, const void* data, size_t len){
+        static const auto table = []{
+            struct T { uint32_t v[256]; } t{};
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                t.v[i] = c;
+            }
+            return t;
+        }();
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        crc = ~crc;
+        while (len--) crc = table.v[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    static uint32_t record_crc(const RecHdr& h, const uint8_t* body){
+        uint32_t c = crc32(0, &h.topic_len,
+                           sizeof(h.topic_len) + sizeof(h.payload_len) + sizeof(h.flags) + sizeof(h.meta_len));
+        return crc32(c, body, static_cast<size_t>(h.topic_len) + vin_len(h) + timestamp_len(h) + h.payload_len);
+    }
+
+    bool valid_header_on_disk(size_t file_size) const {
+        Header h{};
+        if (::pread(fd_, &h, sizeof(h), 0) != static_cast<ssize_t>(sizeof(h))) return false;
+        if (std::memcmp(h.magic, "BMWSPOOL", 8) != 0 || h.version != VERSION ||
+            h.header_bytes != HEADER_BYTES || h.data_size != file_size - HEADER_BYTES)
+            return false;
+        return h.read_pos <= h.data_size && h.write_pos <= h.data_size && h.used <= h.data_size &&
+               (h.records > 0 || h.used == 0);
+    }
+
+    void init_header(uint64_t data_size){
+        std::memset(hdr_, 0, HEADER_BYTES);
+        std::memcpy(hdr_->magic, "BMWSPOOL", 8);
+        hdr_->version      = VERSION;
+        hdr_->header_bytes = HEADER_BYTES;
+        hdr_->data_size    = data_size;
+    }
+
+    void reset_locked(){
+        hdr_->read_pos = hdr_->write_pos = hdr_->used = hdr_->records = 0;
+        records_.store(0, std::memory_order_release);
+    }
+
+    // skip a wrap marker / too-short tail at read_pos
+    void skip_wrap_locked(){
+        const uint64_t gap = hdr_->data_size - hdr_->read_pos;
+        uint32_t magic = 0;
+        if (gap >= sizeof(RecHdr)) std::memcpy(&magic, data_ + hdr_->read_pos, sizeof(magic));
+        if (gap < sizeof(RecHdr) || magic == WRAP_MAGIC) {
+            hdr_->used -= gap < hdr_->used ? gap : hdr_->used;
+            hdr_->read_pos = 0;
+        }
+    }
+
+    // oldest record after CRC check, or nullptr (spool discarded if corrupt)
+    const uint8_t* front_locked(){
+        skip_wrap_locked();
+        const uint8_t* rec = data_ + hdr_->read_pos;
+        RecHdr h;
+        std::memcpy(&h, rec, sizeof(h));
+        const uint64_t room = hdr_->data_size - hdr_->read_pos;
+        if (h.magic != REC_MAGIC ||
+            record_size(h) > room ||
+            record_crc(h, rec + sizeof(RecHdr)) != h.crc) {
+            corrupt_.fetch_add(hdr_->records, std::memory_order_relaxed);
+            reset_locked();
+            return nullptr;
+        }
+        return rec;
+    }
+
+    void pop_locked(uint64_t size){
+        hdr_->read_pos += size;
+        hdr_->used     -= size;
+        hdr_->records  -= 1;
+        if (hdr_->records == 0) reset_locked();
+        else records_.store(hdr_->records, std::memory_order_release);
+    }
+
+    void evict_oldest_locked(){
+        const uint8_t* rec = front_locked();
+        if (!rec) return;
+        RecHdr h;
+        std::memcpy(&h, rec, sizeof(h));
+        pop_locked(record_size(h));
+        evicted_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Remap at new_size and move the records over, oldest first; the oldest
+    // ones are evicted if they do not fit any more. Only called from open().
+    bool resize(size_t new_size, std::string& err){
+        std::vector<uint8_t> recs;   // valid records, back to back
+        std::vector<uint64_t> sizes;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            recs.reserve(static_cast<size_t>(hdr_->used));
+            while (hdr_->records > 0) {
+                const uint8_t* rec = front_locked();
+                if (!rec) break;
+                RecHdr h;
+                std::memcpy(&h, rec, sizeof(h));
+                const uint64_t n = record_size(h);
+                recs.insert(recs.end(), rec, rec + n);
+                sizes.push_back(n);
+                pop_locked(n);
+            }
+        }
+
+        ::munmap(base_, map_size_);
+        base_ = nullptr;
+        hdr_ = nullptr;
+        data_ = nullptr;
+        map_size_ = 0;
+        if (::ftruncate(fd_, static_cast<off_t>(new_size)) != 0) { err = std::strerror(errno); return false; }
+        void* p = ::mmap(nullptr, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (p == MAP_FAILED) { err = std::strerror(errno); return false; }
+        base_ = static_cast<uint8_t*>(p);
+        map_size_ = new_size;
+        hdr_ = reinterpret_cast<Header*>(base_);
+        data_ = base_ + HEADER_BYTES;
+        init_header(new_size - HEADER_BYTES);
+
+        // keep the newest records that fit, in their original order
+        size_t first = sizes.size();
+        uint64_t keep = 0;
+        while (first > 0 && keep + sizes[first - 1] <= hdr_->data_size) keep += sizes[--first];
+        uint64_t skip = 0;
+        for (size_t i = 0; i < first; ++i) skip += sizes[i];
+        if (keep) std::memcpy(data_, recs.data() + skip, static_cast<size_t>(keep));
+        evicted_.fetch_add(first, std::memory_order_relaxed);
+
+        hdr_->write_pos = keep;
+        hdr_->used      = keep;
+        hdr_->records   = sizes.size() - first;
+        records_.store(hdr_->records, std::memory_order_release);
+        return true;
+    }
+
+    int       fd_ = -1;
+    uint8_t*  base_ = nullptr;
+    size_t    map_size_ = 0;
+    Header*   hdr_ = nullptr;
+    uint8_t*  data_ = nullptr;
+    std::string topic_buf_;     // replay: NUL-terminated copy of the topic
+
+    mutable std::mutex mu_;
+    std::atomic<uint64_t> records_{0};
+    std::atomic<unsigned long long> evicted_{0};
+    std::atomic<unsigned long long> corrupt_{0};
+    uint64_t resized_from_ = 0;
+};
@@ -0,0 +1,125 @@
+// spsc_queue.hpp
+//
+// Bounded single-producer/single-consumer queue with reusable slots.
+//
+// Used to hand messages from the BMW network thread to the forwarder thread.
+// Slots are allocated once and reused: the producer fills the slot in place
+// (std::string::assign keeps its capacity), so after warm-up a handoff does not
+// allocate. Push and pop are wait-free; when the queue is full the new item is
+// rejected and counted as overflow.
+//
+// The consumer may park in wait(); the producer wakes it only when it is
+// actually parked (one futex call per burst, none while the consumer is busy).
+//
+// Single producer means one producing thread at a time: a producer thread may
+// be replaced (e.g. a rebuilt mosquitto loop thread) as long as the old one
+// has been joined before the new one starts.
+//
+// Copyright (c) 2025 Kurt, DJ0ABR – MIT License (see bmw_mqtt_bridge.cpp)
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+
+template <typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity){
+        size_t cap = 1;
+        while (cap < capacity) cap <<= 1;
+        cap_ = cap;
+        mask_ = cap - 1;
+        slots_.reset(new T[cap]);
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // ---- producer ----
+    // Slot to fill, or nullptr if the queue is full (counted as overflow).
+    T* reserve(){
+        const size_t h = head_.load(std::memory_order_relaxed);
+        if (h - tail_cache_ >= cap_) {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if (h - tail_cache_ >= cap_) {
+                overflow_.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+        }
+        return &slots_[h & mask_];
+    }
+
+    // Make the slot returned by reserve() visible to the consumer.
+    void commit(){
+        const size_t h = head_.load(std::memory_order_relaxed) + 1;
+        head_.store(h, std::memory_order_release);
+        pushed_.fetch_add(1, std::memory_order_relaxed);
+
+        const size_t depth = h - tail_cache_;
+        if (depth > high_water_.load(std::memory_order_relaxed))
+            high_water_.store(depth, std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (parked_.load(std::memory_order_relaxed)) wake();
+    }
+
+    // ---- consumer ----
+    T* front(){
+        const size_t t = tail_.load(std::memory_order_relaxed);
+        if (t == head_cache_) {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if (t == head_cache_) return nullptr;
+        }
+        return &slots_[t & mask_];
+    }
+
+    void pop(){
+        tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Park until an item is available, wake() is called or the timeout expires.
+    void wait(std::chrono::milliseconds timeout){
+        std::unique_lock<std::mutex> lk(mu_);
+        parked_.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!front()) cv_.wait_for(lk, timeout);
+        parked_.store(false, std::memory_order_relaxed);
+    }
+
+    void wake(){
+        { std::lock_guard<std::mutex> lk(mu_); }
+        cv_.notify_one();
+    }
+
+    // ---- statistics (any thread) ----
+    size_t capacity() const { return cap_; }
+    size_t depth() const {
+        return head_.load(std::memory_order_relaxed) - tail_.load(std::memory_order_relaxed);
+    }
+    size_t high_water() const { return high_water_.load(std::memory_order_relaxed); }
+    unsigned long long pushed()   const { return pushed_.load(std::memory_order_relaxed); }
+    unsigned long long overflow() const { return overflow_.load(std::memory_order_relaxed); }
+
+private:
+    std::unique_ptr<T[]> slots_;
+    size_t cap_ = 0;
+    size_t mask_ = 0;
+
+    alignas(64) std::atomic<size_t> head_{0};
+    size_t tail_cache_ = 0;                    // producer's view of tail_
+    alignas(64) std::atomic<size_t> tail_{0};
+    size_t head_cache_ = 0;                    // consumer's view of head_
+
+    alignas(64) std::atomic<size_t> high_water_{0};
+    std::atomic<unsigned long long> pushed_{0};
+    std::atomic<unsigned long long> overflow_{0};
+
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::atomic<bool> parked_{false};
+};
@@ -0,0 +1,294 @@
+// state_store.hpp
+//
+// Last-known state per vehicle for the vehicles/<VIN>/state snapshot topic
+// and the read-only HTTP API.
+//
+// Every CarData message carries a few "data.<prop>" members; the store merges
+// them into one flat record per VIN (the property's JSON object as received,
+// e.g. {"value":..,"unit":..,"timestamp":..}) and builds a snapshot in the
+// CarData shape from it:
+//
+//   {"vin":"<VIN>","timestamp":<unix of last change>,"data":{"<prop>":{...},...}}
+//
+// Publishing is coalesced: a change makes the VIN pending, and the snapshot
+// goes out coalesce_ms after the first change (everything merged meanwhile is
+// included), but not sooner than interval_ms after the previous snapshot of
+// that VIN. With interval_ms > 0 every received property counts, so snapshots
+// also go out periodically while only timestamps move.
+//
+// Versions: every property, vehicle and the VIN list carry a version from one
+// counter that moves only when their bytes change. The serialized snapshot is
+// cached per vehicle and rebuilt on the first read after a change, so the
+// API can answer repeated (conditional) GETs and MQTT snapshots from the same
+// string; wait_changed() lets long-poll requests sleep until a version moves.
+//
+// Notes:
+//   - merge() runs on the thread forwarding messages, due()/flush() on the
+//     main loop, the readers on HTTP threads; one mutex, held only for the
+//     map update / payload build.
+//   - Values are kept as raw JSON text and copied into the snapshot as-is.
+//   - Property names are JSON-escaped on output; nothing else is parsed here.
+//
+// Copyright (c) 2025 Kurt, DJ0ABR – MIT License (see bmw_mqtt_bridge.cpp)
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+class VehicleStateStore {
+public:
+    using Body = std::shared_ptr<const std::string>;
+
+    void configure(long long coalesce_ms, long long interval_ms){
+        std::lock_guard<std::mutex> lk(mu_);
+        coalesce_ms_ = coalesce_ms < 0 ? 0 : coalesce_ms;
+        interval_ms_ = interval_ms < 0 ? 0 : interval_ms;
+    }
+
+    // Merge one property (raw JSON of its object; value_hash covers value +
+    // unit). Returns true if the VIN just became pending, i.e. the caller
+    // should wake whoever calls flush().
+    bool merge(std::string_view vin, std::string_view prop, std::string_view raw,
+               uint64_t value_hash, long long now_ms){
+        std::lock_guard<std::mutex> lk(mu_);
+        Vehicle& v = vehicle(vin);
+        auto it = v.props.find(prop);
+        bool changed = true;
+        if (it == v.props.end()) {
+            it = v.props.emplace(std::string(prop), Prop{}).first;
+        } else {
+            changed = it->second.value_hash != value_hash;
+        }
+        Prop& p = it->second;
+        ++merged_;
+        if (p.version == 0 || p.raw != raw) {
+            p.raw.assign(raw.data(), raw.size());
+            p.version = v.version = ++seq_;
+            v.updated = static_cast<long>(std::time(nullptr));
+            cv_.notify_all();
+        }
+        p.value_hash = value_hash;
+
+        if (!(changed || interval_ms_ > 0) || v.pending_since) return false;
+        v.pending_since = now_ms;
+        return true;
+    }
+
+    // Restore a property from the saved state (not pending, not published).
+    void restore(std::string_view vin, std::string_view prop, std::string_view raw, uint64_t value_hash){
+        std::lock_guard<std::mutex> lk(mu_);
+        Vehicle& v = vehicle(vin);
+        Prop& p = v.props[std::string(prop)];
+        p.raw.assign(raw.data(), raw.size());
+        p.value_hash = value_hash;
+        p.version = v.version = ++seq_;
+        v.updated = static_cast<long>(std::time(nullptr));
+    }
+
+    // earliest snapshot deadline (now_ms() clock), 0 = nothing pending
+    long long due() const {
+        std::lock_guard<std::mutex> lk(mu_);
+        long long next = 0;
+        for (auto& [vin, v] : vehicles_) {
+            if (!v.pending_since) continue;
+            const long long at = due_at(v);
+            if (!next || at < next) next = at;
+        }
+        return next;
+    }
+
+    // Hand the snapshots due at now_ms to publish(vin, payload) outside the
+    // lock. Returns the number of snapshots.
+    size_t flush(long long now_ms, const std::function<void(const std::string&, const std::string&)>& publish){
+        std::vector<std::pair<std::string, Body>> out;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            for (auto& [vin, v] : vehicles_) {
+                if (!v.pending_since || now_ms < due_at(v)) continue;
+                out.emplace_back(vin, snapshot(vin, v));
+                v.pending_since = 0;
+                v.last_publish = now_ms;
+            }
+        }
+        for (auto& [vin, body] : out) publish(vin, *body);
+        return out.size();
+    }
+
+    // ---- readers (HTTP API); version 0 = not found ----
+
+    // {"vehicles":["<VIN>",...]}
+    Body vehicle_list(uint64_t& version){
+        std::lock_guard<std::mutex> lk(mu_);
+        if (!list_cache_ || list_cache_version_ != list_version_) {
+            std::string s = "{\"vehicles\":[";
+            bool first = true;
+            for (auto& [vin, v] : vehicles_) {
+                if (!first) s += ',';
+                first = false;
+                append_string(s, vin);
+            }
+            s += "]}";
+            list_cache_ = std::make_shared<const std::string>(std::move(s));
+            list_cache_version_ = list_version_;
+        }
+        version = list_version_;
+        return list_cache_;
+    }
+
+    Body vehicle_state(std::string_view vin, uint64_t& version){
+        std::lock_guard<std::mutex> lk(mu_);
+        auto it = vehicles_.find(vin);
+        if (it == vehicles_.end()) { version = 0; return nullptr; }
+        version = it->second.version;
+        return snapshot(it->first, it->second);
+    }
+
+    Body property(std::string_view vin, std::string_view prop, uint64_t& version){
+        std::lock_guard<std::mutex> lk(mu_);
+        version = 0;
+        auto it = vehicles_.find(vin);
+        if (it == vehicles_.end()) return nullptr;
+        auto pit = it->second.props.find(prop);
+        if (pit == it->second.props.end()) return nullptr;
+        version = pit->second.version;
+        return std::make_shared<const std::string>(pit->second.raw);
+    }
+
+    // Sleep until the version of the VIN list (vin empty), a vehicle (prop
+    // empty) or a property differs from known, at most max. Returns the
+    // current version.
+    uint64_t wait_changed(std::string_view vin, std::string_view prop, uint64_t known,
+                          std::chrono::milliseconds max){
+        std::unique_lock<std::mutex> lk(mu_);
+        uint64_t cur = version_of(vin, prop);
+        cv_.wait_for(lk, max, [&]{ return (cur = version_of(vin, prop)) != known; });
+        return cur;
+    }
+
+    // {"<VIN>":{"<prop>":{...},...},...} for saving across restarts
+    std::string dump() const {
+        std::lock_guard<std::mutex> lk(mu_);
+        std::string s = "{";
+        for (auto& [vin, v] : vehicles_) {
+            if (s.size() > 1) s += ',';
+            append_string(s, vin);
+            s += ':';
+            append_props(s, v);
+        }
+        s += '}';
+        return s;
+    }
+
+    size_t vehicles() const { std::lock_guard<std::mutex> lk(mu_); return vehicles_.size(); }
+    unsigned long long merged() const { std::lock_guard<std::mutex> lk(mu_); return merged_; }
+
+private:
+    struct Prop {
+        std::string raw;
+        uint64_t    value_hash = 0;
+        uint64_t    version = 0;
+    };
+    struct Vehicle {
+        std::map<std::string, Prop, std::less<>> props;   // sorted: stable snapshot order
+        uint64_t  version = 0;
+        long      updated = 0;         // unix time of the last change
+        Body      cache;               // serialized snapshot of cache_version
+        uint64_t  cache_version = 0;
+        long long pending_since = 0;   // first unpublished change, 0 = none
+        long long last_publish = 0;
+    };
+
+    Vehicle& vehicle(std::string_view vin){
+        auto it = vehicles_.find(vin);
+        if (it == vehicles_.end()) {
+            it = vehicles_.emplace(std::string(vin), Vehicle{}).first;
+            list_version_ = ++seq_;
+        }
+        return it->second;
+    }
+
+    uint64_t version_of(std::string_view vin, std::string_view prop) const {
+        if (vin.empty()) return list_version_;
+        auto it = vehicles_.find(vin);
+        if (it == vehicles_.end()) return 0;
+        if (prop.empty()) return it->second.version;
+        auto pit = it->second.props.find(prop);
+        return pit == it->second.props.end() ? 0 : pit->second.version;
+    }
+
+    long long due_at(const Vehicle& v) const {
+        const long long at = v.pending_since + coalesce_ms_;
+        return v.last_publish ? std::max(at, v.last_publish + interval_ms_) : at;
+    }
+
+    // cached snapshot, rebuilt only after a change
+    static Body snapshot(const std::string& vin, Vehicle& v){
+        if (v.cache && v.cache_version == v.version) return v.cache;
+        std::string s = "{\"vin\":";
+        append_string(s, vin);
+        s += ",\"timestamp\":";
+        s += std::to_string(v.updated);
+        s += ",\"data\":";
+        append_props(s, v);
+        s += '}';
+        v.cache = std::make_shared<const std::string>(std::move(s));
+        v.cache_version = v.version;
+        return v.cache;
+    }
+
+    static void append_props(std::string& s, const Vehicle& v){
+        s += '{';
+        bool first = true;
+        for (auto& [name, p] : v.props) {
+            if (!first) s += ',';
+            first = false;
+            append_string(s, name);
+            s += ':';
+            s += p.raw;
+        }
+        s += '}';
+    }
+
+    static void append_string(std::string& s, std::string_view v){
+        s += '"';
+        for (char c : v) {
+            switch (c) {
+            case '"':  s += "\\\""; break;
+            case '\\': s += "\\\\"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char buf[8];
+                    std::snprintf(buf, sizeof(buf), "\\u%04x", static_cast<unsigned char>(c));
+                    s += buf;
+                } else {
+                    s += c;
+                }
+            }
+        }
+        s += '"';
+    }
+
+    mutable std::mutex mu_;
+    std::condition_variable cv_;   // notified when a version moves
+    std::map<std::string, Vehicle, std::less<>> vehicles_;
+    uint64_t seq_ = 0;
+    uint64_t list_version_ = 0;
+    Body     list_cache_;
+    uint64_t list_cache_version_ = 0;
+    long long coalesce_ms_ = 1000;
+    long long interval_ms_ = 0;
+    unsigned long long merged_ = 0;
+};
@@ -0,0 +1,142 @@
+// tls_cache.hpp
+//
+// Shared client SSL_CTX with TLS session resumption for the BMW connection.
+//
+// mosquitto_tls_set() makes every new mosquitto client build its own SSL_CTX
+// and parse the whole CA bundle again, and each new connection does a full
+// TLS handshake. TlsClientCache builds one SSL_CTX at startup (CA bundle
+// parsed once) that every BMW client uses via MOSQ_OPT_SSL_CTX, and keeps the
+// last session ticket the server issued. When the next connection starts its
+// handshake the ticket is offered, so rebuilds and token refresh reconnects
+// can do an abbreviated handshake.
+//
+// libmosquitto has no hook between SSL_new() and SSL_connect(), so the
+// session (and the host name for certificate verification, which mosquitto
+// only configures in its own SSL_CTX) is set from the info callback at the
+// start of the first handshake. SNI is still set by libmosquitto.
+//
+// Copyright (c) 2025 Kurt, DJ0ABR – MIT License (see bmw_mqtt_bridge.cpp)
+
+#pragma once
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509_vfy.h>
+
+#include <chrono>
+#include <ctime>
+#include <functional>
+#include <mutex>
+#include <string>
+
+class TlsClientCache {
+public:
+    // called once per completed handshake (on the connecting thread)
+    using HandshakeHook = std::function<void(double seconds, bool resumed)>;
+
+    TlsClientCache() = default;
+    ~TlsClientCache(){
+        if (session_) SSL_SESSION_free(session_);
+        if (ctx_) SSL_CTX_free(ctx_);
+    }
+
+    TlsClientCache(const TlsClientCache&) = delete;
+    TlsClientCache& operator=(const TlsClientCache&) = delete;
+
+    // Build the context and load the CA bundle; host is verified against the
+    // server certificate. On failure err is set and ctx() stays nullptr.
+    bool init(const std::string& ca_file, const std::string& host, std::string& err){
+        host_ = host;
+        SSL_CTX* ctx = SSL_CTX_new(TLS_client_method());
+        if (!ctx) { err = last_error(); return false; }
+
+        SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+        if (SSL_CTX_load_verify_locations(ctx, ca_file.c_str(), nullptr) != 1) {
+            err = "cannot load CA file " + ca_file + ": " + last_error();
+            SSL_CTX_free(ctx);
+            return false;
+        }
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+
+        // keep client sessions ourselves (one server, one ticket)
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(ctx, &TlsClientCache::new_session_cb);
+        SSL_CTX_set_info_callback(ctx, &TlsClientCache::info_cb);
+        SSL_CTX_set_app_data(ctx, this);
+
+        ctx_ = ctx;
+        return true;
+    }
+
+    // shared context; libmosquitto takes its own reference (MOSQ_OPT_SSL_CTX)
+    SSL_CTX* ctx() const { return ctx_; }
+
+    void set_handshake_hook(HandshakeHook h){ hook_ = std::move(h); }
+
+private:
+    static TlsClientCache* self(const SSL* ssl){
+        return static_cast<TlsClientCache*>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+    }
+
+    // takes ownership of sess (returning 1 keeps OpenSSL's reference for us)
+    static int new_session_cb(SSL* ssl, SSL_SESSION* sess){
+        TlsClientCache* c = self(ssl);
+        if (!c) return 0;
+        std::lock_guard<std::mutex> lk(c->mu_);
+        if (c->session_) SSL_SESSION_free(c->session_);
+        c->session_ = sess;
+        return 1;
+    }
+
+    static void info_cb(const SSL* cssl, int where, int /*ret*/){
+        TlsClientCache* c = self(cssl);
+        if (!c) return;
+        SSL* ssl = const_cast<SSL*>(cssl);   // callback API is const, setters are not
+
+        HandshakeState& st = hs();
+        if ((where & SSL_CB_HANDSHAKE_START) && SSL_in_before(ssl)) {
+            st.ssl = cssl;
+            st.reported = false;
+            st.start = std::chrono::steady_clock::now();
+
+            if (!c->host_.empty()) SSL_set1_host(ssl, c->host_.c_str());
+
+            std::lock_guard<std::mutex> lk(c->mu_);
+            if (c->session_ && SSL_SESSION_is_resumable(c->session_) &&
+                SSL_SESSION_get_time(c->session_) + SSL_SESSION_get_timeout(c->session_) > std::time(nullptr)) {
+                SSL_set_session(ssl, c->session_);
+            }
+            return;
+        }
+
+        // TLS 1.3 also signals "done" after post-handshake messages: report once
+        if ((where & SSL_CB_HANDSHAKE_DONE) && st.ssl == cssl && !st.reported) {
+            st.reported = true;
+            const double secs = std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - st.start).count();
+            if (c->hook_) c->hook_(secs, SSL_session_reused(ssl) == 1);
+        }
+    }
+
+    static std::string last_error(){
+        char buf[256];
+        unsigned long e = ERR_get_error();
+        if (!e) return "unknown error";
+        ERR_error_string_n(e, buf, sizeof(buf));
+        return buf;
+    }
+
+    // handshake in progress on this thread (each mosquitto loop has its own)
+    struct HandshakeState {
+        const SSL* ssl = nullptr;
+        bool       reported = true;
+        std::chrono::steady_clock::time_point start;
+    };
+    static HandshakeState& hs(){ static thread_local HandshakeState s; return s; }
+
+    SSL_CTX*      ctx_ = nullptr;
+    std::string   host_;
+    HandshakeHook hook_;
+    std::mutex    mu_;
+    SSL_SESSION*  session_ = nullptr;   // guarded by mu_
+};
@@ -0,0 +1,106 @@
+// topic_alias.hpp
+//
+// MQTT v5 topic alias allocation for the local client (LRU).
+//
+// With a topic alias the full topic string is sent once per connection; later
+// publishes to the same topic carry only a two-byte alias. The broker tells in
+// its CONNACK how many aliases a client may use (Topic Alias Maximum). When
+// all are taken, the least recently used alias is reassigned to the new topic
+// (the publish that remaps it sends topic + alias again).
+//
+//   lookup(topic, qos) → { alias, known }
+//     alias == 0       no aliasing (disabled / not connected / qos > 0): send the topic
+//     known == false   send topic + alias: establishes (or remaps) the alias
+//     known == true    send the alias only (empty topic)
+//
+// Limit: an alias is remapped without knowing which packets still refer to
+// it. That is only safe for packets written to the connection in publish
+// order - QoS 0. libmosquitto holds QoS 1/2 packets back (in-flight window)
+// and resends them after a reconnect; an alias in such a packet could name a
+// different topic by then, or redefine one that is in use. So qos > 0 never
+// gets an alias and must carry the full topic.
+//
+// Notes:
+//   - Aliases are per connection: reset() on every CONNACK (and disconnect).
+//     QoS 0 packets still queued at a disconnect are dropped by libmosquitto.
+//   - Not thread-safe; the caller holds its publish lock across lookup() and
+//     the publish itself, so the broker sees an alias defined before it is used.
+//   - forget() undoes an assignment whose publish failed.
+//
+// Copyright (c) 2025 Kurt, DJ0ABR – MIT License (see bmw_mqtt_bridge.cpp)
+
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+class TopicAliasLru {
+public:
+    struct Result {
+        uint16_t alias = 0;
+        bool     known = false;
+    };
+
+    // new connection: drop all aliases, allow up to max (0 = aliasing off)
+    void reset(uint16_t max){
+        max_ = max;
+        lru_.clear();
+        map_.clear();
+    }
+
+    uint16_t max() const { return max_; }
+    size_t size() const { return map_.size(); }
+
+    Result lookup(std::string_view topic, int qos){
+        if (!max_ || qos > 0) return {};
+        key_.assign(topic.data(), topic.size());
+        auto it = map_.find(key_);
+        if (it != map_.end()) {
+            lru_.splice(lru_.begin(), lru_, it->second);   // most recently used
+            ++hits_;
+            return {it->second->second, true};
+        }
+
+        uint16_t alias;
+        if (lru_.size() < max_) {
+            alias = static_cast<uint16_t>(lru_.size() + 1);
+        } else {
+            alias = lru_.back().second;                     // reuse the oldest
+            if (!lru_.back().first.empty()) {
+                map_.erase(lru_.back().first);
+                ++remaps_;
+            }
+            lru_.pop_back();
+        }
+        lru_.emplace_front(key_, alias);
+        map_.emplace(key_, lru_.begin());
+        return {alias, false};
+    }
+
+    // the publish that should have established topic's alias failed
+    void forget(std::string_view topic){
+        key_.assign(topic.data(), topic.size());
+        auto it = map_.find(key_);
+        if (it == map_.end()) return;
+        auto e = it->second;
+        map_.erase(it);
+        e->first.clear();                    // alias stays allocated but unowned ...
+        lru_.splice(lru_.end(), lru_, e);    // ... and is the next one reused
+    }
+
+    unsigned long long hits()   const { return hits_; }
+    unsigned long long remaps() const { return remaps_; }
+
+private:
+    using Entry = std::pair<std::string, uint16_t>;   // topic, alias
+
+    uint16_t max_ = 0;
+    std::list<Entry> lru_;      // allocated aliases, front = most recently used
+    std::unordered_map<std::string, std::list<Entry>::iterator> map_;   // topic → entry
+    std::string key_;
+    unsigned long long hits_ = 0, remaps_ = 0;
+};
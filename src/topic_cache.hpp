@@ -0,0 +1,88 @@
+// topic_cache.hpp
+//
+// Bounded, interned lookup table for topics the bridge publishes to.
+//
+// The forward path derives the same topic strings over and over: the raw and
+// legacy topic from the incoming BMW topic, and one split topic per
+// (VIN, property). InternTable builds the value once per unique key and hands
+// out a reference on every later lookup, so sanitize_key() and the string
+// concatenation run once per key instead of once per message.
+//
+// Notes:
+//   - Not thread-safe: one table is owned by the thread that forwards messages.
+//   - Lookups reuse an internal key buffer, so a hit does not allocate.
+//   - Bounded: when max_entries is reached the least recently used entry is
+//     evicted (its node is reused for the new key), so per-key state such as
+//     the SPLIT_CHANGE_ONLY hashes survives for every key still in use.
+//     References returned by get() are only valid until the next get().
+//
+// Copyright (c) 2025 Kurt, DJ0ABR – MIT License (see bmw_mqtt_bridge.cpp)
+
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+template <typename V>
+class InternTable {
+public:
+    explicit InternTable(size_t max_entries = 4096) : max_(max_entries ? max_entries : 1) {}
+
+    void set_max_entries(size_t n){
+        max_ = n ? n : 1;
+        while (map_.size() > max_) {
+            map_.erase(std::string_view(lru_.back().first));
+            lru_.pop_back();
+            ++evictions_;
+        }
+    }
+
+    // Look up (a, b); on a miss call build() to create the value.
+    template <typename Build>
+    V& get(std::string_view a, std::string_view b, Build&& build){
+        key_.assign(a.data(), a.size());
+        key_.push_back('\x1f'); // unit separator: cannot appear in topics or VINs
+        key_.append(b.data(), b.size());
+
+        auto it = map_.find(std::string_view(key_));
+        if (it != map_.end()) {
+            ++hits_;
+            lru_.splice(lru_.begin(), lru_, it->second);
+            return it->second->second;
+        }
+
+        ++misses_;
+        if (map_.size() >= max_) {
+            // evict the least recently used key and reuse its node
+            const auto last = std::prev(lru_.end());
+            map_.erase(std::string_view(last->first));
+            lru_.splice(lru_.begin(), lru_, last);
+            last->first = key_;
+            last->second = build();
+            ++evictions_;
+        } else {
+            lru_.emplace_front(key_, build());
+        }
+        map_.emplace(std::string_view(lru_.front().first), lru_.begin());
+        return lru_.front().second;
+    }
+
+    size_t size()    const { return map_.size(); }
+    unsigned long long hits()      const { return hits_; }
+    unsigned long long misses()    const { return misses_; }
+    unsigned long long evictions() const { return evictions_; }
+
+private:
+    using Entry = std::pair<std::string, V>;
+
+    size_t max_;
+    std::string key_;
+    std::list<Entry> lru_;   // front = most recently used; nodes own the keys
+    std::unordered_map<std::string_view, typename std::list<Entry>::iterator> map_;
+    unsigned long long hits_ = 0, misses_ = 0, evictions_ = 0;
+};